@@ -7,6 +7,7 @@ WARNING="-Dwarning_level=${WARNING_LEVEL}"
 
 BUILDTYPE_RELEASE="-Dbuildtype=release" # default debug
 SQUASH2="-Dsquash2=true" # default false
+SQUASH3="-Dsquash3=true" # default false
 CPPUNIT="-Dcppunit=true" # default false
 
 MESON_BUILD=./meson.build
@@ -61,7 +62,7 @@ assert_bin() {
 }
 
 for a in "" ${BUILDTYPE_RELEASE}; do
-	for b in "" ${SQUASH2}; do
+	for b in "" ${SQUASH2} ${SQUASH3}; do
 		for c in "" ${CPPUNIT}; do
 			echo "========================================"
 			clean_builddir
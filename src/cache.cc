@@ -0,0 +1,501 @@
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./cache.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./util.h"
+#include "./xattr.h"
+
+namespace {
+const std::string CACHE_MAGIC("DHCACHE1");
+const std::size_t CACHE_KEY_SIZE = 16; // st_dev + st_ino
+
+HashCache* _cache;
+std::mutex _cache_mutex; // hashing may run in parallel
+std::mt19937 _rand{std::random_device{}()};
+
+std::string get_cache_key(const struct stat& st, const std::string& hash_algo) {
+	std::uint64_t x[2] = {
+		static_cast<std::uint64_t>(st.st_dev),
+		static_cast<std::uint64_t>(st.st_ino),
+	};
+	std::string s(reinterpret_cast<const char*>(x), sizeof(x));
+	return s + hash_algo;
+}
+
+template <typename T>
+bool read_value(std::FILE* fp, T& x) {
+	return std::fread(&x, sizeof(x), 1, fp) == 1;
+}
+
+bool read_string(std::FILE* fp, std::string& s) {
+	std::uint8_t n;
+	if (!read_value(fp, n))
+		return false;
+	s.resize(n);
+	return n == 0 || std::fread(&s[0], 1, n, fp) == n;
+}
+
+template <typename T>
+void write_value(std::ostringstream& ss, const T& x) {
+	ss.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+void write_string(std::ostringstream& ss, const std::string& s) {
+	assert(s.size() <= 0xff);
+	write_value(ss, static_cast<std::uint8_t>(s.size()));
+	ss << s;
+}
+} // namespace
+
+HashCache::HashCache(void):
+	_map{},
+	_path{},
+	_fp(nullptr),
+	_num_record(0) {
+}
+
+HashCache::~HashCache(void) {
+	close_cache();
+}
+
+int HashCache::open_cache(const std::string& f) {
+	assert(!_fp);
+	_fp = std::fopen(f.c_str(), "a+b");
+	if (!_fp)
+		return -errno;
+	_path = f;
+	auto ret = load_cache();
+	if (ret < 0) {
+		std::fclose(_fp);
+		_fp = nullptr;
+	}
+	return ret;
+}
+
+// compact on close if more than half of records are stale
+int HashCache::close_cache(void) {
+	if (!_fp)
+		return 0;
+	auto ret = 0;
+	if (_num_record > 2 * _map.size())
+		ret = compact_cache();
+	if (_fp && std::fclose(_fp) && ret == 0)
+		ret = -errno;
+	_fp = nullptr;
+	_map.clear();
+	_num_record = 0;
+	return ret;
+}
+
+// rewrite live records and atomically replace the cache file
+int HashCache::compact_cache(void) {
+	assert(_fp);
+	auto tmp = _path + ".tmp";
+	auto* fp = std::fopen(tmp.c_str(), "wb");
+	if (!fp)
+		return -errno;
+	if (std::fwrite(CACHE_MAGIC.data(), 1, CACHE_MAGIC.size(), fp) !=
+		CACHE_MAGIC.size()) {
+		auto error = errno;
+		std::fclose(fp);
+		return -error;
+	}
+	for (const auto& [key, rec] : _map) {
+		auto ret = append_record(fp, key, rec);
+		if (ret < 0) {
+			std::fclose(fp);
+			return ret;
+		}
+	}
+	if (std::fflush(fp) || fsync(fileno(fp)) || std::fclose(fp))
+		return -errno;
+	if (std::rename(tmp.c_str(), _path.c_str()))
+		return -errno;
+
+	std::fclose(_fp);
+	_fp = std::fopen(_path.c_str(), "a+b");
+	if (!_fp)
+		return -errno;
+	_num_record = _map.size();
+	return 0;
+}
+
+bool HashCache::get_cache(const struct stat& st, const std::string& hash_algo,
+	std::vector<char>& b) const {
+	const auto it = _map.find(get_cache_key(st, hash_algo));
+	if (it == _map.end())
+		return false;
+	const auto& rec = it->second;
+	if (rec.size != static_cast<std::uint64_t>(st.st_size) ||
+		rec.mtime_ns != get_mtime_ns(st) ||
+		rec.ctime_ns != get_ctime_ns(st))
+		return false;
+	b = rec.digest;
+	return true;
+}
+
+// memory only unless opened
+int HashCache::put_cache(const struct stat& st, const std::string& hash_algo,
+	const std::vector<char>& b) {
+	auto key = get_cache_key(st, hash_algo);
+	Record rec{static_cast<std::uint64_t>(st.st_size), get_mtime_ns(st),
+		get_ctime_ns(st), b};
+	if (_fp) {
+		auto ret = append_record(_fp, key, rec);
+		if (ret < 0)
+			return ret;
+	}
+	_map[key] = rec;
+	_num_record++;
+	return 0;
+}
+
+int HashCache::load_cache(void) {
+	if (std::fseek(_fp, 0, SEEK_SET))
+		return -errno;
+	std::string magic(CACHE_MAGIC.size(), '\0');
+	auto n = std::fread(&magic[0], 1, magic.size(), _fp);
+	if (n == 0) {
+		// new cache file
+		if (std::fseek(_fp, 0, SEEK_END))
+			return -errno;
+		if (std::fwrite(CACHE_MAGIC.data(), 1, CACHE_MAGIC.size(),
+			_fp) != CACHE_MAGIC.size() || std::fflush(_fp))
+			return -errno;
+		return 0;
+	}
+	if (n != magic.size() || magic != CACHE_MAGIC)
+		return -EINVAL;
+
+	while (1) {
+		auto off = std::ftell(_fp);
+		std::string key(CACHE_KEY_SIZE, '\0'), hash_algo, digest;
+		Record rec;
+		if (std::fread(&key[0], 1, key.size(), _fp) != key.size() ||
+			!read_value(_fp, rec.size) ||
+			!read_value(_fp, rec.mtime_ns) ||
+			!read_value(_fp, rec.ctime_ns) ||
+			!read_string(_fp, hash_algo) ||
+			!read_string(_fp, digest)) {
+			if (std::ferror(_fp))
+				return -EIO;
+			// drop partially appended record if any
+			if (std::fseek(_fp, 0, SEEK_END))
+				return -errno;
+			if (std::ftell(_fp) != off &&
+				ftruncate(fileno(_fp), off) == -1)
+				return -errno;
+			break;
+		}
+		rec.digest.assign(digest.begin(), digest.end());
+		_map[key + hash_algo] = rec;
+		_num_record++;
+	}
+	return 0;
+}
+
+int HashCache::append_record(std::FILE* fp, const std::string& key,
+	const Record& rec) {
+	assert(key.size() > CACHE_KEY_SIZE);
+	std::ostringstream ss;
+	ss << key.substr(0, CACHE_KEY_SIZE);
+	write_value(ss, rec.size);
+	write_value(ss, rec.mtime_ns);
+	write_value(ss, rec.ctime_ns);
+	write_string(ss, key.substr(CACHE_KEY_SIZE));
+	write_string(ss, std::string(rec.digest.begin(), rec.digest.end()));
+	auto s = ss.str();
+	if (std::fwrite(s.data(), 1, s.size(), fp) != s.size())
+		return -errno;
+	return 0;
+}
+
+int cache_init(const std::string& f) {
+	assert(!_cache);
+	_cache = new HashCache();
+	auto ret = _cache->open_cache(f);
+	if (ret < 0) {
+		delete _cache;
+		_cache = nullptr;
+	}
+	return ret;
+}
+
+// memory only, e.g. resident server
+int cache_init(void) {
+	assert(!_cache);
+	_cache = new HashCache();
+	return 0;
+}
+
+int cache_cleanup(void) {
+	if (!_cache)
+		return 0;
+	auto ret = _cache->close_cache();
+	delete _cache;
+	_cache = nullptr;
+	return ret;
+}
+
+namespace {
+// caller holds _cache_mutex
+void put_db_hash(const struct stat& st, const std::string& hash_algo,
+	const std::vector<char>& b) {
+	auto ret = _cache->put_cache(st, hash_algo, b);
+	if (ret < 0)
+		throw std::runtime_error(std::string("cache: ") +
+			strerror(-ret));
+}
+
+// store=false leaves storing to caller, e.g. after setting xattr
+hash_res get_db_file_hash(const std::string& f, const std::string& hash_algo,
+	bool store=true) {
+	struct stat st1;
+	if (!_cache || stat(f.c_str(), &st1) == -1 || !S_ISREG(st1.st_mode))
+		return get_file_hash(f, hash_algo);
+
+	std::vector<char> b;
+	bool hit;
+	{
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		hit = _cache->get_cache(st1, hash_algo, b);
+		// revalidate random sample in strict mode
+		std::uniform_int_distribution<unsigned long> d(0, 99);
+		if (hit && d(_rand) >= opt.cache_strict)
+			return {b, static_cast<unsigned long>(st1.st_size)};
+	}
+
+	auto res = get_file_hash(f, hash_algo);
+	const auto& [x, _ignore] = res;
+	std::lock_guard<std::mutex> lock(_cache_mutex);
+	if (hit) {
+		if (x == b)
+			return res;
+		get_output() << "Cache mismatch " << f << std::endl;
+	}
+
+	// don't cache if modified while hashing
+	struct stat st2;
+	if (store && stat(f.c_str(), &st2) == 0 &&
+		st1.st_size == st2.st_size &&
+		get_mtime_ns(st1) == get_mtime_ns(st2) &&
+		get_ctime_ns(st1) == get_ctime_ns(st2))
+		put_db_hash(st2, hash_algo, x);
+	return res;
+}
+
+// extended attribute is consulted before cache file if both enabled
+hash_res get_xattr_file_hash(const std::string& f,
+	const std::string& hash_algo) {
+	auto fd = open(f.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return get_db_file_hash(f, hash_algo);
+
+	struct stat st1;
+	std::vector<char> b;
+	if (fstat(fd, &st1) == -1 || !S_ISREG(st1.st_mode)) {
+		close(fd);
+		return get_db_file_hash(f, hash_algo);
+	} else if (get_xattr_hash(fd, st1, hash_algo, b)) {
+		close(fd);
+		return {b, static_cast<unsigned long>(st1.st_size)};
+	}
+
+	hash_res res;
+	try {
+		res = get_db_file_hash(f, hash_algo, false);
+
+		// don't store if modified while hashing, and ignore xattr
+		// errors (e.g. read-only file system or no user xattr
+		// support), setting xattr changes ctime, so cache file record
+		// is keyed by stat taken after it
+		const auto& [x, _ignore] = res;
+		struct stat st2;
+		if (fstat(fd, &st2) == 0 && st1.st_size == st2.st_size &&
+			get_mtime_ns(st1) == get_mtime_ns(st2) &&
+			get_ctime_ns(st1) == get_ctime_ns(st2)) {
+			set_xattr_hash(fd, st2, hash_algo, x);
+			if (_cache && fstat(fd, &st2) == 0) {
+				std::lock_guard<std::mutex> lock(_cache_mutex);
+				put_db_hash(st2, hash_algo, x);
+			}
+		}
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+	close(fd);
+	return res;
+}
+} // namespace
+
+// same as get_file_hash, but consult cache first if enabled
+hash_res get_cache_file_hash(const std::string& f,
+	const std::string& hash_algo) {
+	if (opt.xattr_cache)
+		return get_xattr_file_hash(f, hash_algo);
+	else
+		return get_db_file_hash(f, hash_algo);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <fstream>
+
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+namespace {
+std::string get_test_cache_path(void) {
+	auto d = std::filesystem::temp_directory_path();
+	return d / ("dirhash-cpp-cache-test." + std::to_string(getpid()));
+}
+
+struct stat get_test_stat(unsigned long ino, unsigned long size) {
+	struct stat st;
+	std::memset(&st, 0, sizeof(st));
+	st.st_dev = 1;
+	st.st_ino = ino;
+	st.st_size = static_cast<off_t>(size);
+	st.st_mtim.tv_sec = 2;
+	st.st_ctim.tv_sec = 3;
+	return st;
+}
+} // namespace
+
+void CacheTest::test_get_cache(void) {
+	auto f = get_test_cache_path();
+	HashCache cache;
+	CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), 0);
+
+	auto st = get_test_stat(1, 100);
+	std::vector<char> b1{'1'}, b;
+	CPPUNIT_ASSERT(!cache.get_cache(st, hash::SHA256, b));
+	CPPUNIT_ASSERT_EQUAL(cache.put_cache(st, hash::SHA256, b1), 0);
+	CPPUNIT_ASSERT(cache.get_cache(st, hash::SHA256, b));
+	CPPUNIT_ASSERT(b == b1);
+
+	// different hash algorithm
+	CPPUNIT_ASSERT(!cache.get_cache(st, hash::MD5, b));
+
+	// modified
+	st.st_size++;
+	CPPUNIT_ASSERT(!cache.get_cache(st, hash::SHA256, b));
+	st.st_size--;
+	st.st_mtim.tv_nsec++;
+	CPPUNIT_ASSERT(!cache.get_cache(st, hash::SHA256, b));
+	st.st_mtim.tv_nsec--;
+	st.st_ctim.tv_nsec++;
+	CPPUNIT_ASSERT(!cache.get_cache(st, hash::SHA256, b));
+
+	CPPUNIT_ASSERT_EQUAL(cache.close_cache(), 0);
+	std::filesystem::remove(f);
+
+	// memory only
+	HashCache mcache;
+	st.st_ctim.tv_nsec--;
+	CPPUNIT_ASSERT_EQUAL(mcache.put_cache(st, hash::SHA256, b1), 0);
+	CPPUNIT_ASSERT(mcache.get_cache(st, hash::SHA256, b));
+	CPPUNIT_ASSERT(b == b1);
+	CPPUNIT_ASSERT_EQUAL(mcache.num_record(), 1lu);
+	CPPUNIT_ASSERT_EQUAL(mcache.close_cache(), 0);
+	CPPUNIT_ASSERT(!std::filesystem::exists(f));
+}
+
+void CacheTest::test_open_cache(void) {
+	auto f = get_test_cache_path();
+	std::vector<char> b1{'1'}, b2{'2', '2'}, b;
+	{
+		HashCache cache;
+		CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), 0);
+		CPPUNIT_ASSERT_EQUAL(cache.put_cache(get_test_stat(1, 1),
+			hash::SHA256, b1), 0);
+		CPPUNIT_ASSERT_EQUAL(cache.put_cache(get_test_stat(2, 2),
+			hash::SHA256, b2), 0);
+	}
+
+	// partially appended record is dropped
+	std::FILE* fp = std::fopen(f.c_str(), "ab");
+	CPPUNIT_ASSERT(fp);
+	std::fputs("xxx", fp);
+	std::fclose(fp);
+	auto siz = std::filesystem::file_size(f);
+
+	HashCache cache;
+	CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), 0);
+	CPPUNIT_ASSERT_EQUAL(cache.num_cache(), 2lu);
+	CPPUNIT_ASSERT(cache.get_cache(get_test_stat(1, 1), hash::SHA256, b));
+	CPPUNIT_ASSERT(b == b1);
+	CPPUNIT_ASSERT(cache.get_cache(get_test_stat(2, 2), hash::SHA256, b));
+	CPPUNIT_ASSERT(b == b2);
+	CPPUNIT_ASSERT_EQUAL(std::filesystem::file_size(f), siz - 3);
+	CPPUNIT_ASSERT_EQUAL(cache.close_cache(), 0);
+	std::filesystem::remove(f);
+
+	// not a cache file
+	fp = std::fopen(f.c_str(), "wb");
+	CPPUNIT_ASSERT(fp);
+	std::fputs("xxxxxxxxxxxxxxxx", fp);
+	std::fclose(fp);
+	CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), -EINVAL);
+	std::filesystem::remove(f);
+}
+
+void CacheTest::test_compact_cache(void) {
+	auto f = get_test_cache_path();
+	std::vector<char> b1{'1'}, b;
+	{
+		HashCache cache;
+		CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), 0);
+		for (unsigned long i = 0; i < 10; i++)
+			CPPUNIT_ASSERT_EQUAL(cache.put_cache(get_test_stat(1,
+				i), hash::SHA256, b1), 0);
+		CPPUNIT_ASSERT_EQUAL(cache.num_cache(), 1lu);
+		CPPUNIT_ASSERT_EQUAL(cache.num_record(), 10lu);
+	}
+
+	HashCache cache;
+	CPPUNIT_ASSERT_EQUAL(cache.open_cache(f), 0);
+	CPPUNIT_ASSERT_EQUAL(cache.num_cache(), 1lu);
+	CPPUNIT_ASSERT_EQUAL(cache.num_record(), 1lu);
+	CPPUNIT_ASSERT(cache.get_cache(get_test_stat(1, 9), hash::SHA256, b));
+	CPPUNIT_ASSERT_EQUAL(cache.close_cache(), 0);
+	std::filesystem::remove(f);
+}
+
+void CacheTest::test_get_cache_file_hash(void) {
+	auto f = get_test_cache_path();
+	{
+		std::ofstream ofs(f);
+		ofs << "abc";
+	}
+	CPPUNIT_ASSERT_EQUAL(cache_init(), 0);
+	opt.xattr_cache = true;
+	auto res = get_cache_file_hash(f, hash::SHA256);
+	opt.xattr_cache = false;
+	CPPUNIT_ASSERT(res == get_file_hash(f, hash::SHA256));
+
+	// cache file record matches file after xattr is set if supported
+	struct stat st;
+	std::vector<char> b;
+	CPPUNIT_ASSERT_EQUAL(stat(f.c_str(), &st), 0);
+	CPPUNIT_ASSERT(_cache->get_cache(st, hash::SHA256, b));
+	CPPUNIT_ASSERT(b == std::get<0>(res));
+	CPPUNIT_ASSERT_EQUAL(cache_cleanup(), 0);
+	std::filesystem::remove(f);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CacheTest);
+#endif
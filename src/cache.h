@@ -0,0 +1,81 @@
+#ifndef SRC_CACHE_H_
+#define SRC_CACHE_H_
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <random>
+#include <cstdio>
+#include <cstdint>
+
+#include <sys/stat.h>
+
+#include "./hash.h"
+
+// Append-only on-disk digest store keyed by
+// (st_dev, st_ino, size, mtime_ns, ctime_ns, hash algorithm).
+// Later records of the same (st_dev, st_ino, hash algorithm) win.
+// Kept in memory only if never opened.
+class HashCache {
+	public:
+	HashCache(void);
+	~HashCache(void);
+	HashCache(const HashCache&) = delete;
+	HashCache& operator=(const HashCache&) = delete;
+	int open_cache(const std::string&);
+	int close_cache(void);
+	int compact_cache(void);
+	bool get_cache(const struct stat&, const std::string&,
+		std::vector<char>&) const;
+	int put_cache(const struct stat&, const std::string&,
+		const std::vector<char>&);
+	unsigned long num_cache(void) const {
+		return static_cast<unsigned long>(_map.size());
+	}
+	unsigned long num_record(void) const {
+		return _num_record;
+	}
+
+	private:
+	struct Record {
+		std::uint64_t size;
+		std::int64_t mtime_ns;
+		std::int64_t ctime_ns;
+		std::vector<char> digest;
+	};
+	int load_cache(void);
+	int append_record(std::FILE*, const std::string&, const Record&);
+
+	std::unordered_map<std::string, Record> _map; // dev, ino, hash algo
+	std::string _path;
+	std::FILE* _fp;
+	unsigned long _num_record; // including stale ones
+};
+
+int cache_init(const std::string&);
+int cache_init(void);
+int cache_cleanup(void);
+hash_res get_cache_file_hash(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class CacheTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(CacheTest);
+	CPPUNIT_TEST(test_get_cache);
+	CPPUNIT_TEST(test_open_cache);
+	CPPUNIT_TEST(test_compact_cache);
+	CPPUNIT_TEST(test_get_cache_file_hash);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_cache(void);
+	void test_open_cache(void);
+	void test_compact_cache(void);
+	void test_get_cache_file_hash(void);
+};
+#endif
+#endif // SRC_CACHE_H_
@@ -0,0 +1,382 @@
+#include <sstream>
+#include <filesystem>
+#include <fstream>
+#include <array>
+#include <unordered_set>
+
+#include <cassert>
+
+#include <unistd.h>
+
+#include "./cdc.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./util.h"
+
+const std::string CDC_LABEL("cdc");
+const int CDC_VERSION = 1;
+
+namespace {
+// 64 bit gear table, fixed so that boundaries are stable across runs
+std::array<std::uint64_t, 256> get_gear_table(void) {
+	std::array<std::uint64_t, 256> a;
+	std::uint64_t x = 0;
+	for (auto& v : a) {
+		// splitmix64
+		x += 0x9e3779b97f4a7c15;
+		auto z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		v = z ^ (z >> 31);
+	}
+	return a;
+}
+
+const std::array<std::uint64_t, 256> _gear = get_gear_table();
+
+// ranges at least this long are scanned by 4 interleaved lanes
+const std::size_t CDC_LANE_MIN_SIZE = 1024;
+
+// advance u over [u, q) up to and including the first byte whose
+// fingerprint has no bit of mask set, true if found
+bool scan_cut(const unsigned char*& u, const unsigned char* q,
+	std::uint64_t& fp, std::uint64_t mask) {
+	auto x = fp;
+	while (u < q) {
+		x = (x << 1) + _gear[*u++];
+		if (!(x & mask)) {
+			fp = x;
+			return true;
+		}
+	}
+	fp = x;
+	return false;
+}
+
+// Same as above, but the fingerprint only depends on the last 64 bytes,
+// i.e. fp_i = sum of gear[b_{i-k}] << k for k < 64, so [u, q) is split
+// into 4 segments scanned side by side, each after hashing the 64 bytes
+// before it, which breaks the dependency chain of a single scan. Lanes are
+// kept in named variables, arrays of them end up in memory.
+bool scan_cut_lane(const unsigned char*& u, const unsigned char* q,
+	std::uint64_t& fp, std::uint64_t mask) {
+	auto n = static_cast<std::size_t>(q - u) / 4;
+	assert(n >= 64);
+	const auto* p0 = u;
+	const auto* p1 = p0 + n;
+	const auto* p2 = p1 + n;
+	const auto* p3 = p2 + n;
+	std::uint64_t x0 = fp, x1 = 0, x2 = 0, x3 = 0;
+	for (std::size_t k = 64; k > 0; k--) {
+		x1 = (x1 << 1) + _gear[p1[-k]];
+		x2 = (x2 << 1) + _gear[p2[-k]];
+		x3 = (x3 << 1) + _gear[p3[-k]];
+	}
+
+	std::size_t k = 0;
+	for (; k < n; k++) {
+		x0 = (x0 << 1) + _gear[p0[k]];
+		x1 = (x1 << 1) + _gear[p1[k]];
+		x2 = (x2 << 1) + _gear[p2[k]];
+		x3 = (x3 << 1) + _gear[p3[k]];
+		if (!((x0 & mask) && (x1 & mask) && (x2 & mask) &&
+			(x3 & mask)))
+			break;
+	}
+	if (k == n) {
+		// last segment also has the remainder
+		u = p3 + n;
+		fp = x3;
+		return scan_cut(u, q, fp, mask);
+	}
+
+	// earlier lanes may still cut after k within their segment
+	k++;
+	for (const auto& [p, x] : {std::pair{p0, x0}, std::pair{p1, x1},
+		std::pair{p2, x2}, std::pair{p3, x3}}) {
+		u = p + k;
+		fp = x;
+		if (!(x & mask) || scan_cut(u, p + n, fp, mask))
+			return true;
+	}
+	assert(false);
+	return false;
+}
+
+// most significant n bits, which depend on the last 64 bytes
+std::uint64_t get_cdc_mask(unsigned long n) {
+	assert(n > 0 && n < 64);
+	return ((static_cast<std::uint64_t>(1) << n) - 1) << (64 - n);
+}
+
+unsigned long get_log2(unsigned long x) {
+	unsigned long n = 0;
+	while (x >>= 1)
+		n++;
+	return n;
+}
+
+// chunk digests seen so far
+std::unordered_set<std::string> _cdc_digest;
+unsigned long _num_chunk;
+unsigned long _num_unique_byte;
+unsigned long _num_dup_byte;
+} // namespace
+
+Chunker::Chunker(unsigned long avg_size):
+	_avg_size(avg_size),
+	_min_size(avg_size / 4),
+	_max_size(avg_size * 8),
+	_mask_s(get_cdc_mask(get_log2(avg_size) + 2)),
+	_mask_l(get_cdc_mask(get_log2(avg_size) - 2)),
+	_fp(0),
+	_len(0) {
+	assert(is_valid_cdc_size(avg_size));
+}
+
+// call fn with size of each chunk completed in p
+void Chunker::update(const char* p, std::size_t n,
+	const std::function<void(std::size_t)>& fn) {
+	const auto* u = reinterpret_cast<const unsigned char*>(p);
+	const auto* end = u + n;
+	while (u < end) {
+		// no cut point below minimum size, skip without hashing
+		if (_len < _min_size) {
+			auto x = std::min(static_cast<std::size_t>(end - u),
+				static_cast<std::size_t>(_min_size - _len));
+			u += x;
+			_len += x;
+			continue;
+		}
+		// mask is the same up to average or maximum size
+		auto len = _len;
+		auto mask = len < _avg_size ? _mask_s : _mask_l;
+		auto lim = len < _avg_size ? _avg_size : _max_size;
+		auto x = std::min(static_cast<std::size_t>(end - u),
+			static_cast<std::size_t>(lim - len));
+		const auto* q = u + x;
+		// cut points are rare below average size, where lanes seldom
+		// scan past one, unlike above where they are 16 times as likely
+		auto cut = mask == _mask_s && x >= CDC_LANE_MIN_SIZE ?
+			scan_cut_lane(u, q, _fp, mask) :
+			scan_cut(u, q, _fp, mask);
+		_len = len + static_cast<unsigned long>(x -
+			static_cast<std::size_t>(q - u));
+		if (cut || _len == _max_size) {
+			fn(_len);
+			_len = 0;
+			_fp = 0;
+		}
+	}
+}
+
+void Chunker::finish(const std::function<void(std::size_t)>& fn) {
+	if (_len)
+		fn(_len);
+	_len = 0;
+	_fp = 0;
+}
+
+// "[cdc][v1][offset,size]" appended to file path
+std::string get_cdc_label_string(const CdcChunk& x) {
+	std::ostringstream ss;
+	ss << "[" << CDC_LABEL << "][v" << CDC_VERSION << "][" << x.offset
+		<< "," << x.size << "]";
+	return ss.str();
+}
+
+// power of 2 so that masks have the expected number of bits
+bool is_valid_cdc_size(unsigned long x) {
+	return x >= 64 && x <= (1ul << 30) && (x & (x - 1)) == 0;
+}
+
+// whole file digest and per chunk digests in a single read, each buffer
+// read is fed to both digests in place
+hash_res get_file_cdc_hash(const std::string& f, const std::string& hash_algo,
+	unsigned long avg_size, std::vector<CdcChunk>& l) {
+	Chunker c(avg_size);
+	HashContext ctx(hash_algo);
+	const char* p = nullptr; // current buffer
+	std::size_t pos = 0; // bytes of p fed to ctx
+	std::size_t fed = 0; // bytes of current chunk fed to ctx
+	std::uint64_t off = 0;
+	auto cut = [&](std::size_t n) {
+		assert(n >= fed);
+		if (n > fed) { // else last chunk fed entirely
+			ctx.update(p + pos, n - fed);
+			pos += n - fed;
+		}
+		l.push_back({off, n, ctx.get_digest()});
+		off += n;
+		fed = 0;
+	};
+	auto res = get_file_hash(f, hash_algo,
+		[&](const char* q, std::size_t n) {
+		p = q;
+		pos = 0;
+		c.update(p, n, cut);
+		ctx.update(p + pos, n - pos);
+		fed += n - pos;
+	});
+	c.finish(cut);
+
+	// count duplicates across all files hashed so far
+	for (const auto& x : l) {
+		_num_chunk++;
+		if (_cdc_digest.insert(std::string(x.digest.begin(),
+			x.digest.end())).second)
+			_num_unique_byte += x.size;
+		else
+			_num_dup_byte += x.size;
+	}
+	return res;
+}
+
+void print_cdc_stat(void) {
+	print_num_format_string(_num_chunk, "chunk");
+	print_num_format_string(static_cast<unsigned long>(_cdc_digest.size()),
+		"unique chunk");
+	print_num_format_string(_num_unique_byte, "unique byte");
+	print_num_format_string(_num_dup_byte, "duplicate byte");
+	_cdc_digest.clear();
+	_num_chunk = 0;
+	_num_unique_byte = 0;
+	_num_dup_byte = 0;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+namespace {
+std::vector<char> get_test_cdc_byte(std::size_t n, std::uint64_t seed) {
+	std::vector<char> v(n);
+	auto x = seed;
+	for (auto& c : v) {
+		x = x * 6364136223846793005 + 1442695040888963407;
+		c = static_cast<char>(x >> 56);
+	}
+	return v;
+}
+
+std::vector<std::size_t> get_test_cdc_cut(const std::vector<char>& v,
+	std::size_t bsiz) {
+	Chunker c(1024);
+	std::vector<std::size_t> l;
+	auto fn = [&](std::size_t n) {
+		l.push_back(n);
+	};
+	for (std::size_t i = 0; i < v.size(); i += bsiz)
+		c.update(v.data() + i, std::min(bsiz, v.size() - i), fn);
+	c.finish(fn);
+	return l;
+}
+} // namespace
+
+void CdcTest::test_is_valid_cdc_size(void) {
+	for (const auto& x : {64ul, 1024ul, 8192ul, 1ul << 30})
+		CPPUNIT_ASSERT(is_valid_cdc_size(x));
+	for (const auto& x : {0ul, 1ul, 32ul, 1000ul, 8193ul, 1ul << 31})
+		CPPUNIT_ASSERT(!is_valid_cdc_size(x));
+}
+
+void CdcTest::test_scan_cut(void) {
+	auto v = get_test_cdc_byte(1 << 16, 4);
+	const auto* b = reinterpret_cast<const unsigned char*>(v.data());
+	for (const auto& n : {1ul, 4ul, 8ul, 12ul, 20ul}) {
+		auto mask = get_cdc_mask(n);
+		for (std::size_t off = 0; off + 4096 < v.size(); off += 997) {
+			for (const auto& siz : {256ul, 1000ul, 4096ul}) {
+				const auto* u1 = b + off;
+				const auto* u2 = b + off;
+				std::uint64_t fp1 = 12345, fp2 = 12345;
+				const auto* q = b + off + siz;
+				auto c1 = scan_cut(u1, q, fp1, mask);
+				auto c2 = scan_cut_lane(u2, q, fp2, mask);
+				CPPUNIT_ASSERT_EQUAL(c1, c2);
+				CPPUNIT_ASSERT(u1 == u2);
+				CPPUNIT_ASSERT_EQUAL(fp1, fp2);
+			}
+		}
+	}
+}
+
+void CdcTest::test_update(void) {
+	auto v = get_test_cdc_byte(1 << 20, 1);
+	auto l = get_test_cdc_cut(v, v.size());
+	CPPUNIT_ASSERT(l.size() > 1);
+	std::size_t total = 0;
+	for (std::size_t i = 0; i < l.size(); i++) {
+		total += l[i];
+		CPPUNIT_ASSERT(l[i] <= 8192);
+		if (i != l.size() - 1)
+			CPPUNIT_ASSERT(l[i] >= 256);
+	}
+	CPPUNIT_ASSERT_EQUAL(total, v.size());
+
+	// independent of read size
+	for (const auto& bsiz : {1ul, 7ul, 4096ul, 65536ul})
+		CPPUNIT_ASSERT(get_test_cdc_cut(v, bsiz) == l);
+
+	// insertion only changes chunks near it
+	auto w = v;
+	auto x = get_test_cdc_byte(100, 2);
+	w.insert(w.begin() + (1 << 19), x.begin(), x.end());
+	auto m = get_test_cdc_cut(w, w.size());
+	std::size_t i = 0;
+	while (i < l.size() && i < m.size() && l[i] == m[i])
+		i++;
+	std::size_t j = 0;
+	while (j < l.size() && j < m.size() &&
+		l[l.size() - 1 - j] == m[m.size() - 1 - j])
+		j++;
+	CPPUNIT_ASSERT(i > l.size() / 4);
+	CPPUNIT_ASSERT(j > l.size() / 4);
+	CPPUNIT_ASSERT(i + j + 4 >= l.size());
+
+	// no cut point in constant input, hence maximum size chunks
+	std::vector<char> z(20000, 0);
+	const std::vector<std::size_t> y{8192, 8192, 3616};
+	CPPUNIT_ASSERT(get_test_cdc_cut(z, 1000) == y);
+}
+
+void CdcTest::test_get_file_cdc_hash(void) {
+	auto f = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-cdc-test." + std::to_string(getpid())));
+	auto v = get_test_cdc_byte(200000, 3);
+	v.insert(v.end(), v.begin(), v.end()); // second half is duplicate
+	{
+		std::ofstream ofs(f, std::ios::binary);
+		ofs.write(v.data(), static_cast<std::streamsize>(v.size()));
+	}
+
+	std::vector<CdcChunk> l;
+	auto [b, written] = get_file_cdc_hash(f, hash::SHA256, 8192, l);
+	CPPUNIT_ASSERT(b == std::get<0>(get_byte_hash(v, hash::SHA256)));
+	CPPUNIT_ASSERT_EQUAL(written, v.size());
+	CPPUNIT_ASSERT(l.size() > 2);
+	std::uint64_t off = 0;
+	for (const auto& x : l) {
+		CPPUNIT_ASSERT_EQUAL(x.offset, off);
+		std::vector<char> y(v.begin() + static_cast<std::ptrdiff_t>(off),
+			v.begin() + static_cast<std::ptrdiff_t>(off + x.size));
+		CPPUNIT_ASSERT(x.digest ==
+			std::get<0>(get_byte_hash(y, hash::SHA256)));
+		off += x.size;
+	}
+	CPPUNIT_ASSERT_EQUAL(off, static_cast<std::uint64_t>(v.size()));
+	std::filesystem::remove(f);
+
+	// most of the second half deduplicates
+	CPPUNIT_ASSERT(_num_dup_byte > v.size() / 2 - 2 * 65536);
+	CPPUNIT_ASSERT_EQUAL(_num_unique_byte + _num_dup_byte,
+		static_cast<unsigned long>(v.size()));
+	_cdc_digest.clear();
+	_num_chunk = 0;
+	_num_unique_byte = 0;
+	_num_dup_byte = 0;
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CdcTest);
+#endif
@@ -0,0 +1,72 @@
+#ifndef SRC_CDC_H_
+#define SRC_CDC_H_
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include "./hash.h"
+
+extern const std::string CDC_LABEL;
+extern const int CDC_VERSION;
+
+struct CdcChunk {
+	std::uint64_t offset;
+	std::uint64_t size;
+	std::vector<char> digest;
+};
+
+// FastCDC content defined chunker with normalized chunking,
+// chunk size is between 1/4 and 8 times given average size.
+class Chunker {
+	public:
+	explicit Chunker(unsigned long);
+	void update(const char*, std::size_t,
+		const std::function<void(std::size_t)>&);
+	void finish(const std::function<void(std::size_t)>&);
+	unsigned long get_min_size(void) const {
+		return _min_size;
+	}
+	unsigned long get_max_size(void) const {
+		return _max_size;
+	}
+
+	private:
+	unsigned long _avg_size;
+	unsigned long _min_size;
+	unsigned long _max_size;
+	std::uint64_t _mask_s; // harder to match below average size
+	std::uint64_t _mask_l; // easier to match above average size
+	std::uint64_t _fp;
+	unsigned long _len; // of current chunk
+};
+
+std::string get_cdc_label_string(const CdcChunk&);
+bool is_valid_cdc_size(unsigned long);
+hash_res get_file_cdc_hash(const std::string&, const std::string&,
+	unsigned long, std::vector<CdcChunk>&);
+void print_cdc_stat(void);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class CdcTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(CdcTest);
+	CPPUNIT_TEST(test_is_valid_cdc_size);
+	CPPUNIT_TEST(test_scan_cut);
+	CPPUNIT_TEST(test_update);
+	CPPUNIT_TEST(test_get_file_cdc_hash);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_is_valid_cdc_size(void);
+	void test_scan_cut(void);
+	void test_update(void);
+	void test_get_file_cdc_hash(void);
+};
+#endif
+#endif // SRC_CDC_H_
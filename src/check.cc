@@ -0,0 +1,411 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <set>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+#include <cctype>
+#include <cerrno>
+#include <cassert>
+
+#include "./cache.h"
+#include "./cdc.h"
+#include "./check.h"
+#include "./dir.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./manifest.h"
+#include "./squash.h"
+#include "./util.h"
+
+namespace {
+enum class CheckStatus {
+	None,
+	Ok,
+	Failed,
+	Missing,
+	Unreadable,
+};
+
+struct CheckEntry {
+	std::string path; // as in manifest
+	std::string hex_sum;
+	CheckStatus status;
+};
+
+std::string get_check_path(const std::string& f, const std::string& base) {
+	if (is_abspath(f) || base == ".")
+		return f;
+	else if (base.ends_with("/"))
+		return base + f;
+	else
+		return base + "/" + f;
+}
+
+std::string get_check_parent(const std::string& f) {
+	auto i = f.rfind('/');
+	if (i == std::string::npos)
+		return ".";
+	else if (i == 0)
+		return "/";
+	else
+		return f.substr(0, i);
+}
+
+// same as per file hash in dir.cc
+CheckStatus check_entry(const CheckEntry& e, const std::string& base) {
+	auto f = get_check_path(e.path, base);
+	if (!path_exists(f))
+		return CheckStatus::Missing;
+
+	std::vector<char> b;
+	auto t = get_raw_file_type(f);
+	try {
+		if (t == FileType::Symlink && !opt.follow_symlink) {
+			b = std::get<0>(get_string_hash(get_basename(f),
+				opt.hash_algo));
+		} else {
+			if (t == FileType::Symlink)
+				t = get_file_type(f);
+			if (t != FileType::Reg && t != FileType::Device)
+				return CheckStatus::Failed;
+			b = std::get<0>(get_cache_file_hash(f, opt.hash_algo));
+		}
+	} catch (const std::exception& ex) {
+		return CheckStatus::Unreadable;
+	}
+	return get_hex_sum(b) == e.hex_sum ? CheckStatus::Ok :
+		CheckStatus::Failed;
+}
+
+const std::string& get_check_status_string(const CheckStatus& s) {
+	static const std::array<std::string, 4> x{
+		"OK",
+		"FAILED",
+		"MISSING",
+		"FAILED open or read",
+	};
+	switch (s) {
+	case CheckStatus::Ok:
+		return x[0];
+	case CheckStatus::Failed:
+		return x[1];
+	case CheckStatus::Missing:
+		return x[2];
+	case CheckStatus::Unreadable:
+		return x[3];
+	default:
+		assert(false);
+	}
+	throw std::runtime_error("Invalid check status");
+}
+
+// entries in directories containing listed paths, but not listed
+void find_extra(const std::vector<CheckEntry>& l, const std::string& base,
+	std::vector<std::string>& extra) {
+	std::set<std::string> listed, dirs;
+	for (const auto& e : l)
+		listed.insert(e.path);
+
+	// common ancestor of listed paths limits directories to scan
+	std::string root;
+	for (const auto& e : l) {
+		auto d = get_check_parent(e.path);
+		if (root.empty()) {
+			root = d;
+			continue;
+		}
+		while (root != d && !d.starts_with(root == "/" ? root :
+			root + "/")) {
+			if (root == "." || root == "/")
+				break;
+			root = get_check_parent(root);
+		}
+	}
+	for (const auto& e : l) {
+		auto d = get_check_parent(e.path);
+		while (dirs.insert(d).second && d != root && d != "." &&
+			d != "/")
+			d = get_check_parent(d);
+	}
+
+	std::function<void(const std::string&, bool)> scan =
+		[&](const std::string& d, bool unknown) {
+		std::vector<std::string> names;
+		try {
+			for (const auto& x : std::filesystem::directory_iterator(
+				get_check_path(d, base)))
+				names.push_back(x.path().filename());
+		} catch (const std::filesystem::filesystem_error& e) {
+			return;
+		}
+		std::sort(names.begin(), names.end());
+		for (const auto& name : names) {
+			auto f = d == "." ? name : d == "/" ? d + name :
+				d + "/" + name;
+			auto x = get_abspath(get_check_path(f, base));
+			auto t = get_raw_file_type(x);
+			if (test_ignore_entry(x, t))
+				continue;
+			if (t == FileType::Dir) {
+				if (unknown || !dirs.contains(f))
+					scan(f, true);
+			} else if (t == FileType::Symlink &&
+				opt.ignore_symlink) {
+				continue;
+			} else if (t == FileType::Reg ||
+				t == FileType::Device ||
+				t == FileType::Symlink) {
+				if (unknown || !listed.contains(f))
+					extra.push_back(f);
+			}
+		}
+	};
+	for (const auto& d : dirs)
+		scan(d, false);
+}
+} // namespace
+
+// "<hex>  <path>", or "<path>  <hex>" if swapped
+std::tuple<std::string, std::string, bool> parse_manifest_line(
+	const std::string& line, bool swap) {
+	auto s = line;
+	if (s.ends_with("\r"))
+		s.pop_back();
+	std::string f, h;
+	if (!swap) {
+		auto i = s.find("  ");
+		if (i == std::string::npos)
+			return {"", "", false};
+		h = s.substr(0, i);
+		f = s.substr(i + 2);
+	} else {
+		auto i = s.rfind("  ");
+		if (i == std::string::npos)
+			return {"", "", false};
+		f = s.substr(0, i);
+		h = s.substr(i + 2);
+	}
+
+	// squash, quick, chunk or per directory digests can't be verified
+	// per file
+	if (f.empty() || f == ".")
+		return {"", "", false};
+	if (h.ends_with("]") || (f.ends_with("]") &&
+		(f.rfind("[" + SQUASH_LABEL + "][v") != std::string::npos ||
+		f.rfind("[" + QUICK_LABEL + "][v") != std::string::npos ||
+		f.rfind("[" + CDC_LABEL + "][v") != std::string::npos)))
+		return {"", "", false};
+	auto [x, valid] = is_valid_hexsum(h);
+	if (!valid)
+		return {"", "", false};
+	for (auto& c : x)
+		c = static_cast<char>(tolower(c));
+
+	// link -> target if symlink was followed, see strip_link_target
+	return {f, x, true};
+}
+
+// path listed as link -> target if symlink was followed, but file names may
+// contain " -> " too, so split only where link under base is a symlink to
+// target, or at the first one if there is no tree to check (empty base)
+std::string strip_link_target(const std::string& f, const std::string& base) {
+	for (auto i = f.find(" -> "); i != std::string::npos;
+		i = f.find(" -> ", i + 1)) {
+		auto l = f.substr(0, i);
+		if (base.empty())
+			return l;
+		auto x = get_check_path(l, base);
+		if (get_raw_file_type(x) == FileType::Symlink &&
+			canonicalize_path(x, false) == canonicalize_path(
+			get_check_path(f.substr(i + 4), base), false))
+			return l;
+	}
+	return f;
+}
+
+// verify files listed in text or binary manifest without walking directories,
+// returns number of problems found
+int check_manifest(const std::string& manifest, const std::string& base) {
+	std::vector<CheckEntry> l;
+	unsigned long num_invalid = 0;
+	if (manifest != "-" && is_binary_manifest(manifest)) {
+		Manifest m;
+		auto ret = m.open_manifest(manifest);
+		if (ret < 0)
+			return ret;
+		if (m.get_hash_algo() != opt.hash_algo) {
+			std::cout << "Manifest uses hash algorithm "
+				<< m.get_hash_algo() << std::endl;
+			return -EINVAL;
+		}
+		m.read_entry([&](const ManifestEntry& e) {
+			l.push_back({e.path, get_hex_sum(e.digest),
+				CheckStatus::None});
+		});
+	} else {
+		std::ifstream ifs;
+		if (manifest != "-") {
+			ifs.open(manifest);
+			if (!ifs.is_open())
+				return errno ? -errno : -ENOENT;
+		}
+		auto& is = manifest == "-" ? std::cin : ifs;
+		std::string line;
+		while (std::getline(is, line)) {
+			if (line.empty())
+				continue;
+			auto [f, h, valid] = parse_manifest_line(line,
+				opt.swap);
+			if (valid)
+				l.push_back({strip_link_target(f, base), h,
+					CheckStatus::None});
+			else
+				num_invalid++;
+		}
+	}
+
+	// hash in parallel, print in manifest order
+	std::mutex mutex;
+	std::atomic<std::size_t> next_job(0);
+	std::atomic<bool> stop(false);
+	std::size_t next_print = 0;
+	unsigned long num_failed = 0, num_missing = 0;
+	auto worker = [&](void) {
+		while (!stop) {
+			auto i = next_job++;
+			if (i >= l.size())
+				break;
+			auto status = check_entry(l[i], base);
+			std::lock_guard<std::mutex> lock(mutex);
+			l[i].status = status;
+			while (next_print < l.size() &&
+				l[next_print].status != CheckStatus::None) {
+				const auto& e = l[next_print++];
+				if (stop)
+					continue;
+				if (e.status == CheckStatus::Missing)
+					num_missing++;
+				else if (e.status != CheckStatus::Ok)
+					num_failed++;
+				if (e.status != CheckStatus::Ok || opt.verbose)
+					std::cout << e.path << ": "
+						<< get_check_status_string(
+						e.status) << std::endl;
+				if (e.status != CheckStatus::Ok &&
+					opt.fail_fast)
+					stop = true;
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < opt.jobs; i++)
+		threads.push_back(new_thread(worker));
+	for (auto& t : threads)
+		t.join();
+
+	std::vector<std::string> extra;
+	if (!stop)
+		find_extra(l, base, extra);
+	for (const auto& f : extra)
+		std::cout << f << ": EXTRA" << std::endl;
+
+	if (num_invalid)
+		print_num_format_string(num_invalid,
+			"improperly formatted line");
+	if (num_failed)
+		print_num_format_string(num_failed, "mismatched file");
+	if (num_missing)
+		print_num_format_string(num_missing, "missing file");
+	if (!extra.empty())
+		print_num_format_string(extra.size(), "extra file");
+	return static_cast<int>(num_failed + num_missing + extra.size());
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <unistd.h>
+
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void CheckTest::test_parse_manifest_line(void) {
+	const std::string h("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	const std::vector<std::tuple<std::string, bool, std::string, bool>>
+	line_list{
+		{h + "  a/b", false, "a/b", true},
+		{h + "  a  b", false, "a  b", true},
+		{h + "  /a/b", false, "/a/b", true},
+		{h + "  a/b\r", false, "a/b", true},
+		{h + "  a -> b/c", false, "a -> b/c", true},
+		{"a/b  " + h, true, "a/b", true},
+		{"a  b  " + h, true, "a  b", true},
+		{h + " a/b", false, "", false},
+		{h + "  a/b", true, "", false},
+		{h + "  .", false, "", false},
+		{h + "[squash][v1]", false, "", false},
+		{h + "  a[squash][v1]", false, "", false},
+		{h + "  a[quick][v1]", false, "", false},
+		{"a[quick][v1]  " + h, true, "", false},
+		{h + "  a[cdc][v1][0,8192]", false, "", false},
+		{"a[cdc][v1][0,8192]  " + h, true, "", false},
+		{h + "[cdc][v1][0,8192]", false, "", false},
+		{"xxx  a/b", false, "", false},
+		{"", false, "", false},
+	};
+	for (const auto& x : line_list) {
+		const auto [line, swap, f, valid] = x;
+		auto [f2, h2, valid2] = parse_manifest_line(line, swap);
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(line, valid2, valid);
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(line, f2, f);
+		if (valid)
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(line, h2, h);
+	}
+
+	// upper case
+	std::string u(h);
+	for (auto& c : u)
+		c = static_cast<char>(toupper(c));
+	auto [f, h2, valid] = parse_manifest_line(u + "  a", false);
+	CPPUNIT_ASSERT(valid);
+	CPPUNIT_ASSERT_EQUAL(h2, h);
+}
+
+void CheckTest::test_strip_link_target(void) {
+	auto d = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-check-test." + std::to_string(getpid())));
+	std::filesystem::create_directory(d);
+	std::ofstream(d + "/t");
+	std::ofstream(d + "/a -> t");
+	std::filesystem::create_symlink("t", d + "/l");
+	std::filesystem::create_symlink("a -> t", d + "/m");
+
+	const std::vector<std::tuple<std::string, std::string>> path_list{
+		{"l -> t", "l"},
+		{"l -> " + d + "/t", "l"},
+		{"a -> t", "a -> t"},
+		{"m -> a -> t", "m"},
+		{"l -> u", "l -> u"},
+		{"x -> t", "x -> t"},
+		{"l", "l"},
+	};
+	for (const auto& x : path_list) {
+		const auto [input, output] = x;
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(input,
+			strip_link_target(input, d), output);
+	}
+	CPPUNIT_ASSERT_EQUAL(strip_link_target("a -> t", ""),
+		std::string("a"));
+	std::filesystem::remove_all(d);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CheckTest);
+#endif
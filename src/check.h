@@ -0,0 +1,29 @@
+#ifndef SRC_CHECK_H_
+#define SRC_CHECK_H_
+
+#include <tuple>
+#include <string>
+
+std::tuple<std::string, std::string, bool> parse_manifest_line(
+	const std::string&, bool);
+std::string strip_link_target(const std::string&, const std::string&);
+int check_manifest(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class CheckTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(CheckTest);
+	CPPUNIT_TEST(test_parse_manifest_line);
+	CPPUNIT_TEST(test_strip_link_target);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_parse_manifest_line(void);
+	void test_strip_link_target(void);
+};
+#endif
+#endif // SRC_CHECK_H_
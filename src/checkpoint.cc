@@ -0,0 +1,299 @@
+#include <filesystem>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "./cache.h"
+#include "./checkpoint.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./util.h"
+
+namespace {
+const std::string CHECKPOINT_MAGIC("DHCKPT01");
+const auto CHECKPOINT_INTERVAL = std::chrono::seconds(10);
+
+Checkpoint* _checkpoint;
+
+template <typename T>
+bool read_value(std::FILE* fp, T& x) {
+	return std::fread(&x, sizeof(x), 1, fp) == 1;
+}
+
+template <typename T>
+bool write_value(std::FILE* fp, const T& x) {
+	return std::fwrite(&x, sizeof(x), 1, fp) == 1;
+}
+
+template <typename T, typename S>
+bool read_string(std::FILE* fp, S& s) {
+	T n;
+	if (!read_value(fp, n))
+		return false;
+	s.resize(n);
+	return n == 0 || std::fread(&s[0], 1, n, fp) == n;
+}
+
+template <typename T, typename S>
+bool write_string(std::FILE* fp, const S& s) {
+	assert(s.size() <= static_cast<T>(-1));
+	return write_value(fp, static_cast<T>(s.size())) &&
+		std::fwrite(s.data(), 1, s.size(), fp) == s.size();
+}
+} // namespace
+
+Checkpoint::Checkpoint(void):
+	_path{},
+	_fp(nullptr),
+	_reading(false),
+	_off(0),
+	_next{},
+	_num_resumed(0),
+	_sync{} {
+}
+
+Checkpoint::~Checkpoint(void) {
+	close_checkpoint(false);
+}
+
+// start reading journal from the beginning if hash algorithm matches,
+// otherwise start a new one
+int Checkpoint::open_checkpoint(const std::string& f,
+	const std::string& hash_algo) {
+	assert(!_fp);
+	_fp = std::fopen(f.c_str(), "a+b");
+	if (!_fp)
+		return -errno;
+	_path = f;
+	_num_resumed = 0;
+	_sync = std::chrono::steady_clock::now();
+
+	std::string magic(CHECKPOINT_MAGIC.size(), '\0'), s;
+	auto n = std::fread(&magic[0], 1, magic.size(), _fp);
+	if (n == 0) {
+		// new checkpoint file
+		if (std::fwrite(CHECKPOINT_MAGIC.data(), 1,
+			CHECKPOINT_MAGIC.size(), _fp) != CHECKPOINT_MAGIC.size() ||
+			!write_string<std::uint8_t>(_fp, hash_algo) ||
+			std::fflush(_fp)) {
+			auto error = errno;
+			std::fclose(_fp);
+			_fp = nullptr;
+			return -error;
+		}
+		_reading = false;
+		return 0;
+	}
+	if (n != magic.size() || magic != CHECKPOINT_MAGIC ||
+		!read_string<std::uint8_t>(_fp, s) || s != hash_algo) {
+		std::fclose(_fp);
+		_fp = nullptr;
+		return -EINVAL;
+	}
+	_reading = true;
+	if (!read_record())
+		return std::ferror(_fp) ? -EIO : 0;
+	return 0;
+}
+
+// remove journal if walk completed
+int Checkpoint::close_checkpoint(bool done) {
+	if (!_fp)
+		return 0;
+	auto ret = 0;
+	if (!done && (std::fflush(_fp) || fdatasync(fileno(_fp))))
+		ret = -errno;
+	if (std::fclose(_fp) && ret == 0)
+		ret = -errno;
+	_fp = nullptr;
+	_reading = false;
+	if (done && std::remove(_path.c_str()) && ret == 0)
+		ret = -errno;
+	return ret;
+}
+
+// consume next record if it is for this file and still valid,
+// anything else means the tree changed since, so drop the rest
+bool Checkpoint::get_checkpoint(const std::string& f, const struct stat& st,
+	hash_res& res) {
+	if (!_reading)
+		return false;
+	if (_next.path != f || _next.size !=
+		static_cast<std::uint64_t>(st.st_size) ||
+		_next.mtime_ns != get_mtime_ns(st)) {
+		truncate_checkpoint(_off);
+		return false;
+	}
+	res = {_next.digest, static_cast<unsigned long>(_next.written)};
+	_num_resumed++;
+	read_record();
+	return true;
+}
+
+int Checkpoint::put_checkpoint(const std::string& f, const struct stat& st,
+	const hash_res& res) {
+	assert(_fp);
+	assert(!_reading);
+	const auto& [b, written] = res;
+	if (!write_string<std::uint32_t>(_fp, f) ||
+		!write_value(_fp, static_cast<std::uint64_t>(st.st_size)) ||
+		!write_value(_fp, get_mtime_ns(st)) ||
+		!write_value(_fp, static_cast<std::uint64_t>(written)) ||
+		!write_string<std::uint8_t>(_fp, b))
+		return -errno;
+
+	// persist periodically, not per record
+	auto t = std::chrono::steady_clock::now();
+	if (t - _sync >= CHECKPOINT_INTERVAL) {
+		if (std::fflush(_fp) || fdatasync(fileno(_fp)))
+			return -errno;
+		_sync = t;
+	}
+	return 0;
+}
+
+// read record at current offset into _next,
+// stop reading at end of journal or partially appended record
+bool Checkpoint::read_record(void) {
+	assert(_reading);
+	_off = std::ftell(_fp);
+	auto& rec = _next;
+	if (!read_string<std::uint32_t>(_fp, rec.path) ||
+		!read_value(_fp, rec.size) ||
+		!read_value(_fp, rec.mtime_ns) ||
+		!read_value(_fp, rec.written) ||
+		!read_string<std::uint8_t>(_fp, rec.digest)) {
+		truncate_checkpoint(_off);
+		return false;
+	}
+	return true;
+}
+
+// switch from reading to appending at given offset
+int Checkpoint::truncate_checkpoint(long off) {
+	_reading = false;
+	if (std::fseek(_fp, 0, SEEK_END))
+		return -errno;
+	if (std::ftell(_fp) != off && ftruncate(fileno(_fp), off) == -1)
+		return -errno;
+	if (std::fseek(_fp, 0, SEEK_END))
+		return -errno;
+	return 0;
+}
+
+int checkpoint_init(const std::string& f) {
+	assert(!_checkpoint);
+	_checkpoint = new Checkpoint();
+	auto ret = _checkpoint->open_checkpoint(f, opt.hash_algo);
+	if (ret < 0) {
+		delete _checkpoint;
+		_checkpoint = nullptr;
+	}
+	return ret;
+}
+
+int checkpoint_cleanup(bool done) {
+	if (!_checkpoint)
+		return 0;
+	auto ret = _checkpoint->close_checkpoint(done);
+	delete _checkpoint;
+	_checkpoint = nullptr;
+	return ret;
+}
+
+// same as get_cache_file_hash, but take digest from journal while resuming
+hash_res get_checkpoint_file_hash(const std::string& f,
+	const std::string& hash_algo) {
+	struct stat st;
+	if (!_checkpoint || stat(f.c_str(), &st) == -1 || !S_ISREG(st.st_mode))
+		return get_cache_file_hash(f, hash_algo);
+
+	hash_res res;
+	if (_checkpoint->get_checkpoint(f, st, res))
+		return res;
+	res = get_cache_file_hash(f, hash_algo);
+	auto ret = _checkpoint->put_checkpoint(f, st, res);
+	if (ret < 0)
+		throw std::runtime_error(std::string("checkpoint: ") +
+			strerror(-ret));
+	return res;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+namespace {
+std::string get_test_checkpoint_path(void) {
+	auto d = std::filesystem::temp_directory_path();
+	return d / ("dirhash-cpp-checkpoint-test." + std::to_string(getpid()));
+}
+
+struct stat get_test_stat(unsigned long size) {
+	struct stat st;
+	std::memset(&st, 0, sizeof(st));
+	st.st_size = static_cast<off_t>(size);
+	st.st_mtim.tv_sec = 2;
+	return st;
+}
+} // namespace
+
+void CheckpointTest::test_get_checkpoint(void) {
+	auto f = get_test_checkpoint_path();
+	std::vector<char> b1{'1'}, b2{'2', '2'};
+	hash_res res;
+	{
+		Checkpoint c;
+		CPPUNIT_ASSERT_EQUAL(c.open_checkpoint(f, hash::SHA256), 0);
+		CPPUNIT_ASSERT(!c.get_checkpoint("/a", get_test_stat(1), res));
+		for (const auto& x : {"/a", "/b", "/c"})
+			CPPUNIT_ASSERT_EQUAL(c.put_checkpoint(x,
+				get_test_stat(1), {b1, 1}), 0);
+	}
+
+	// partially appended record is dropped
+	std::FILE* fp = std::fopen(f.c_str(), "ab");
+	CPPUNIT_ASSERT(fp);
+	std::fputs("xxx", fp);
+	std::fclose(fp);
+
+	{
+		Checkpoint c;
+		CPPUNIT_ASSERT_EQUAL(c.open_checkpoint(f, hash::SHA256), 0);
+		CPPUNIT_ASSERT(c.get_checkpoint("/a", get_test_stat(1), res));
+		CPPUNIT_ASSERT(std::get<0>(res) == b1);
+		CPPUNIT_ASSERT_EQUAL(std::get<1>(res), 1lu);
+		// modified since, rest of journal is dropped
+		CPPUNIT_ASSERT(!c.get_checkpoint("/b", get_test_stat(2), res));
+		CPPUNIT_ASSERT_EQUAL(c.put_checkpoint("/b", get_test_stat(2),
+			{b2, 2}), 0);
+		CPPUNIT_ASSERT(!c.get_checkpoint("/c", get_test_stat(1), res));
+		CPPUNIT_ASSERT_EQUAL(c.num_resumed(), 1lu);
+	}
+
+	{
+		Checkpoint c;
+		CPPUNIT_ASSERT_EQUAL(c.open_checkpoint(f, hash::SHA256), 0);
+		CPPUNIT_ASSERT(c.get_checkpoint("/a", get_test_stat(1), res));
+		CPPUNIT_ASSERT(c.get_checkpoint("/b", get_test_stat(2), res));
+		CPPUNIT_ASSERT(std::get<0>(res) == b2);
+		CPPUNIT_ASSERT(!c.get_checkpoint("/c", get_test_stat(1), res));
+		CPPUNIT_ASSERT_EQUAL(c.num_resumed(), 2lu);
+		CPPUNIT_ASSERT_EQUAL(c.close_checkpoint(false), 0);
+	}
+
+	// different hash algorithm
+	Checkpoint c;
+	CPPUNIT_ASSERT_EQUAL(c.open_checkpoint(f, hash::MD5), -EINVAL);
+	CPPUNIT_ASSERT_EQUAL(c.open_checkpoint(f, hash::SHA256), 0);
+	CPPUNIT_ASSERT_EQUAL(c.close_checkpoint(true), 0);
+	CPPUNIT_ASSERT(!std::filesystem::exists(f));
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CheckpointTest);
+#endif
@@ -0,0 +1,72 @@
+#ifndef SRC_CHECKPOINT_H_
+#define SRC_CHECKPOINT_H_
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+#include <sys/stat.h>
+
+#include "./hash.h"
+
+// Append-only journal of hashed files in walk order.
+// A resumed run walks in the same sorted order, and takes digests from the
+// journal while paths line up, so output, squash and stat are rebuilt
+// without reading file data again.
+class Checkpoint {
+	public:
+	Checkpoint(void);
+	~Checkpoint(void);
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+	int open_checkpoint(const std::string&, const std::string&);
+	int close_checkpoint(bool);
+	bool get_checkpoint(const std::string&, const struct stat&, hash_res&);
+	int put_checkpoint(const std::string&, const struct stat&,
+		const hash_res&);
+	unsigned long num_resumed(void) const {
+		return _num_resumed;
+	}
+
+	private:
+	struct Record {
+		std::string path;
+		std::uint64_t size;
+		std::int64_t mtime_ns;
+		std::uint64_t written;
+		std::vector<char> digest;
+	};
+	bool read_record(void);
+	int truncate_checkpoint(long);
+
+	std::string _path;
+	std::FILE* _fp;
+	bool _reading; // journal not yet consumed
+	long _off; // offset of _next
+	Record _next;
+	unsigned long _num_resumed;
+	std::chrono::steady_clock::time_point _sync;
+};
+
+int checkpoint_init(const std::string&);
+int checkpoint_cleanup(bool);
+hash_res get_checkpoint_file_hash(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class CheckpointTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(CheckpointTest);
+	CPPUNIT_TEST(test_get_checkpoint);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_checkpoint(void);
+};
+#endif
+#endif // SRC_CHECKPOINT_H_
@@ -0,0 +1,483 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cassert>
+
+#include <sys/stat.h>
+
+#include "./cache.h"
+#include "./check.h"
+#include "./diff.h"
+#include "./dir.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./manifest.h"
+#include "./util.h"
+
+namespace {
+// results waiting to be printed, bounded so that memory doesn't grow with
+// the number of files while same size candidates are hashed
+const std::size_t DIFF_PENDING_SIZE = 4096;
+
+struct DiffJob {
+	std::string path;
+	DiffStatus status;
+	DiffEntry a;
+	DiffEntry b;
+};
+
+// one side of diff, a directory walked while merging or a manifest
+struct DiffSource {
+	TreeReader tree;
+	Manifest manifest;
+	std::vector<DiffEntry> entry; // text manifest, sorted once read
+	std::uint64_t next;
+	DiffReader reader;
+};
+
+bool compare_diff_entry(const DiffEntry& a, const DiffEntry& b) {
+	return a.path < b.path;
+}
+
+// base is the tree on the other side if any, to tell followed symlinks
+// listed in text manifest
+int open_manifest_source(const std::string& f, DiffSource& x,
+	const std::string& base) {
+	if (is_binary_manifest(f)) {
+		auto ret = x.manifest.open_manifest(f);
+		if (ret < 0)
+			return ret;
+		if (x.manifest.get_hash_algo() != opt.hash_algo) {
+			std::cout << "Manifest uses hash algorithm "
+				<< x.manifest.get_hash_algo() << std::endl;
+			return -EINVAL;
+		}
+		// size is unknown if converted from text manifest
+		x.reader = [&x](DiffEntry& e) {
+			if (x.next == x.manifest.num_entry())
+				return false;
+			auto m = x.manifest.get_entry(x.next++);
+			e = {m.path, "", m.type, m.size, m.mtime_ns != 0,
+				m.digest};
+			return true;
+		};
+		return 0;
+	}
+
+	// text manifest lines needn't be in path order
+	std::ifstream ifs(f);
+	if (!ifs.is_open())
+		return errno ? -errno : -ENOENT;
+	std::string line;
+	while (std::getline(ifs, line)) {
+		auto [path, h, valid] = parse_manifest_line(line, opt.swap);
+		if (!valid)
+			continue;
+		x.entry.push_back({strip_link_target(path, base), "",
+			FileType::Invalid, 0, false, get_hex_byte(h)});
+	}
+	std::sort(x.entry.begin(), x.entry.end(), compare_diff_entry);
+	x.reader = [&x](DiffEntry& e) {
+		if (x.next == x.entry.size())
+			return false;
+		e = std::move(x.entry[x.next++]);
+		return true;
+	};
+	return 0;
+}
+
+int open_diff_source(const std::string& f, DiffSource& x,
+	const std::string& base) {
+	x.next = 0;
+	if (get_file_type(f) != FileType::Dir)
+		return open_manifest_source(f, x, base);
+	auto ret = x.tree.open_tree(f);
+	if (ret < 0)
+		return ret;
+	x.reader = [&x](DiffEntry& e) {
+		return x.tree.get_next_entry(e);
+	};
+	return 0;
+}
+} // namespace
+
+int TreeReader::open_tree(const std::string& d) {
+	_inp = get_abspath(canonicalize_path(d));
+	_level.clear();
+	auto t = get_file_type(_inp);
+	if (t == FileType::Unsupported && !path_exists(_inp))
+		return -ENOENT;
+	else if (t != FileType::Dir)
+		return -ENOTDIR;
+	push_level(_inp);
+	return 0;
+}
+
+// children sorted by name, with "/" appended to directories so that
+// walking them depth first yields paths in string order
+void TreeReader::push_level(const std::string& d) {
+	Level x{d, {}, 0};
+	for (const auto& e : std::filesystem::directory_iterator(d)) {
+		std::string f = e.path();
+		auto t = get_raw_file_type(f);
+		auto name = get_basename(f);
+		if (t == FileType::Dir)
+			name += "/";
+		x.child.push_back({name, t});
+	}
+	std::sort(x.child.begin(), x.child.end());
+	_level.push_back(std::move(x));
+}
+
+bool TreeReader::get_next_entry(DiffEntry& e) {
+	while (!_level.empty()) {
+		auto& x = _level.back();
+		if (x.next == x.child.size()) {
+			_level.pop_back();
+			continue;
+		}
+		auto [name, t] = x.child[x.next++];
+		if (t == FileType::Dir) {
+			name.pop_back();
+			push_level(x.dir == "/" ? "/" + name :
+				x.dir + "/" + name);
+			continue;
+		}
+		auto p = x.dir == "/" ? "/" + name : x.dir + "/" + name;
+		if (test_ignore_entry(p, t))
+			continue;
+		auto f = p;
+		if (t == FileType::Symlink) {
+			if (opt.ignore_symlink)
+				continue;
+			if (opt.follow_symlink) {
+				f = canonicalize_path(p);
+				if (f.empty())
+					continue;
+				t = get_file_type(f);
+			}
+		}
+		if (t != FileType::Reg && t != FileType::Device &&
+			t != FileType::Symlink)
+			continue;
+
+		struct stat st;
+		auto ret = t == FileType::Symlink ? lstat(f.c_str(), &st) :
+			stat(f.c_str(), &st);
+		if (ret == -1)
+			continue;
+		e = {get_real_path(p, _inp), f, t,
+			static_cast<std::uint64_t>(st.st_size), true, {}};
+		return true;
+	}
+	return false;
+}
+
+// same as per file hash in dir.cc, throws if unreadable
+void get_diff_digest(DiffEntry& e) {
+	if (!e.digest.empty())
+		return;
+	assert(!e.file.empty());
+	if (e.type == FileType::Symlink)
+		e.digest = std::get<0>(get_string_hash(get_basename(e.file),
+			opt.hash_algo));
+	else
+		e.digest = std::get<0>(get_cache_file_hash(e.file,
+			opt.hash_algo));
+}
+
+const std::string& get_diff_status_string(const DiffStatus& s) {
+	static const std::array<std::string, 4> x{
+		"OK",
+		"ADDED",
+		"REMOVED",
+		"MODIFIED",
+	};
+	switch (s) {
+	case DiffStatus::Same:
+		return x[0];
+	case DiffStatus::Added:
+		return x[1];
+	case DiffStatus::Removed:
+		return x[2];
+	case DiffStatus::Modified:
+		return x[3];
+	default:
+		assert(false);
+	}
+	throw std::runtime_error("Invalid diff status");
+}
+
+// all entries of directory d in path order
+int get_tree_entry(const std::string& d, std::vector<DiffEntry>& l) {
+	TreeReader r;
+	auto ret = r.open_tree(d);
+	if (ret < 0)
+		return ret;
+	DiffEntry e;
+	while (r.get_next_entry(e))
+		l.push_back(std::move(e));
+	return 0;
+}
+
+// entry present in both, resolved by type and size where possible,
+// otherwise None until digests are compared
+DiffStatus get_diff_status(const DiffEntry& x, const DiffEntry& y) {
+	if (x.type != FileType::Invalid && y.type != FileType::Invalid &&
+		x.type != y.type)
+		return DiffStatus::Modified;
+	else if (x.has_size && y.has_size && x.size != y.size)
+		return DiffStatus::Modified;
+	else if (!x.digest.empty() && !y.digest.empty())
+		return x.digest == y.digest ? DiffStatus::Same :
+			DiffStatus::Modified;
+	return DiffStatus::None;
+}
+
+// read two sides in lockstep path order and pass each result to fn along
+// with entries of both sides, an entry of a missing side is empty
+void merge_diff_reader(const DiffReader& ra, const DiffReader& rb,
+	const DiffResultFn& fn) {
+	DiffEntry x, y, none{};
+	auto hx = ra(x);
+	auto hy = rb(y);
+	std::size_t i = 0, j = 0;
+	while (hx || hy) {
+		if (!hy || (hx && x.path < y.path)) {
+			none = {};
+			fn({x.path, DiffStatus::Removed, i, 0}, x, none);
+			i++;
+			hx = ra(x);
+		} else if (!hx || y.path < x.path) {
+			none = {};
+			fn({y.path, DiffStatus::Added, 0, j}, none, y);
+			j++;
+			hy = rb(y);
+		} else {
+			fn({x.path, get_diff_status(x, y), i, j}, x, y);
+			i++;
+			j++;
+			hx = ra(x);
+			hy = rb(y);
+		}
+	}
+}
+
+// same as above for two sorted entry lists
+std::vector<DiffResult> merge_diff_entry(const std::vector<DiffEntry>& a,
+	const std::vector<DiffEntry>& b) {
+	std::size_t i = 0, j = 0;
+	auto ra = [&](DiffEntry& e) {
+		if (i == a.size())
+			return false;
+		e = a[i++];
+		return true;
+	};
+	auto rb = [&](DiffEntry& e) {
+		if (j == b.size())
+			return false;
+		e = b[j++];
+		return true;
+	};
+	std::vector<DiffResult> l;
+	merge_diff_reader(ra, rb, [&](const DiffResult& r, DiffEntry&,
+		DiffEntry&) {
+		l.push_back(r);
+	});
+	return l;
+}
+
+// print entries differing from a to b, each of which is either a directory
+// or a manifest, while walking both in path order, returns number of
+// differences found
+int diff_input(const std::string& fa, const std::string& fb) {
+	DiffSource a, b;
+	auto ret = open_diff_source(fa, a,
+		get_file_type(fb) == FileType::Dir ? fb : "");
+	if (ret < 0)
+		return ret;
+	ret = open_diff_source(fb, b,
+		get_file_type(fa) == FileType::Dir ? fa : "");
+	if (ret < 0)
+		return ret;
+
+	// hash same size candidates in parallel, print in sorted order
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<DiffJob> pending; // in path order, printed from front
+	std::deque<DiffJob*> todo; // same size candidates not yet hashed
+	auto done = false;
+	unsigned long num_added = 0, num_removed = 0, num_modified = 0;
+	auto print = [&](void) {
+		while (!pending.empty() &&
+			pending.front().status != DiffStatus::None) {
+			const auto& x = pending.front();
+			if (x.status == DiffStatus::Added)
+				num_added++;
+			else if (x.status == DiffStatus::Removed)
+				num_removed++;
+			else if (x.status == DiffStatus::Modified)
+				num_modified++;
+			if (x.status != DiffStatus::Same || opt.verbose)
+				std::cout << x.path << ": "
+					<< get_diff_status_string(x.status)
+					<< std::endl;
+			pending.pop_front();
+		}
+		cv.notify_all();
+	};
+	auto worker = [&](void) {
+		std::unique_lock<std::mutex> lk(mutex);
+		while (true) {
+			cv.wait(lk, [&] { return !todo.empty() || done; });
+			if (todo.empty())
+				break;
+			auto& x = *todo.front();
+			todo.pop_front();
+			lk.unlock();
+			auto s = DiffStatus::Modified;
+			try {
+				get_diff_digest(x.a);
+				get_diff_digest(x.b);
+				if (x.a.digest == x.b.digest)
+					s = DiffStatus::Same;
+			} catch (const std::exception& ex) {
+				// unreadable counts as modified
+			}
+			lk.lock();
+			x.status = s;
+			print();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < opt.jobs; i++)
+		threads.push_back(new_thread(worker));
+
+	std::exception_ptr e;
+	try {
+		merge_diff_reader(a.reader, b.reader, [&](const DiffResult& r,
+			DiffEntry& x, DiffEntry& y) {
+			std::unique_lock<std::mutex> lk(mutex);
+			cv.wait(lk, [&] {
+				return pending.size() < DIFF_PENDING_SIZE;
+			});
+			pending.push_back({r.path, r.status, std::move(x),
+				std::move(y)});
+			if (r.status == DiffStatus::None) {
+				todo.push_back(&pending.back());
+				cv.notify_all();
+			} else {
+				print();
+			}
+		});
+	} catch (...) {
+		e = std::current_exception();
+	}
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		done = true;
+	}
+	cv.notify_all();
+	for (auto& t : threads)
+		t.join();
+	if (e)
+		std::rethrow_exception(e);
+	assert(pending.empty());
+
+	if (num_added)
+		print_num_format_string(num_added, "added file");
+	if (num_removed)
+		print_num_format_string(num_removed, "removed file");
+	if (num_modified)
+		print_num_format_string(num_modified, "modified file");
+	return static_cast<int>(num_added + num_removed + num_modified);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include <unistd.h>
+
+#include "./cppunit.h"
+
+void DiffTest::test_get_tree_entry(void) {
+	auto d = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-diff-test." + std::to_string(getpid()));
+	const std::vector<std::string> x{"a b", "a-b", "a.txt", "a/x", "a/y/z",
+		"a0", "b"};
+	for (const auto& f : x) {
+		std::filesystem::create_directories((d / f).parent_path());
+		std::ofstream(d / f) << f;
+	}
+	std::filesystem::create_directories(d / "c/empty");
+
+	// depth first walk yields paths in string order
+	std::vector<DiffEntry> l;
+	CPPUNIT_ASSERT_EQUAL(get_tree_entry(d, l), 0);
+	CPPUNIT_ASSERT_EQUAL(l.size(), x.size());
+	for (std::size_t i = 0; i < l.size(); i++) {
+		CPPUNIT_ASSERT_EQUAL(l[i].path, x[i]);
+		CPPUNIT_ASSERT_EQUAL(l[i].size,
+			static_cast<std::uint64_t>(x[i].size()));
+	}
+	CPPUNIT_ASSERT_EQUAL(get_tree_entry(d / "b", l), -ENOTDIR);
+	std::filesystem::remove_all(d);
+}
+
+void DiffTest::test_merge_diff_entry(void) {
+	std::vector<char> d1{'1'}, d2{'2'};
+	std::vector<DiffEntry> a{
+		{"a", "", FileType::Reg, 1, true, d1},
+		{"b", "", FileType::Reg, 1, true, d1},
+		{"c", "", FileType::Reg, 1, true, {}},
+		{"d", "", FileType::Reg, 1, true, d1},
+		{"e", "", FileType::Symlink, 1, true, d1},
+		{"f", "", FileType::Invalid, 0, false, d1},
+	};
+	std::vector<DiffEntry> b{
+		{"0", "", FileType::Reg, 1, true, d1},
+		{"a", "", FileType::Reg, 1, true, d1},
+		{"b", "", FileType::Reg, 1, true, d2},
+		{"c", "", FileType::Reg, 1, true, d1},
+		{"d", "", FileType::Reg, 2, true, {}},
+		{"e", "", FileType::Reg, 1, true, d1},
+		{"f", "", FileType::Reg, 1, true, d1},
+		{"g", "", FileType::Reg, 1, true, d1},
+	};
+	const std::vector<std::pair<std::string, DiffStatus>> x{
+		{"0", DiffStatus::Added},
+		{"a", DiffStatus::Same},
+		{"b", DiffStatus::Modified},
+		{"c", DiffStatus::None}, // needs hashing
+		{"d", DiffStatus::Modified}, // size differs
+		{"e", DiffStatus::Modified}, // type differs
+		{"f", DiffStatus::Same}, // type and size unknown
+		{"g", DiffStatus::Added},
+	};
+	auto l = merge_diff_entry(a, b);
+	CPPUNIT_ASSERT_EQUAL(l.size(), x.size());
+	for (std::size_t i = 0; i < l.size(); i++) {
+		CPPUNIT_ASSERT_EQUAL(l[i].path, x[i].first);
+		CPPUNIT_ASSERT(l[i].status == x[i].second);
+	}
+
+	l = merge_diff_entry(a, {});
+	CPPUNIT_ASSERT_EQUAL(l.size(), a.size());
+	for (const auto& r : l)
+		CPPUNIT_ASSERT(r.status == DiffStatus::Removed);
+	CPPUNIT_ASSERT(merge_diff_entry({}, {}).empty());
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DiffTest);
+#endif
@@ -0,0 +1,86 @@
+#ifndef SRC_DIFF_H_
+#define SRC_DIFF_H_
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+#include "./util.h"
+
+enum class DiffStatus {
+	None, // same size, digest not yet compared
+	Same,
+	Added,
+	Removed,
+	Modified,
+};
+
+struct DiffEntry {
+	std::string path; // relative to input prefix
+	std::string file; // path to hash if digest is empty
+	FileType type; // Invalid if unknown
+	std::uint64_t size;
+	bool has_size;
+	std::vector<char> digest;
+};
+
+struct DiffResult {
+	std::string path;
+	DiffStatus status;
+	std::size_t a; // index of old entry
+	std::size_t b; // index of new entry
+};
+
+// next entry in path order, false once there is none
+typedef std::function<bool(DiffEntry&)> DiffReader;
+typedef std::function<void(const DiffResult&, DiffEntry&, DiffEntry&)>
+	DiffResultFn;
+
+// Same set of files as dir.cc prints, directories excluded, read one
+// directory level at a time in path order.
+class TreeReader {
+	public:
+	int open_tree(const std::string&);
+	bool get_next_entry(DiffEntry&);
+
+	private:
+	struct Level {
+		std::string dir;
+		std::vector<std::pair<std::string, FileType>> child;
+		std::size_t next;
+	};
+	void push_level(const std::string&);
+
+	std::string _inp;
+	std::vector<Level> _level;
+};
+
+void get_diff_digest(DiffEntry&);
+const std::string& get_diff_status_string(const DiffStatus&);
+int get_tree_entry(const std::string&, std::vector<DiffEntry>&);
+DiffStatus get_diff_status(const DiffEntry&, const DiffEntry&);
+void merge_diff_reader(const DiffReader&, const DiffReader&,
+	const DiffResultFn&);
+std::vector<DiffResult> merge_diff_entry(const std::vector<DiffEntry>&,
+	const std::vector<DiffEntry>&);
+int diff_input(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class DiffTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(DiffTest);
+	CPPUNIT_TEST(test_get_tree_entry);
+	CPPUNIT_TEST(test_merge_diff_entry);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_tree_entry(void);
+	void test_merge_diff_entry(void);
+};
+#endif
+#endif // SRC_DIFF_H_
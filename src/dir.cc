@@ -1,34 +1,85 @@
 #include <iostream>
 #include <sstream>
+#include <streambuf>
 #include <vector>
 #include <filesystem>
 #include <algorithm>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <stdexcept>
 
+#include <cstring>
 #include <cerrno>
 #include <cassert>
 
+#include <sys/stat.h>
+
+#include "./cache.h"
+#include "./cdc.h"
+#include "./checkpoint.h"
 #include "./dir.h"
+#include "./dirhash.h"
 #include "./global.h"
 #include "./hash.h"
+#include "./manifest.h"
+#include "./merkle.h"
+#include "./output.h"
+#include "./shard.h"
 #include "./squash.h"
 #include "./stat.h"
+#include "./tar.h"
 #include "./util.h"
+#include "./verify.h"
+
+const std::string METADATA_LABEL("metadata");
+const int METADATA_VERSION = 1;
 
 namespace {
-int walk_directory(const std::string&, const std::string&, Squash&, Stat&);
-int walk_directory_impl(const std::string&, const std::string&, Squash&, Stat&);
-bool test_ignore_entry(const std::string&, const FileType&);
+const std::size_t LIST_BATCH_SIZE = 4096;
+const std::size_t INPUT_PENDING_SIZE = 16;
+
+// digests of listed files hashed ahead in parallel, see walk_list
+thread_local const std::unordered_map<std::string, hash_res>* _prehash;
+
+int walk_directory(const std::string&, const std::string&, Squash&, Merkle&,
+	Stat&);
+int walk_directory_entry(const std::string&, const std::string&, Squash&,
+	Merkle&, Stat&);
+int walk_tar(const std::string&, Squash&, Merkle&, Stat&);
+int walk_list(const std::vector<std::string>&, const std::string&, Squash&,
+	Merkle&, Stat&);
+int walk_directory_impl(const std::string&, const std::string&, Squash&,
+	Merkle&, Stat&);
+bool is_entry_output(void);
+void put_entry(const std::string&, const std::string&, const FileType&,
+	unsigned long, const std::vector<char>&, const std::string&, bool);
 void print_byte(const std::string&, const std::vector<char>&,
-	const std::string&);
+	unsigned long, const std::string&);
+void print_merkle(const std::string&, Merkle&);
+void print_input_stat(const std::string&, const std::string&, Squash&,
+	Merkle&, Stat&);
+void print_squash(const std::string&, const std::string&, Squash&);
 void handle_directory(const std::string&, const std::string&,
-	const std::string&, Squash&, Stat&);
+	const std::string&, Squash&, Merkle&, Stat&);
 void print_file(const std::string&, const std::string&, const FileType&,
-	const std::string&, Squash&, Stat&);
-void print_symlink(const std::string&, const std::string&, Squash&, Stat&);
+	const std::string&, Squash&, Merkle&, Stat&);
+void print_file_hash(const std::string&, const std::string&, const FileType&,
+	const std::string&, const hash_res&, const std::vector<CdcChunk>&,
+	Squash&, Merkle&, Stat&);
+void print_symlink(const std::string&, const std::string&, Squash&, Merkle&,
+	Stat&);
 void print_unsupported(const std::string&, Stat&);
 void print_invalid(const std::string&, Stat&);
 void print_debug(const std::string&, const FileType&);
+bool test_newer_entry(const struct stat&, const FileType&);
 void print_verbose_stat(const std::string&, const Stat&);
 void assert_file_path(const std::string&, const std::string&);
 } // namespace
@@ -52,15 +103,23 @@ int print_input(const std::string& fx) {
 	// convert input to abs first
 	f = get_abspath(f);
 	assert_file_path(f, "");
+	set_manifest_input(f);
 
-	// keep input prefix based on raw type
+	// keep input prefix based on raw type,
+	// tar archive is walked as if extracted to directory of the same path
 	std::string inp;
 	auto can_walk = true;
+	auto is_tar = false;
 	switch (get_raw_file_type(f)) {
 	case FileType::Dir:
 		inp = f;
 		break;
 	case FileType::Reg:
+		if (opt.tar) {
+			inp = f;
+			is_tar = true;
+			break;
+		}
 		[[fallthrough]];
 	case FileType::Device:
 		[[fallthrough]];
@@ -73,36 +132,471 @@ int print_input(const std::string& fx) {
 	}
 
 	// prefix is a directory
-	assert(get_file_type(inp) == FileType::Dir);
+	assert(is_tar || get_file_type(inp) == FileType::Dir);
 
 	// start directory walk
 	// (unlike Rust or Go, std::filesystem::recursive_directory_iterator
 	// can only handle directory)
 	Squash squ;
+	Merkle mer;
 	Stat sta;
-	if (can_walk) {
-		auto ret = walk_directory(f, inp, squ, sta);
+	if (opt.dir_digests)
+		mer.update_directory(".");
+	if (is_partial_enabled())
+		put_partial_header(f, inp);
+	if (is_tar) {
+		auto ret = walk_tar(f, squ, mer, sta);
+		if (ret < 0)
+			return ret;
+	} else if (can_walk) {
+		auto ret = walk_directory(f, inp, squ, mer, sta);
 		if (ret < 0)
 			return ret;
 	} else {
-		auto ret = walk_directory_impl(f, inp, squ, sta);
+		auto ret = walk_directory_entry(f, inp, squ, mer, sta);
 		if (ret < 0)
 			return ret;
 	}
 
+	// partial output is printed when merged
+	if (is_partial_enabled())
+		return 0;
+	print_input_stat(f, inp, squ, mer, sta);
+	return 0;
+}
+
+namespace {
+struct InputJob {
+	std::string f; // first argument resolving to this input
+	std::string key; // absolute path
+	std::vector<std::size_t> dep; // inputs containing this one
+	std::string buf; // output not yet printed
+	bool keep; // repeated, buffered whole and printed at each position
+	bool started;
+	bool head; // reached by printer, output written through unless keep
+	int ret;
+	std::exception_ptr e;
+	bool done;
+};
+
+// output of an input job, buffered until the job is at head of line
+class InputBuffer: public std::streambuf {
+	public:
+	InputBuffer(InputJob& x, std::mutex& m):
+		_job(x),
+		_mutex(m) {
+	}
+
+	protected:
+	int_type overflow(int_type c) override {
+		if (c != traits_type::eof()) {
+			auto ch = traits_type::to_char_type(c);
+			xsputn(&ch, 1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char* p, std::streamsize n) override {
+		std::lock_guard<std::mutex> lk(_mutex);
+		if (_job.head && !_job.keep)
+			std::cout.write(p, n);
+		else
+			_job.buf.append(p, static_cast<std::size_t>(n));
+		return n;
+	}
+
+	private:
+	InputJob& _job;
+	std::mutex& _mutex;
+};
+} // namespace
+
+// print inputs in argument order, processed concurrently by up to opt.jobs
+// threads unless a single thread is enough, output of the input being
+// printed is written through and that of others is buffered, at most
+// INPUT_PENDING_SIZE finished ones before workers only take the input being
+// printed, repeated inputs are hashed once, and inputs under another input
+// wait for it to finish so that digests of shared files are taken from cache
+int print_inputs(const std::vector<std::string>& l) {
+	// global state other than cache is updated in walk order
+	if (l.size() < 2 || opt.jobs < 2 || !opt.manifest.empty() ||
+		!opt.checkpoint.empty() || !opt.emit_partial.empty() ||
+		opt.cdc || opt.first) {
+		for (std::size_t i = 0; i < l.size(); i++) {
+			auto ret = print_input(l[i]);
+			if (ret < 0)
+				return ret;
+			if (is_hash_verify_done())
+				break;
+			if (opt.verbose && i != l.size() - 1)
+				std::cout << std::endl;
+		}
+		return 0;
+	}
+
+	std::vector<std::unique_ptr<InputJob>> jobs;
+	std::vector<std::size_t> index; // argument to job
+	std::unordered_map<std::string, std::size_t> m;
+	for (const auto& f : l) {
+		auto key = canonicalize_path(get_abspath(f));
+		auto it = m.find(key);
+		if (it != m.end()) {
+			index.push_back(it->second);
+			jobs[it->second]->keep = true;
+			continue;
+		}
+		m[key] = jobs.size();
+		index.push_back(jobs.size());
+		jobs.push_back(std::make_unique<InputJob>());
+		jobs.back()->f = f;
+		jobs.back()->key = key;
+		jobs.back()->keep = false;
+		jobs.back()->started = false;
+		jobs.back()->head = false;
+		jobs.back()->ret = 0;
+		jobs.back()->done = false;
+	}
+	auto overlap = false;
+	for (std::size_t i = 0; i < jobs.size(); i++) {
+		for (std::size_t j = 0; j < jobs.size(); j++) {
+			const auto& k = jobs[j]->key;
+			if (i != j && jobs[i]->key.starts_with(k == "/" ? k :
+				k + "/")) {
+				jobs[i]->dep.push_back(j);
+				overlap = true;
+			}
+		}
+	}
+	if (overlap && opt.cache.empty())
+		cache_init();
+
+	// containing inputs start first, hence never wait for a later one
+	std::vector<std::size_t> order(jobs.size());
+	for (std::size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](std::size_t a,
+		std::size_t b) {
+		return jobs[a]->key.size() < jobs[b]->key.size();
+	});
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::size_t next_job = 0; // in order, all before started
+	std::size_t num_started = 0;
+	std::size_t head = 0; // argument being printed
+	std::size_t pending = 0; // finished before reaching head
+	auto cancel = false;
+	// next input to start, or the one being printed or one containing it
+	// if too many finished inputs wait to be printed
+	auto get_next_job = [&](std::size_t& k) {
+		if (pending < INPUT_PENDING_SIZE) {
+			while (next_job < order.size() &&
+				jobs[order[next_job]]->started)
+				next_job++;
+			if (next_job == order.size())
+				return false;
+			k = order[next_job];
+			return true;
+		}
+		auto found = false;
+		auto consider = [&](std::size_t i) {
+			if (!jobs[i]->started && (!found ||
+				jobs[i]->key.size() < jobs[k]->key.size())) {
+				k = i;
+				found = true;
+			}
+		};
+		consider(index[head]);
+		for (const auto& d : jobs[index[head]]->dep)
+			consider(d);
+		return found;
+	};
+	auto worker = [&](void) {
+		std::unique_lock<std::mutex> lk(mutex);
+		while (true) {
+			std::size_t k = 0;
+			cv.wait(lk, [&] {
+				return cancel || num_started == jobs.size() ||
+					get_next_job(k);
+			});
+			if (cancel || num_started == jobs.size())
+				break;
+			auto& x = *jobs[k];
+			x.started = true;
+			num_started++;
+			cv.wait(lk, [&] {
+				for (const auto& d : x.dep)
+					if (!jobs[d]->done)
+						return false;
+				return true;
+			});
+			lk.unlock();
+
+			InputBuffer b(x, mutex);
+			std::ostream os(&b);
+			set_output(&os);
+			try {
+				x.ret = print_input(x.f);
+			} catch (...) {
+				x.e = std::current_exception();
+			}
+			set_output(nullptr);
+
+			lk.lock();
+			x.done = true;
+			if (!x.head)
+				pending++;
+			cv.notify_all();
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < std::min(opt.jobs,
+		static_cast<unsigned long>(jobs.size())); i++)
+		threads.push_back(new_thread(worker));
+
+	auto ret = 0;
+	std::exception_ptr e;
+	for (std::size_t i = 0; i < index.size(); i++) {
+		auto& x = *jobs[index[i]];
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			head = i;
+			if (!x.head) {
+				x.head = true;
+				if (x.done)
+					pending--;
+				if (!x.keep) {
+					std::cout << x.buf;
+					std::string().swap(x.buf);
+				}
+			}
+			cv.notify_all();
+			cv.wait(lk, [&] {
+				return x.done;
+			});
+		}
+		if (x.keep)
+			std::cout << x.buf;
+		std::cout << std::flush;
+		if (x.e) {
+			e = x.e;
+			break;
+		} else if (x.ret < 0) {
+			ret = x.ret;
+			break;
+		}
+		if (opt.verbose && i != index.size() - 1)
+			std::cout << std::endl;
+	}
+
+	// don't start remaining inputs on error
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		cancel = true;
+	}
+	cv.notify_all();
+	for (auto& t : threads)
+		t.join();
+	if (e)
+		std::rethrow_exception(e);
+	return ret;
+}
+
+// hash paths read from is as if walked under directory base, relative paths
+// are relative to base, and listed directories are counted but not walked
+int print_input_list(const std::string& base, std::istream& is, char delim) {
+	auto inp = canonicalize_path(get_abspath(base));
+	if (get_file_type(inp) != FileType::Dir)
+		return -ENOTDIR;
+	assert_file_path(inp, "");
+
+	Squash squ;
+	Merkle mer;
+	Stat sta;
+	if (opt.dir_digests)
+		mer.update_directory(".");
+
+	// batched unless sort, so that hashing starts before the list ends,
+	// repeated paths are only hashed once
+	std::vector<std::string> l;
+	std::unordered_set<std::string> seen;
+	std::string s;
+	while (std::getline(is, s, delim)) {
+		if (s.empty())
+			continue;
+		auto f = canonicalize_path(is_abspath(s) ? s : inp + "/" + s);
+		if (f == inp)
+			continue;
+		if (!f.starts_with(inp == "/" ? inp : inp + "/")) {
+			std::cout << s << ": Not under " << inp << std::endl;
+			return -EINVAL;
+		}
+		if (!seen.insert(f).second)
+			continue;
+		l.push_back(f);
+		if (!opt.sort && l.size() == LIST_BATCH_SIZE) {
+			auto ret = walk_list(l, inp, squ, mer, sta);
+			if (ret < 0)
+				return ret;
+			if (is_hash_verify_done())
+				return 0;
+			l.clear();
+		}
+	}
+	if (is.bad())
+		return -EIO;
+	if (opt.sort)
+		std::sort(l.begin(), l.end());
+	auto ret = walk_list(l, inp, squ, mer, sta);
+	if (ret < 0)
+		return ret;
+	print_input_stat(inp, inp, squ, mer, sta);
+	return 0;
+}
+
+namespace {
+void print_input_stat(const std::string& f, const std::string& inp,
+	Squash& squ, Merkle& mer, Stat& sta) {
+	// print per directory hash if specified
+	if (opt.dir_digests)
+		print_merkle(inp, mer);
+
 	// print various stats
-	if (opt::verbose)
+	if (opt.verbose)
 		print_verbose_stat(inp, sta);
-	sta.print_stat_unsupported(inp);
-	sta.print_stat_invalid(inp);
+	if (is_entry_output()) {
+		for (const auto& x : sta.get_stat_unsupported())
+			put_entry(x, get_real_path(x, inp),
+				FileType::Unsupported, 0, {}, "", false);
+		for (const auto& x : sta.get_stat_invalid())
+			put_entry(x, get_real_path(x, inp), FileType::Invalid,
+				0, {}, "", false);
+	} else {
+		sta.print_stat_unsupported(inp);
+		sta.print_stat_invalid(inp);
+	}
+
+	// print unique and duplicate chunks if cdc
+	if (opt.cdc)
+		print_cdc_stat();
 
 	// print squash hash if specified
-	if (opt::squash) {
-		auto b = squ.get_buffer();
-		if (opt::verbose)
-			print_num_format_string(b.size(), "squashed byte");
-		print_byte(f, b, inp);
+	if (opt.squash)
+		print_squash(f, inp, squ);
+}
+} // namespace
+
+// merge partial outputs of all shards into output of a single process
+int merge_partial_input(const std::vector<std::string>& l) {
+	std::vector<std::unique_ptr<PartialReader>> r;
+	std::vector<bool> found;
+	for (const auto& f : l) {
+		r.push_back(std::make_unique<PartialReader>());
+		auto ret = r.back()->open_partial(f);
+		if (ret < 0) {
+			std::cout << f << ": " << strerror(-ret) << std::endl;
+			return ret;
+		}
+		const auto& h = r.back()->get_header();
+		if (h.option != get_partial_option_string()) {
+			std::cout << f << ": Options differ from partial output"
+				<< std::endl;
+			return -EINVAL;
+		}
+		// shards of another tree would merge into a bogus digest
+		const auto& h0 = r[0]->get_header();
+		if (h.input != h0.input || h.prefix != h0.prefix) {
+			std::cout << f << ": Input " << h.input << " differs from "
+				<< h0.input << std::endl;
+			return -EINVAL;
+		}
+		if (found.empty())
+			found.resize(h.shard_count);
+		if (h.shard_count != found.size() || found[h.shard_index]) {
+			std::cout << f << ": Unexpected shard " << h.shard_index
+				<< "/" << h.shard_count << std::endl;
+			return -EINVAL;
+		}
+		found[h.shard_index] = true;
+	}
+	for (std::size_t i = 0; i < found.size(); i++) {
+		if (!found[i]) {
+			std::cout << "Missing shard " << i << "/" << found.size()
+				<< std::endl;
+			return -EINVAL;
+		}
 	}
+
+	// each partial output is in walk order, and each entry is in one
+	// shard only, hence merging by key is the same as a single walk
+	typedef std::pair<std::string, std::size_t> key;
+	std::priority_queue<key, std::vector<key>, std::greater<key>> q;
+	std::vector<PartialEntry> e(r.size());
+	auto read = [&](std::size_t i) {
+		auto ret = r[i]->read_entry(e[i]);
+		if (ret < 0) {
+			std::cout << l[i] << ": " << strerror(-ret) << std::endl;
+			return ret;
+		}
+		if (ret > 0)
+			q.push({e[i].key, i});
+		return 0;
+	};
+	for (std::size_t i = 0; i < r.size(); i++) {
+		auto ret = read(i);
+		if (ret < 0)
+			return ret;
+	}
+
+	Squash squ;
+	Merkle mer;
+	std::vector<std::string> unsupported, invalid;
+	if (opt.dir_digests)
+		mer.update_directory(".");
+	while (!q.empty()) {
+		auto i = q.top().second;
+		q.pop();
+		const auto& x = e[i];
+		switch (x.type) {
+		case PartialType::Text:
+			std::cout.write(x.data.data(), x.data.size());
+			break;
+		case PartialType::Squash:
+			squ.update_buffer(x.data);
+			break;
+		case PartialType::Directory:
+			mer.update_directory(x.path);
+			break;
+		case PartialType::Entry:
+			mer.update_entry(x.path, x.data);
+			break;
+		case PartialType::Unsupported:
+			unsupported.push_back({x.data.begin(), x.data.end()});
+			break;
+		case PartialType::Invalid:
+			invalid.push_back({x.data.begin(), x.data.end()});
+			break;
+		}
+		auto ret = read(i);
+		if (ret < 0)
+			return ret;
+	}
+
+	// same order as print_input
+	const auto& h = r[0]->get_header();
+	if (opt.dir_digests)
+		print_merkle(h.prefix, mer);
+	for (const auto& [v, t] : {std::make_pair(&unsupported,
+		FileType::Unsupported), std::make_pair(&invalid,
+		FileType::Invalid)}) {
+		if (v->empty())
+			continue;
+		print_num_format_string(v->size(), get_file_type_string(t));
+		for (const auto& s : *v)
+			std::cout << s << std::endl;
+	}
+	if (opt.squash)
+		print_squash(h.input, h.prefix, squ);
 	return 0;
 }
 
@@ -111,32 +605,242 @@ namespace {
 // vs filepath.WalkDir, hence squash2 hash won't match the original golang
 // implementation (but it does seem to match Rust's walkdir::WalkDir).
 int walk_directory(const std::string& f, const std::string& inp, Squash& squ,
-	Stat& sta) {
+	Merkle& mer, Stat& sta) {
 	std::vector<std::string> l;
 	for (const auto& e : std::filesystem::recursive_directory_iterator(f)) {
 		auto x = e.path();
-		if (opt::sort) {
+		if (opt.sort) {
 			l.push_back(x);
 		} else {
-			auto ret = walk_directory_impl(x, inp, squ, sta);
+			auto ret = walk_directory_entry(x, inp, squ, mer, sta);
 			if (ret < 0)
 				return ret;
+			if (is_hash_verify_done())
+				return 0;
 		}
 	}
-	if (opt::sort) {
+	if (opt.sort) {
 		std::sort(l.begin(), l.end());
 		for (const auto& f : l) {
-			auto ret = walk_directory_impl(f, inp, squ, sta);
+			auto ret = walk_directory_entry(f, inp, squ, mer, sta);
 			if (ret < 0)
 				return ret;
+			if (is_hash_verify_done())
+				return 0;
+		}
+	}
+	return 0;
+}
+
+// hash listed regular files in parallel first, then walk the list in order,
+// same digests as serial hashing unless a file is modified in between
+int walk_list(const std::vector<std::string>& l, const std::string& inp,
+	Squash& squ, Merkle& mer, Stat& sta) {
+	std::vector<std::string> v;
+	if (opt.jobs > 1 && !opt.metadata_only && !opt.quick && !opt.cdc &&
+		opt.checkpoint.empty()) {
+		for (const auto& f : l) {
+			auto t = get_raw_file_type(f);
+			if (t == FileType::Symlink && opt.follow_symlink &&
+				!opt.ignore_symlink) {
+				auto x = canonicalize_path(f);
+				if (!x.empty() && get_file_type(x) == FileType::Reg)
+					v.push_back(x);
+			} else if (t == FileType::Reg && !test_ignore_entry(f, t)) {
+				v.push_back(f);
+			}
+		}
+	}
+
+	std::unordered_map<std::string, hash_res> m;
+	if (!v.empty()) {
+		std::vector<hash_res> res(v.size());
+		std::vector<int> ok(v.size()); // not vector<bool>
+		std::atomic<std::size_t> next_job(0);
+		auto worker = [&](void) {
+			while (true) {
+				auto i = next_job++;
+				if (i >= v.size())
+					break;
+				// hashed again in order to report error if any
+				try {
+					res[i] = get_cache_file_hash(v[i],
+						opt.hash_algo);
+					ok[i] = 1;
+				} catch (const std::exception& e) {
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		for (unsigned long i = 0; i < std::min(opt.jobs,
+			static_cast<unsigned long>(v.size())); i++)
+			threads.push_back(new_thread(worker));
+		for (auto& t : threads)
+			t.join();
+		for (std::size_t i = 0; i < v.size(); i++)
+			if (ok[i])
+				m[v[i]] = res[i];
+	}
+
+	_prehash = &m;
+	try {
+		for (const auto& f : l) {
+			auto ret = walk_directory_entry(f, inp, squ, mer, sta);
+			if (ret < 0) {
+				_prehash = nullptr;
+				return ret;
+			}
+			if (is_hash_verify_done())
+				break;
+		}
+	} catch (...) {
+		_prehash = nullptr;
+		throw;
+	}
+	_prehash = nullptr;
+	return 0;
+}
+
+struct TarRecord {
+	std::string f; // virtual path under input prefix
+	FileType t;
+	hash_res res; // regular file only
+	std::int64_t mtime_ns;
+};
+
+// hash members in archive order in a single pass, then print them in the
+// same order as walk_directory would if extracted to directory inp
+// (readdir(3) order isn't reproducible, hence archive order unless sort)
+int walk_tar(const std::string& inp, Squash& squ, Merkle& mer, Stat& sta) {
+	TarReader r;
+	auto ret = r.open_tar(inp);
+	if (ret < 0) {
+		std::cout << inp << ": " << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	// later member overwrites earlier one as if extracted
+	std::vector<TarRecord> l;
+	std::unordered_map<std::string, std::size_t> m;
+	auto add = [&](TarRecord&& x) {
+		auto it = m.find(x.f);
+		if (it == m.end()) {
+			m[x.f] = l.size();
+			l.push_back(std::move(x));
+		} else {
+			l[it->second] = std::move(x);
+		}
+	};
+
+	TarEntry e;
+	while ((ret = r.read_entry(e)) > 0) {
+		// extraction skips members outside of top directory
+		if (e.path.empty() || e.path == ".")
+			continue;
+
+		// missing parent directories are created on extraction
+		for (auto i = e.path.find('/'); i != std::string::npos;
+			i = e.path.find('/', i + 1)) {
+			auto x = inp + "/" + e.path.substr(0, i);
+			if (!m.contains(x))
+				add({x, FileType::Dir, {}, e.mtime_ns});
+		}
+
+		// hardlink is a regular file with contents of its target
+		auto x = inp + "/" + e.path;
+		switch (e.type) {
+		case TarType::Reg: {
+			hash_res res;
+			ret = get_tar_data_hash(r, opt.hash_algo, res);
+			if (ret < 0)
+				break;
+			add({x, FileType::Reg, res, e.mtime_ns});
+			break;
+		}
+		case TarType::Hardlink: {
+			auto it = m.find(inp + "/" + get_tar_path(e.link));
+			if (it == m.end() || l[it->second].t != FileType::Reg)
+				add({x, FileType::Invalid, {}, e.mtime_ns});
+			else
+				add({x, FileType::Reg, l[it->second].res,
+					e.mtime_ns});
+			break;
+		}
+		case TarType::Symlink:
+			add({x, FileType::Symlink, {}, e.mtime_ns});
+			break;
+		case TarType::Dir:
+			add({x, FileType::Dir, {}, e.mtime_ns});
+			break;
+		case TarType::Device:
+			// contents of device aren't archived
+			[[fallthrough]];
+		case TarType::Fifo:
+			[[fallthrough]];
+		case TarType::Unsupported:
+			add({x, FileType::Unsupported, {}, e.mtime_ns});
+			break;
+		}
+		if (ret < 0)
+			break;
+	}
+	if (ret < 0) {
+		std::cout << inp << ": " << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	if (opt.sort)
+		std::sort(l.begin(), l.end(), [](const auto& a, const auto& b) {
+			return a.f < b.f;
+		});
+	for (const auto& x : l) {
+		// same as walk_directory_impl without following symlinks
+		if (test_ignore_entry(x.f, x.t) || (x.t == FileType::Symlink &&
+			opt.ignore_symlink)) {
+			sta.set_stat_type(x.f, x.t);
+			sta.append_stat_ignored(x.f);
+			continue;
+		}
+		if ((x.t == FileType::Reg || x.t == FileType::Symlink) &&
+			opt.newer >= 0 && x.mtime_ns <= opt.newer) {
+			sta.append_stat_skipped();
+			continue;
+		}
+		switch (x.t) {
+		case FileType::Dir:
+			handle_directory(x.f, "", inp, squ, mer, sta);
+			break;
+		case FileType::Reg:
+			if (opt.debug)
+				print_debug(x.f, x.t);
+			print_file_hash(x.f, "", x.t, inp, x.res, {}, squ, mer,
+				sta);
+			break;
+		case FileType::Symlink:
+			print_symlink(x.f, inp, squ, mer, sta);
+			break;
+		case FileType::Unsupported:
+			sta.set_stat_type(x.f, x.t);
+			print_unsupported(x.f, sta);
+			break;
+		case FileType::Invalid:
+			sta.set_stat_type(x.f, x.t);
+			print_invalid(x.f, sta);
+			break;
+		case FileType::Device:
+			panic_file_type(x.f, "device", x.t);
+			break;
 		}
+		if (is_hash_verify_done())
+			return 0;
 	}
 	return 0;
 }
 
 int walk_directory_impl(const std::string& f, const std::string& inp,
-	Squash& squ, Stat& sta) {
-	auto t = get_raw_file_type(f);
+	Squash& squ, Merkle& mer, Stat& sta) {
+	struct stat st;
+	auto t = get_raw_file_type(f, st);
 	if (test_ignore_entry(f, t)) {
 		sta.append_stat_ignored(f);
 		return 0;
@@ -146,12 +850,15 @@ int walk_directory_impl(const std::string& f, const std::string& inp,
 	// l is symlink itself, not its target
 	std::string x, l;
 	if (t == FileType::Symlink) {
-		if (opt::ignore_symlink) {
+		if (opt.ignore_symlink) {
 			sta.append_stat_ignored(f);
 			return 0;
 		}
-		if (!opt::follow_symlink) {
-			print_symlink(f, inp, squ, sta);
+		if (!opt.follow_symlink) {
+			if (!test_newer_entry(st, t))
+				sta.append_stat_skipped();
+			else
+				print_symlink(f, inp, squ, mer, sta);
 			return 0;
 		}
 		x = canonicalize_path(f);
@@ -160,21 +867,27 @@ int walk_directory_impl(const std::string& f, const std::string& inp,
 			return 0;
 		}
 		assert(is_abspath(x));
-		t = get_file_type(x); // update type
+		t = get_file_type(x, st); // update type
 		assert(t != FileType::Symlink); // symlink chains resolved
 		l = f;
 	} else {
 		x = f;
 	}
 
+	// skip files not modified since cutoff if specified
+	if (!test_newer_entry(st, t)) {
+		sta.append_stat_skipped();
+		return 0;
+	}
+
 	switch (t) {
 	case FileType::Dir:
-		handle_directory(x, l, inp, squ, sta);
+		handle_directory(x, l, inp, squ, mer, sta);
 		break;
 	case FileType::Reg:
 		[[fallthrough]];
 	case FileType::Device:
-		print_file(x, l, t, inp, squ, sta);
+		print_file(x, l, t, inp, squ, mer, sta);
 		break;
 	case FileType::Unsupported:
 		print_unsupported(x, sta);
@@ -189,6 +902,17 @@ int walk_directory_impl(const std::string& f, const std::string& inp,
 	return 0;
 }
 
+std::string trim_input_prefix(const std::string& f, const std::string& inp) {
+	if (f.starts_with(inp)) {
+		auto x = f.substr(inp.size() + 1);
+		assert(!x.starts_with("/"));
+		return x;
+	} else {
+		return f;
+	}
+}
+} // namespace
+
 bool test_ignore_entry(const std::string& f, const FileType& t) {
 	assert(is_abspath(f));
 
@@ -200,35 +924,24 @@ bool test_ignore_entry(const std::string& f, const FileType& t) {
 	auto path_contains_slash_dot = f.find("/.") != std::string::npos;
 
 	// ignore . directories if specified
-	if (opt::ignore_dot_dir && !base_starts_with_dot &&
+	if (opt.ignore_dot_dir && !base_starts_with_dot &&
 		path_contains_slash_dot)
 		return true;
 
 	// ignore . regular files if specified
-	if (opt::ignore_dot_file) {
+	if (opt.ignore_dot_file) {
 		// XXX limit to REG ?
 		if (base_starts_with_dot)
 			return true;
 	}
 
 	// ignore . entries if specified
-	return opt::ignore_dot &&
+	return opt.ignore_dot &&
 		(base_starts_with_dot || path_contains_slash_dot);
 }
 
-std::string trim_input_prefix(const std::string& f, const std::string& inp) {
-	if (f.starts_with(inp)) {
-		auto x = f.substr(inp.size() + 1);
-		assert(!x.starts_with("/"));
-		return x;
-	} else {
-		return f;
-	}
-}
-} // namespace
-
 std::string get_real_path(const std::string& f, const std::string& inp) {
-	if (opt::abs) {
+	if (opt.abs) {
 		assert(is_abspath(f));
 		return f;
 	} else if (f == inp) {
@@ -242,32 +955,189 @@ std::string get_real_path(const std::string& f, const std::string& inp) {
 }
 
 namespace {
-void print_byte(const std::string& f, const std::vector<char>& inb,
+// path relative to input prefix regardless of opt.abs,
+// l is symlink itself if f is its target
+std::string get_relative_path(const std::string& f, const std::string& l,
 	const std::string& inp) {
+	auto x = l.empty() ? f : l;
+	if (x == inp)
+		return ".";
+	else if (inp == "/")
+		return x.substr(1);
+	else
+		return trim_input_prefix(x, inp);
+}
+
+// relative path, type, size, mode and mtime_ns instead of file contents,
+// l is symlink itself if f is its target
+hash_res get_metadata_hash(const std::string& f, const std::string& l,
+	const FileType& t, const std::string& inp) {
+	struct stat st;
+	auto ret = t == FileType::Symlink ? lstat(f.c_str(), &st) :
+		stat(f.c_str(), &st);
+	if (ret == -1)
+		throw std::runtime_error(f + ": " + strerror(errno));
+
+	auto s = get_relative_path(f, l, inp);
+	std::vector<char> v(s.begin(), s.end());
+	v.push_back('\0');
+	const auto& x = get_file_type_string(t);
+	v.insert(v.end(), x.begin(), x.end());
+	v.push_back('\0');
+	put_le64(v, static_cast<std::uint64_t>(st.st_size));
+	put_le32(v, static_cast<std::uint32_t>(st.st_mode));
+	put_le64(v, static_cast<std::uint64_t>(get_mtime_ns(st)));
+	return get_byte_hash(v, opt.hash_algo);
+}
+
+// walk f if in this shard, and record printed lines in partial output
+// instead of printing them if specified
+int walk_directory_entry(const std::string& f, const std::string& inp,
+	Squash& squ, Merkle& mer, Stat& sta) {
+	auto x = get_relative_path(f, "", inp);
+	if (!test_shard_entry(x, opt.shard_index, opt.shard_count))
+		return 0;
+	if (!is_partial_enabled())
+		return walk_directory_impl(f, inp, squ, mer, sta);
+
+	set_partial_key(x);
+	auto nu = sta.num_stat_unsupported();
+	auto ni = sta.num_stat_invalid();
+	std::ostringstream ss;
+	auto* p = std::cout.rdbuf(ss.rdbuf());
+	int ret;
+	try {
+		ret = walk_directory_impl(f, inp, squ, mer, sta);
+	} catch (...) {
+		std::cout.rdbuf(p);
+		throw;
+	}
+	std::cout.rdbuf(p);
+
+	auto s = ss.str();
+	if (!s.empty())
+		add_partial_entry(PartialType::Text, "", {s.begin(), s.end()});
+	if (sta.num_stat_unsupported() != nu) {
+		s = sta.get_stat_string(sta.get_stat_unsupported().back(), inp);
+		add_partial_entry(PartialType::Unsupported, "",
+			{s.begin(), s.end()});
+	}
+	if (sta.num_stat_invalid() != ni) {
+		s = sta.get_stat_string(sta.get_stat_invalid().back(), inp);
+		add_partial_entry(PartialType::Invalid, "",
+			{s.begin(), s.end()});
+	}
+	return ret;
+}
+
+void update_squash_buffer(Squash& squ, const std::vector<char>& v) {
+	if (is_partial_enabled())
+		add_partial_entry(PartialType::Squash, "", v);
+	else
+		squ.update_buffer(v);
+}
+
+void update_merkle_directory(Merkle& mer, const std::string& f) {
+	if (is_partial_enabled())
+		add_partial_entry(PartialType::Directory, f, {});
+	else
+		mer.update_directory(f);
+}
+
+void update_merkle_entry(Merkle& mer, const std::string& f,
+	const std::vector<char>& b) {
+	if (is_partial_enabled())
+		add_partial_entry(PartialType::Entry, f, b);
+	else
+		mer.update_entry(f, b);
+}
+} // namespace
+
+namespace {
+// entries go to library caller or are printed as records rather than text
+bool is_entry_output(void) {
+	return is_result_sink() || is_record_output();
+}
+
+// pass realf to library caller, or print it as record with mtime of f
+void put_entry(const std::string& f, const std::string& realf,
+	const FileType& t, unsigned long written, const std::vector<char>& b,
+	const std::string& label, bool squash) {
+	assert(is_entry_output());
+	if (is_result_sink())
+		put_result({realf, t, written, b, squash});
+	else
+		put_output_record({realf, t, written, get_output_mtime(f, t), b,
+			label});
+}
+
+void print_byte(const std::string& f, const std::vector<char>& b,
+	unsigned long written, const std::string& inp) {
 	assert_file_path(f, inp);
 
-	// get hash value
-	const auto [b, _ignore] = get_byte_hash(inb, opt::hash_algo);
-	assert(!b.empty());
+	// hash value of squash buffer
 	auto hex_sum = get_hex_sum(b);
 
 	// verify hash value if specified
-	if (!opt::hash_verify.empty() && opt::hash_verify != hex_sum)
+	if (!test_hash_verify(b, hex_sum))
 		return;
 
-	if (opt::hash_only) {
-		std::cout << hex_sum << std::endl;
+	if (opt.hash_only) {
+		get_output() << hex_sum << '\n';
 	} else {
 		// no space between two
 		std::ostringstream ss;
 		ss << "[" << SQUASH_LABEL << "][v" << SQUASH_VERSION << "]";
+		if (opt.metadata_only)
+			ss << "[" << METADATA_LABEL << "][v" << METADATA_VERSION
+				<< "]";
 		auto s = ss.str();
 		auto realf = get_real_path(f, inp);
-		if (realf == ".")
-			std::cout << hex_sum << s << std::endl;
+		if (is_entry_output())
+			put_entry(f, realf, f == inp ? FileType::Dir :
+				get_raw_file_type(f), written, b, s, true);
+		else if (realf == ".")
+			get_output() << hex_sum << s << '\n';
+		else
+			get_output() << get_xsum_format_string(realf, hex_sum,
+				opt.swap) << s << '\n';
+	}
+}
+
+void print_squash(const std::string& f, const std::string& inp,
+	Squash& squ) {
+	// squash buffer may not fit in memory, hash it as a stream
+	const auto [b, written] = squ.get_buffer_hash(opt.hash_algo);
+	assert(!b.empty());
+	if (opt.verbose)
+		print_num_format_string(written, "squashed byte");
+	print_byte(f, b, written, inp);
+}
+
+void print_merkle(const std::string& inp, Merkle& mer) {
+	for (const auto& x : mer.get_directory(opt.dir_digests_depth)) {
+		auto b = mer.get_digest(x);
+		auto hex_sum = get_hex_sum(b);
+
+		// verify hash value if specified
+		if (!test_hash_verify(b, hex_sum))
+			continue;
+
+		std::string f;
+		if (x == ".")
+			f = inp;
+		else if (inp == "/")
+			f = inp + x;
+		else
+			f = inp + "/" + x;
+		if (is_entry_output())
+			put_entry(f, get_real_path(f, inp), FileType::Dir, 0, b,
+				"", false);
+		else if (opt.hash_only)
+			get_output() << hex_sum << '\n';
 		else
-			std::cout << get_xsum_format_string(realf, hex_sum,
-				opt::swap) << s << std::endl;
+			get_output() << get_xsum_format_string(get_real_path(f,
+				inp), hex_sum, opt.swap) << '\n';
 	}
 }
 
@@ -277,7 +1147,7 @@ void print_byte(const std::string& f, const std::vector<char>& inb,
 	((l).empty() ? (f) : std::string(std::filesystem::read_symlink(f)))
 
 void handle_directory(const std::string& f, const std::string& l,
-	const std::string& inp, Squash& squ, Stat& sta) {
+	const std::string& inp, Squash& squ, Merkle& mer, Stat& sta) {
 	assert_file_path(f, inp);
 	if (!l.empty())
 		assert_file_path(l, inp);
@@ -286,18 +1156,24 @@ void handle_directory(const std::string& f, const std::string& l,
 	if (f == inp)
 		return;
 
+	// add this directory to merkle tree even if empty
+	if (opt.dir_digests)
+		update_merkle_directory(mer, get_relative_path(f, l, inp));
+
 	// nothing to do unless squash
-	if (!opt::squash)
+	if (!opt.squash)
 		return;
 
 	// debug print first
-	if (opt::debug)
+	if (opt.debug)
 		print_debug(f, FileType::Dir);
 
 	// get hash value
 	// path must be relative to input prefix
 	auto s = trim_input_prefix(f2t(f, l), inp);
-	const auto [b, written] = get_string_hash(s, opt::hash_algo);
+	const auto [b, written] = opt.metadata_only ?
+		get_metadata_hash(f, l, FileType::Dir, inp) :
+		get_string_hash(s, opt.hash_algo);
 	assert(!b.empty());
 
 	// count this file
@@ -307,16 +1183,16 @@ void handle_directory(const std::string& f, const std::string& l,
 	sta.append_written_directory(written);
 
 	// squash
-	assert(opt::squash);
-	if (opt::hash_only) {
-		squ.update_buffer(b);
+	assert(opt.squash);
+	if (opt.hash_only) {
+		update_squash_buffer(squ, b);
 	} else {
 		// make link -> target format if symlink
 		auto realf = get_real_path(f2t(f, l), inp);
 		if (!l.empty()) {
 			assert_file_path(l, inp);
 			auto ll = l;
-			if (!opt::abs) {
+			if (!opt.abs) {
 				ll = trim_input_prefix(ll, inp);
 				assert(!ll.starts_with("/"));
 			}
@@ -326,22 +1202,47 @@ void handle_directory(const std::string& f, const std::string& l,
 		}
 		std::vector<char> v(realf.begin(), realf.end());
 		v.insert(v.end(), b.begin(), b.end());
-		squ.update_buffer(v);
+		update_squash_buffer(squ, v);
 	}
 }
 
 void print_file(const std::string& f, const std::string& l, const FileType& t,
-	const std::string& inp, Squash& squ, Stat& sta) {
+	const std::string& inp, Squash& squ, Merkle& mer, Stat& sta) {
 	assert_file_path(f, inp);
 	if (!l.empty())
 		assert_file_path(l, inp);
 
 	// debug print first
-	if (opt::debug)
+	if (opt.debug)
 		print_debug(f, t);
 
-	// get hash value
-	const auto [b, written] = get_file_hash(f, opt::hash_algo);
+	// hashed ahead if listed
+	if (_prehash) {
+		auto it = _prehash->find(f);
+		if (it != _prehash->end()) {
+			print_file_hash(f, l, t, inp, it->second, {}, squ, mer,
+				sta);
+			return;
+		}
+	}
+
+	// get hash value, sampled blocks if quick,
+	// chunk digests in the same read if cdc
+	std::vector<CdcChunk> chunk;
+	const auto [b, written] = opt.metadata_only ?
+		get_metadata_hash(f, l, t, inp) : opt.quick ?
+		get_file_quick_hash(f, opt.hash_algo, opt.quick_blocks) :
+		opt.cdc ? get_file_cdc_hash(f, opt.hash_algo, opt.cdc_size,
+		chunk) : get_checkpoint_file_hash(f, opt.hash_algo);
+	print_file_hash(f, l, t, inp, {b, written}, chunk, squ, mer, sta);
+}
+
+// print file already hashed, e.g. tar member
+void print_file_hash(const std::string& f, const std::string& l,
+	const FileType& t, const std::string& inp, const hash_res& res,
+	const std::vector<CdcChunk>& chunk, Squash& squ, Merkle& mer,
+	Stat& sta) {
+	const auto& [b, written] = res;
 	assert(!b.empty());
 	auto hex_sum = get_hex_sum(b);
 
@@ -362,23 +1263,51 @@ void print_file(const std::string& f, const std::string& l, const FileType& t,
 		break;
 	}
 
+	// add this file to merkle tree
+	if (opt.dir_digests)
+		update_merkle_entry(mer, get_relative_path(f, l, inp), b);
+
 	// verify hash value if specified
-	if (!opt::hash_verify.empty() && opt::hash_verify != hex_sum)
+	if (!test_hash_verify(b, hex_sum))
 		return;
 
+	// record this file in binary manifest if specified
+	// (symlink itself rather than link -> target format)
+	if (!opt.squash && !opt.dir_digests)
+		add_manifest_entry(f, get_real_path(l.empty() ? f : l, inp), b,
+			t);
+
+	// pass this file to library caller or print it as record with size
+	// and mtime of target
+	// (symlink itself rather than link -> target format)
+	if (is_entry_output() && !opt.squash) {
+		if (!opt.dir_digests) {
+			std::string s;
+			if (opt.quick)
+				s = "[" + QUICK_LABEL + "][v" +
+					std::to_string(QUICK_VERSION) + "]";
+			put_entry(f, get_real_path(l.empty() ? f : l, inp),
+				t, written, b, s, false);
+		}
+		return;
+	}
+
 	// squash or print this file
-	if (opt::hash_only) {
-		if (opt::squash)
-			squ.update_buffer(b);
-		else
-			std::cout << hex_sum << std::endl;
+	if (opt.hash_only) {
+		if (opt.squash)
+			update_squash_buffer(squ, b);
+		else if (!opt.dir_digests)
+			get_output() << hex_sum << '\n';
+		for (const auto& x : chunk)
+			get_output() << get_hex_sum(x.digest)
+				<< get_cdc_label_string(x) << '\n';
 	} else {
 		// make link -> target format if symlink
 		auto realf = get_real_path(f2t(f, l), inp);
 		if (!l.empty()) {
 			assert_file_path(l, inp);
 			auto ll = l;
-			if (!opt::abs) {
+			if (!opt.abs) {
 				ll = trim_input_prefix(ll, inp);
 				assert(!ll.starts_with("/"));
 			}
@@ -386,27 +1315,40 @@ void print_file(const std::string& f, const std::string& l, const FileType& t,
 			ss << ll << " -> " << realf;
 			realf = ss.str();
 		}
-		if (opt::squash) {
+		if (opt.squash) {
 			std::vector<char> v(realf.begin(), realf.end());
 			v.insert(v.end(), b.begin(), b.end());
-			squ.update_buffer(v);
-		} else {
-			std::cout << get_xsum_format_string(realf, hex_sum,
-				opt::swap) << std::endl;
+			update_squash_buffer(squ, v);
+		} else if (opt.quick) {
+			// no space between two
+			get_output() << get_xsum_format_string(realf, hex_sum,
+				opt.swap) << "[" << QUICK_LABEL << "][v"
+				<< QUICK_VERSION << "]\n";
+		} else if (!opt.dir_digests) {
+			get_output() << get_xsum_format_string(realf, hex_sum,
+				opt.swap) << '\n';
+			// no space between two
+			for (const auto& x : chunk)
+				get_output() << get_xsum_format_string(realf +
+					get_cdc_label_string(x),
+					get_hex_sum(x.digest), opt.swap)
+					<< '\n';
 		}
 	}
 }
 
 void print_symlink(const std::string& f, const std::string& inp, Squash& squ,
-	Stat& sta) {
+	Merkle& mer, Stat& sta) {
 	assert_file_path(f, inp);
 
 	// debug print first
-	if (opt::debug)
+	if (opt.debug)
 		print_debug(f, FileType::Symlink);
 
 	// get hash value of symlink base name
-	const auto [b, written] = get_string_hash(get_basename(f), opt::hash_algo);
+	const auto [b, written] = opt.metadata_only ?
+		get_metadata_hash(f, "", FileType::Symlink, inp) :
+		get_string_hash(get_basename(f), opt.hash_algo);
 	assert(!b.empty());
 	auto hex_sum = get_hex_sum(b);
 
@@ -416,51 +1358,80 @@ void print_symlink(const std::string& f, const std::string& inp, Squash& squ,
 	sta.append_stat_symlink(f);
 	sta.append_written_symlink(written);
 
+	// add this symlink to merkle tree
+	if (opt.dir_digests)
+		update_merkle_entry(mer, get_relative_path(f, "", inp), b);
+
 	// verify hash value if specified
-	if (!opt::hash_verify.empty() && opt::hash_verify != hex_sum)
+	if (!test_hash_verify(b, hex_sum))
+		return;
+
+	// record this symlink in binary manifest if specified
+	if (!opt.squash && !opt.dir_digests)
+		add_manifest_entry(f, get_real_path(f, inp), b,
+			FileType::Symlink);
+
+	// pass this symlink to library caller or print it as record with
+	// mtime of symlink itself
+	if (is_entry_output() && !opt.squash) {
+		if (!opt.dir_digests)
+			put_entry(f, get_real_path(f, inp), FileType::Symlink,
+				written, b, "", false);
 		return;
+	}
 
 	// squash or print this file
-	if (opt::hash_only) {
-		if (opt::squash)
-			squ.update_buffer(b);
-		else
-			std::cout << hex_sum << std::endl;
+	if (opt.hash_only) {
+		if (opt.squash)
+			update_squash_buffer(squ, b);
+		else if (!opt.dir_digests)
+			get_output() << hex_sum << '\n';
 	} else {
 		auto realf = get_real_path(f, inp);
-		if (opt::squash) {
+		if (opt.squash) {
 			std::vector<char> v(realf.begin(), realf.end());
 			v.insert(v.end(), b.begin(), b.end());
-			squ.update_buffer(v);
-		} else {
-			std::cout << get_xsum_format_string(realf, hex_sum,
-				opt::swap) << std::endl;
+			update_squash_buffer(squ, v);
+		} else if (!opt.dir_digests) {
+			get_output() << get_xsum_format_string(realf, hex_sum,
+				opt.swap) << '\n';
 		}
 	}
 }
 
 void print_unsupported(const std::string& f, Stat& sta) {
-	if (opt::debug)
+	if (opt.debug)
 		print_debug(f, FileType::Unsupported);
 	sta.append_stat_unsupported(f);
 }
 
 void print_invalid(const std::string& f, Stat& sta) {
-	if (opt::debug)
+	if (opt.debug)
 		print_debug(f, FileType::Invalid);
 	sta.append_stat_invalid(f);
 }
 
 void print_debug(const std::string& f, const FileType& t) {
-	assert(opt::debug);
-	if (opt::abs)
-		std::cout << "### " << get_abspath(f) << " "
+	assert(opt.debug);
+	if (opt.abs)
+		get_output() << "### " << get_abspath(f) << " "
 			<< get_file_type_string(t) << std::endl;
 	else
-		std::cout << "### " << f << " " << get_file_type_string(t)
+		get_output() << "### " << f << " " << get_file_type_string(t)
 			<< std::endl;
 }
 
+// false if not modified after --newer cutoff, directories always pass
+// st is of symlink itself if t is symlink
+bool test_newer_entry(const struct stat& st, const FileType& t) {
+	if (opt.newer < 0)
+		return true;
+	if (t != FileType::Reg && t != FileType::Device &&
+		t != FileType::Symlink)
+		return true;
+	return get_mtime_ns(st) > opt.newer;
+}
+
 void print_verbose_stat(const std::string& inp, const Stat& sta) {
 	auto indent = " ";
 
@@ -471,22 +1442,22 @@ void print_verbose_stat(const std::string& inp, const Stat& sta) {
 	auto a3 = sta.num_stat_symlink();
 	assert(a0 + a1 + a2 + a3 == sta.num_stat_total());
 	if (a0 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		print_num_format_string(a0,
 			get_file_type_string(FileType::Dir));
 	}
 	if (a1 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		print_num_format_string(a1,
 			get_file_type_string(FileType::Reg));
 	}
 	if (a2 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		print_num_format_string(a2,
 			get_file_type_string(FileType::Device));
 	}
 	if (a3 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		print_num_format_string(a3,
 			get_file_type_string(FileType::Symlink));
 	}
@@ -498,31 +1469,32 @@ void print_verbose_stat(const std::string& inp, const Stat& sta) {
 	auto b3 = sta.num_written_symlink();
 	assert(b0 + b1 + b2 + b3 == sta.num_written_total());
 	if (b0 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		std::ostringstream ss;
 		ss << get_file_type_string(FileType::Dir) << " byte";
 		print_num_format_string(b0, ss.str());
 	}
 	if (b1 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		std::ostringstream ss;
 		ss << get_file_type_string(FileType::Reg) << " byte";
 		print_num_format_string(b1, ss.str());
 	}
 	if (b2 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		std::ostringstream ss;
 		ss << get_file_type_string(FileType::Device) << " byte";
 		print_num_format_string(b2, ss.str());
 	}
 	if (b3 > 0) {
-		std::cout << indent;
+		get_output() << indent;
 		std::ostringstream ss;
 		ss << get_file_type_string(FileType::Symlink) << " byte";
 		print_num_format_string(b3, ss.str());
 	}
 
 	sta.print_stat_ignored(inp);
+	sta.print_stat_skipped();
 }
 
 void assert_file_path(const std::string& f, const std::string& inp) {
@@ -1,8 +1,19 @@
 #ifndef SRC_DIR_H_
 #define SRC_DIR_H_
 
+#include <vector>
 #include <string>
+#include <istream>
+
+#include "./util.h"
+
+extern const std::string METADATA_LABEL;
+extern const int METADATA_VERSION;
 
 int print_input(const std::string&);
+int print_inputs(const std::vector<std::string>&);
+int print_input_list(const std::string&, std::istream&, char);
+int merge_partial_input(const std::vector<std::string>&);
+bool test_ignore_entry(const std::string&, const FileType&);
 std::string get_real_path(const std::string&, const std::string&);
 #endif // SRC_DIR_H_
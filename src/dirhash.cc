@@ -0,0 +1,367 @@
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <stdexcept>
+
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+
+#include "./dir.h"
+#include "./dirhash.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./output.h"
+
+namespace {
+thread_local const ResultSink* _sink;
+std::once_flag _hash_once;
+
+// thrown from sink to stop walk once consumer is gone
+struct ResultCancel {
+};
+
+// bounded so that producer blocks until consumer catches up
+class ResultQueue {
+	public:
+	explicit ResultQueue(std::size_t limit):
+		_limit(limit),
+		_done(false),
+		_cancel(false),
+		_ret(0) {
+	}
+	void push(const Result& x) {
+		std::unique_lock<std::mutex> lk(_mutex);
+		_cv.wait(lk, [&] { return _q.size() < _limit || _cancel; });
+		if (_cancel)
+			throw ResultCancel();
+		_q.push_back(x);
+		_cv.notify_all();
+	}
+	// false once producer finished and queue is empty
+	bool pop(Result& x) {
+		std::unique_lock<std::mutex> lk(_mutex);
+		_cv.wait(lk, [&] { return !_q.empty() || _done; });
+		if (_q.empty())
+			return false;
+		x = std::move(_q.front());
+		_q.pop_front();
+		_cv.notify_all();
+		return true;
+	}
+	void finish(int ret, std::exception_ptr e) {
+		std::lock_guard<std::mutex> lk(_mutex);
+		_done = true;
+		_ret = ret;
+		_e = e;
+		_cv.notify_all();
+	}
+	void cancel(void) {
+		std::lock_guard<std::mutex> lk(_mutex);
+		_cancel = true;
+		_cv.notify_all();
+	}
+	int get_ret(void) const {
+		return _ret;
+	}
+	std::exception_ptr get_exception(void) const {
+		return _e;
+	}
+
+	private:
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::deque<Result> _q;
+	std::size_t _limit;
+	bool _done;
+	bool _cancel;
+	int _ret;
+	std::exception_ptr _e;
+};
+
+// stop and join producer, also when generator is destroyed early
+class ResultProducer {
+	public:
+	ResultProducer(ResultQueue& q, const Options& o, const std::string& f):
+		_q(q),
+		_t([&q, o, f](void) {
+			auto ret = 0;
+			std::exception_ptr e;
+			try {
+				ret = hash_path(o, f, [&](const Result& x) {
+					q.push(x);
+				});
+			} catch (const ResultCancel&) {
+			} catch (...) {
+				e = std::current_exception();
+			}
+			q.finish(ret, e);
+		}) {
+	}
+	~ResultProducer(void) {
+		_q.cancel();
+		_t.join();
+	}
+	ResultProducer(const ResultProducer&) = delete;
+	ResultProducer& operator=(const ResultProducer&) = delete;
+
+	private:
+	ResultQueue& _q;
+	std::thread _t;
+};
+
+// arguments by value, coroutine outlives caller's frame
+Generator<Result> generate_result(Options o, std::string f,
+	std::size_t limit) {
+	ResultQueue q(limit);
+	ResultProducer p(q, o, f);
+	Result x;
+	while (q.pop(x))
+		co_yield x;
+	if (q.get_exception())
+		std::rethrow_exception(q.get_exception());
+	auto ret = q.get_ret();
+	if (ret < 0)
+		throw std::runtime_error(f + ": " + strerror(-ret));
+}
+} // namespace
+
+// options which depend on process wide state or print other than results
+int test_library_option(const Options& o) {
+	if (!o.hash_verify.empty() || !o.hash_verify_from.empty() || o.first ||
+		!o.cache.empty() || !o.checkpoint.empty() || !o.check.empty() ||
+		!o.manifest.empty() || !o.manifest_to_text.empty() ||
+		!o.manifest_from_text.empty() || o.diff || o.find_dups ||
+		o.cdc || o.shard_count || !o.emit_partial.empty() ||
+		o.merge_partials || o.sync_server || !o.sync_client.empty() ||
+		o.watch || o.output_format != OUTPUT_TEXT || o.verbose ||
+		o.debug)
+		return -EINVAL;
+	if (o.quick && (o.squash || o.dir_digests))
+		return -EINVAL;
+	if (o.metadata_only && (o.quick || o.dir_digests))
+		return -EINVAL;
+	if (o.tar && (o.follow_symlink || o.quick || o.metadata_only))
+		return -EINVAL;
+	return 0;
+}
+
+// hash f with o and pass results to fn instead of printing them,
+// throws std::runtime_error on I/O error same as print_input
+int hash_path(const Options& o, const std::string& f, const ResultSink& fn) {
+	auto ret = test_library_option(o);
+	if (ret < 0)
+		return ret;
+	std::call_once(_hash_once, hash_init);
+	if (!new_hash(o.hash_algo))
+		return -EINVAL;
+
+	// keep options of calling thread, e.g. main thread of dirhash-cpp
+	auto x = opt;
+	opt = o;
+	_sink = &fn;
+	try {
+		ret = print_input(f);
+	} catch (...) {
+		opt = x;
+		_sink = nullptr;
+		throw;
+	}
+	opt = x;
+	_sink = nullptr;
+	return ret;
+}
+
+// same as hash_path, but results are pulled from g as the walk proceeds,
+// with at most limit results buffered, and the walk stops once g is destroyed
+int hash_path_generator(const Options& o, const std::string& f,
+	std::size_t limit, Generator<Result>& g) {
+	auto ret = test_library_option(o);
+	if (ret < 0)
+		return ret;
+	if (!limit)
+		return -EINVAL;
+	std::call_once(_hash_once, hash_init);
+	if (!new_hash(o.hash_algo))
+		return -EINVAL;
+	g = generate_result(o, f, limit);
+	return 0;
+}
+
+bool is_result_sink(void) {
+	return _sink != nullptr;
+}
+
+void put_result(const Result& r) {
+	assert(_sink);
+	(*_sink)(r);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <map>
+
+#include <cppunit/TestAssert.h>
+
+#include <unistd.h>
+
+#include "./cppunit.h"
+
+void DirhashTest::test_test_library_option(void) {
+	Options o;
+	CPPUNIT_ASSERT_EQUAL(test_library_option(o), 0);
+	o.squash = o.sort = o.tar = true;
+	CPPUNIT_ASSERT_EQUAL(test_library_option(o), 0);
+
+	const std::vector<std::function<void(Options&)>> ng{
+		[](Options& x) { x.verbose = true; },
+		[](Options& x) { x.hash_verify = "x"; },
+		[](Options& x) { x.cache = "x"; },
+		[](Options& x) { x.manifest = "x"; },
+		[](Options& x) { x.watch = true; },
+		[](Options& x) { x.cdc = true; },
+		[](Options& x) { x.quick = x.squash = true; },
+		[](Options& x) { x.tar = x.follow_symlink = true; },
+	};
+	for (const auto& fn : ng) {
+		Options x;
+		fn(x);
+		CPPUNIT_ASSERT_EQUAL(test_library_option(x), -EINVAL);
+	}
+
+	o = {};
+	o.hash_algo = "xxx";
+	CPPUNIT_ASSERT_EQUAL(hash_path(o, "/", [](const Result&) {}),
+		-EINVAL);
+}
+
+void DirhashTest::test_hash_path(void) {
+	auto d = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-dirhash-test." + std::to_string(getpid()));
+	std::filesystem::create_directories(d / "a" / "b");
+	for (const auto& f : {"x", "a/y", "a/b/z"}) {
+		std::ofstream ofs(d / f);
+		ofs << f;
+	}
+
+	auto get = [&](const Options& o) {
+		std::map<std::string, std::string> m;
+		CPPUNIT_ASSERT_EQUAL(hash_path(o, d, [&](const Result& r) {
+			CPPUNIT_ASSERT(!m.contains(r.path));
+			m[r.path] = get_hex_sum(r.digest);
+		}), 0);
+		return m;
+	};
+
+	Options o1;
+	auto m1 = get(o1);
+	CPPUNIT_ASSERT_EQUAL(m1.size(), static_cast<std::size_t>(3));
+	CPPUNIT_ASSERT_EQUAL(m1["a/b/z"], get_hex_sum(std::get<0>(
+		get_string_hash("a/b/z", hash::SHA256))));
+	CPPUNIT_ASSERT(!is_result_sink());
+
+	Options o2;
+	o2.hash_algo = hash::SHA1;
+	o2.dir_digests = true;
+	auto m2 = get(o2);
+	CPPUNIT_ASSERT_EQUAL(m2.size(), static_cast<std::size_t>(3));
+	CPPUNIT_ASSERT(m2.contains("."));
+	CPPUNIT_ASSERT(m2.contains("a/b"));
+	CPPUNIT_ASSERT_EQUAL(m2["a"].size(), static_cast<std::size_t>(40));
+
+	Options o3;
+	o3.squash = o3.sort = true;
+	auto m3 = get(o3);
+	CPPUNIT_ASSERT_EQUAL(m3.size(), static_cast<std::size_t>(1));
+	CPPUNIT_ASSERT(m3.contains("."));
+
+	// options of concurrent calls don't interfere
+	std::vector<std::thread> threads;
+	std::vector<int> ok(12); // not vector<bool>, written concurrently
+	for (std::size_t i = 0; i < ok.size(); i++) {
+		threads.push_back(std::thread([&, i](void) {
+			const auto& o = i % 3 == 0 ? o1 : i % 3 == 1 ? o2 : o3;
+			const auto& m = i % 3 == 0 ? m1 : i % 3 == 1 ? m2 : m3;
+			for (auto j = 0; j < 20; j++) {
+				std::map<std::string, std::string> x;
+				hash_path(o, d, [&](const Result& r) {
+					x[r.path] = get_hex_sum(r.digest);
+				});
+				if (x != m)
+					return;
+			}
+			ok[i] = 1;
+		}));
+	}
+	for (auto& t : threads)
+		t.join();
+	for (std::size_t i = 0; i < ok.size(); i++)
+		CPPUNIT_ASSERT(ok[i]);
+	std::filesystem::remove_all(d);
+}
+
+void DirhashTest::test_hash_path_generator(void) {
+	auto d = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-dirhash-test." + std::to_string(getpid()));
+	for (auto i = 0; i < 100; i++) {
+		auto x = d / std::to_string(i % 10) / std::to_string(i);
+		std::filesystem::create_directories(x.parent_path());
+		std::ofstream ofs(x);
+		ofs << i;
+	}
+
+	Options o;
+	std::map<std::string, std::string> m;
+	CPPUNIT_ASSERT_EQUAL(hash_path(o, d, [&](const Result& r) {
+		m[r.path] = get_hex_sum(r.digest);
+	}), 0);
+	CPPUNIT_ASSERT_EQUAL(m.size(), static_cast<std::size_t>(100));
+
+	// same results regardless of queue size
+	for (const auto& limit : {1ul, 7ul, 1000ul}) {
+		Generator<Result> g;
+		CPPUNIT_ASSERT_EQUAL(hash_path_generator(o, d, limit, g), 0);
+		std::map<std::string, std::string> x;
+		for (const auto& r : g)
+			x[r.path] = get_hex_sum(r.digest);
+		CPPUNIT_ASSERT(x == m);
+	}
+
+	// stop early, producer is joined when generator is destroyed
+	for (const auto& n : {0, 1, 50}) {
+		Generator<Result> g;
+		CPPUNIT_ASSERT_EQUAL(hash_path_generator(o, d, 4, g), 0);
+		auto i = 0;
+		for (const auto& r : g) {
+			if (i++ == n)
+				break;
+			CPPUNIT_ASSERT(m.contains(r.path));
+		}
+		CPPUNIT_ASSERT_EQUAL(i, n + 1);
+	}
+
+	// errors are rethrown to consumer
+	{
+		Generator<Result> g;
+		CPPUNIT_ASSERT_EQUAL(hash_path_generator(o, d / "xxx", 4, g),
+			0);
+		try {
+			for (const auto& r : g)
+				CPPUNIT_FAIL(r.path);
+			CPPUNIT_FAIL("");
+		} catch (const std::runtime_error&) {
+		}
+	}
+
+	Generator<Result> g;
+	CPPUNIT_ASSERT_EQUAL(hash_path_generator(o, d, 0, g), -EINVAL);
+	o.verbose = true;
+	CPPUNIT_ASSERT_EQUAL(hash_path_generator(o, d, 4, g), -EINVAL);
+	std::filesystem::remove_all(d);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DirhashTest);
+#endif
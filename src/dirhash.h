@@ -0,0 +1,51 @@
+#ifndef SRC_DIRHASH_H_
+#define SRC_DIRHASH_H_
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include "./generator.h"
+#include "./option.h"
+#include "./util.h"
+
+// Embedding API of libdirhash. Results are passed to a callback instead of
+// printed, and options are per call rather than process wide, hence calls
+// from multiple threads run concurrently with OpenSSL initialized once.
+struct Result {
+	std::string path; // as printed, "." for input itself
+	FileType type; // directory for per directory digest
+	unsigned long size; // bytes hashed
+	std::vector<char> digest; // empty if unsupported or invalid
+	bool squash; // squashed digest of input
+};
+
+typedef std::function<void(const Result&)> ResultSink;
+
+int test_library_option(const Options&);
+int hash_path(const Options&, const std::string&, const ResultSink&);
+int hash_path_generator(const Options&, const std::string&, std::size_t,
+	Generator<Result>&);
+bool is_result_sink(void);
+void put_result(const Result&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class DirhashTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(DirhashTest);
+	CPPUNIT_TEST(test_test_library_option);
+	CPPUNIT_TEST(test_hash_path);
+	CPPUNIT_TEST(test_hash_path_generator);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_test_library_option(void);
+	void test_hash_path(void);
+	void test_hash_path_generator(void);
+};
+#endif
+#endif // SRC_DIRHASH_H_
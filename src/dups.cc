@@ -0,0 +1,231 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <exception>
+
+#include <cassert>
+
+#include <sys/stat.h>
+
+#include "./cache.h"
+#include "./diff.h"
+#include "./dups.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./util.h"
+
+namespace {
+const unsigned long DUPS_PARTIAL_SIZE = 4096;
+
+void run_parallel(std::size_t n, const std::function<void(std::size_t)>& fn) {
+	std::atomic<std::size_t> next_job(0);
+	auto worker = [&](void) {
+		while (true) {
+			auto i = next_job++;
+			if (i >= n)
+				break;
+			fn(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < opt.jobs; i++)
+		threads.push_back(new_thread(worker));
+	for (auto& t : threads)
+		t.join();
+}
+
+std::string get_size_key(std::uint64_t siz) {
+	std::vector<char> v;
+	put_le64(v, siz);
+	std::reverse(v.begin(), v.end()); // sort by size
+	return std::string(v.begin(), v.end());
+}
+
+// hash given entries with fn, empty key if unreadable
+std::vector<std::string> get_hash_key(const std::vector<DiffEntry>& l,
+	const std::vector<std::size_t>& x,
+	const std::function<hash_res(const std::string&)>& fn) {
+	std::vector<std::string> key(l.size());
+	run_parallel(x.size(), [&](std::size_t i) {
+		const auto& e = l[x[i]];
+		try {
+			auto [b, _ignore] = fn(e.file);
+			key[x[i]] = get_size_key(e.size) +
+				std::string(b.begin(), b.end());
+		} catch (const std::exception& ex) {
+		}
+	});
+	return key;
+}
+} // namespace
+
+// regular files under inputs, each file once even if reachable from
+// overlapping inputs or hardlinked, with paths prefixed by input if many
+int get_dup_entry(const std::vector<std::string>& inputs,
+	std::vector<DiffEntry>& l) {
+	std::set<std::pair<dev_t, ino_t>> seen;
+	for (const auto& f : inputs) {
+		std::vector<DiffEntry> v;
+		auto ret = get_tree_entry(f, v);
+		if (ret < 0)
+			return ret;
+		for (auto& e : v) {
+			if (e.type != FileType::Reg)
+				continue;
+			struct stat st;
+			if (stat(e.file.c_str(), &st) == -1 ||
+				!seen.insert({st.st_dev, st.st_ino}).second)
+				continue;
+			if (inputs.size() > 1)
+				e.path = f.ends_with("/") ? f + e.path :
+					f + "/" + e.path;
+			l.push_back(std::move(e));
+		}
+	}
+	return 0;
+}
+
+// groups of indices in x sharing the same non empty key, ordered by key
+std::vector<std::vector<std::size_t>> get_dup_group(
+	const std::vector<std::string>& key, const std::vector<std::size_t>& x) {
+	std::map<std::string, std::vector<std::size_t>> m;
+	for (auto i : x)
+		if (!key[i].empty())
+			m[key[i]].push_back(i);
+	std::vector<std::vector<std::size_t>> l;
+	for (auto& [k, v] : m)
+		if (v.size() > 1)
+			l.push_back(std::move(v));
+	return l;
+}
+
+// print regular files with identical content grouped by message digest,
+// only files sharing size and then first and last blocks are fully hashed
+int find_dups(const std::vector<std::string>& inputs) {
+	std::vector<DiffEntry> l;
+	auto ret = get_dup_entry(inputs, l);
+	if (ret < 0)
+		return ret;
+
+	// same size
+	std::vector<std::string> key(l.size());
+	std::vector<std::size_t> x;
+	for (std::size_t i = 0; i < l.size(); i++) {
+		key[i] = get_size_key(l[i].size);
+		x.push_back(i);
+	}
+	auto g = get_dup_group(key, x);
+
+	// same first and last blocks, unless small enough to fully hash
+	std::vector<std::size_t> partial, full;
+	for (const auto& v : g)
+		for (auto i : v)
+			if (l[i].size > 2 * DUPS_PARTIAL_SIZE)
+				partial.push_back(i);
+			else
+				full.push_back(i);
+	key = get_hash_key(l, partial, [](const std::string& f) {
+		return get_file_partial_hash(f, opt.hash_algo,
+			DUPS_PARTIAL_SIZE);
+	});
+	for (const auto& v : get_dup_group(key, partial))
+		full.insert(full.end(), v.begin(), v.end());
+
+	// same message digest
+	key = get_hash_key(l, full, [](const std::string& f) {
+		return get_cache_file_hash(f, opt.hash_algo);
+	});
+	g = get_dup_group(key, full);
+
+	unsigned long num_dups = 0;
+	for (auto& v : g) {
+		if (num_dups)
+			std::cout << std::endl;
+		std::sort(v.begin(), v.end(), [&](std::size_t a, std::size_t b) {
+			return l[a].path < l[b].path;
+		});
+		auto hex_sum = get_hex_sum(std::vector<char>(key[v[0]].begin() +
+			8, key[v[0]].end()));
+		for (auto i : v)
+			if (opt.hash_only)
+				std::cout << hex_sum << std::endl;
+			else
+				std::cout << get_xsum_format_string(l[i].path,
+					hex_sum, opt.swap) << std::endl;
+		num_dups += v.size() - 1;
+	}
+
+	if (opt.verbose) {
+		if (num_dups)
+			std::cout << std::endl;
+		print_num_format_string(l.size(), "file");
+		print_num_format_string(partial.size(), "partially hashed file");
+		print_num_format_string(full.size(), "fully hashed file");
+		print_num_format_string(g.size(), "duplicate group");
+		print_num_format_string(num_dups, "duplicate file");
+	}
+	return 0;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <filesystem>
+#include <fstream>
+
+#include <cppunit/TestAssert.h>
+
+#include <unistd.h>
+
+#include "./cppunit.h"
+
+void DupsTest::test_get_dup_entry(void) {
+	auto d = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-dups-test." + std::to_string(getpid()));
+	std::filesystem::create_directories(d / "a" / "b");
+	for (const auto& f : {"x", "a/y", "a/b/z"}) {
+		std::ofstream ofs(d / f);
+		ofs << "xxx";
+	}
+	std::filesystem::create_hard_link(d / "x", d / "a" / "hl");
+
+	// hardlink is the same file
+	std::vector<DiffEntry> l;
+	CPPUNIT_ASSERT_EQUAL(get_dup_entry({d}, l), 0);
+	CPPUNIT_ASSERT_EQUAL(l.size(), static_cast<std::size_t>(3));
+	for (const auto& e : l)
+		CPPUNIT_ASSERT(!e.path.starts_with("/"));
+
+	// overlapping inputs, files under a/b only once and prefixed
+	std::string x = d / "a" / "b";
+	l.clear();
+	CPPUNIT_ASSERT_EQUAL(get_dup_entry({x, d / "a"}, l), 0);
+	CPPUNIT_ASSERT_EQUAL(l.size(), static_cast<std::size_t>(3));
+	CPPUNIT_ASSERT_EQUAL(l[0].path, x + "/z");
+	for (std::size_t i = 1; i < l.size(); i++)
+		CPPUNIT_ASSERT(l[i].path.starts_with(std::string(d / "a") +
+			"/"));
+	std::filesystem::remove_all(d);
+}
+
+void DupsTest::test_get_dup_group(void) {
+	const std::vector<std::string> key{"b", "a", "", "b", "c", "a", "", "b"};
+	std::vector<std::size_t> x{0, 1, 2, 3, 4, 5, 6, 7};
+	auto g = get_dup_group(key, x);
+	CPPUNIT_ASSERT_EQUAL(g.size(), static_cast<std::size_t>(2));
+	CPPUNIT_ASSERT(g[0] == std::vector<std::size_t>({1, 5}));
+	CPPUNIT_ASSERT(g[1] == std::vector<std::size_t>({0, 3, 7}));
+
+	// only given indices
+	x = {0, 1, 3, 4};
+	g = get_dup_group(key, x);
+	CPPUNIT_ASSERT_EQUAL(g.size(), static_cast<std::size_t>(1));
+	CPPUNIT_ASSERT(g[0] == std::vector<std::size_t>({0, 3}));
+	CPPUNIT_ASSERT(get_dup_group(key, {}).empty());
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DupsTest);
+#endif
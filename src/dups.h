@@ -0,0 +1,31 @@
+#ifndef SRC_DUPS_H_
+#define SRC_DUPS_H_
+
+#include <vector>
+#include <string>
+
+#include "./diff.h"
+
+int get_dup_entry(const std::vector<std::string>&, std::vector<DiffEntry>&);
+std::vector<std::vector<std::size_t>> get_dup_group(
+	const std::vector<std::string>&, const std::vector<std::size_t>&);
+int find_dups(const std::vector<std::string>&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class DupsTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(DupsTest);
+	CPPUNIT_TEST(test_get_dup_entry);
+	CPPUNIT_TEST(test_get_dup_group);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_dup_entry(void);
+	void test_get_dup_group(void);
+};
+#endif
+#endif // SRC_DUPS_H_
@@ -0,0 +1,114 @@
+#ifndef SRC_GENERATOR_H_
+#define SRC_GENERATOR_H_
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+// Minimal std::generator for C++20. Values are produced lazily on each
+// increment, and exceptions thrown by the coroutine are rethrown to the
+// consumer. Destroying the generator before the end stops the coroutine.
+template <typename T>
+class Generator {
+	public:
+	struct promise_type;
+	typedef std::coroutine_handle<promise_type> handle;
+
+	struct promise_type {
+		const T* _value;
+		std::exception_ptr _e;
+
+		Generator get_return_object(void) {
+			return Generator(handle::from_promise(*this));
+		}
+		std::suspend_always initial_suspend(void) noexcept {
+			return {};
+		}
+		std::suspend_always final_suspend(void) noexcept {
+			return {};
+		}
+		std::suspend_always yield_value(const T& x) noexcept {
+			_value = std::addressof(x);
+			return {};
+		}
+		void return_void(void) noexcept {
+		}
+		void unhandled_exception(void) noexcept {
+			_e = std::current_exception();
+		}
+		template <typename U>
+		void await_transform(U&&) = delete; // yield only
+	};
+
+	class iterator {
+		public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+
+		explicit iterator(handle h):
+			_h(h) {
+		}
+		const T& operator*(void) const {
+			return *_h.promise()._value;
+		}
+		iterator& operator++(void) {
+			resume(_h);
+			return *this;
+		}
+		void operator++(int) {
+			++*this;
+		}
+		bool operator==(std::default_sentinel_t) const {
+			return !_h || _h.done();
+		}
+
+		private:
+		handle _h;
+	};
+
+	Generator(void):
+		_h(nullptr) {
+	}
+	Generator(Generator&& x) noexcept:
+		_h(std::exchange(x._h, nullptr)) {
+	}
+	Generator& operator=(Generator&& x) noexcept {
+		if (this != &x) {
+			if (_h)
+				_h.destroy();
+			_h = std::exchange(x._h, nullptr);
+		}
+		return *this;
+	}
+	Generator(const Generator&) = delete;
+	Generator& operator=(const Generator&) = delete;
+	~Generator(void) {
+		if (_h)
+			_h.destroy();
+	}
+	iterator begin(void) {
+		if (_h)
+			resume(_h);
+		return iterator(_h);
+	}
+	std::default_sentinel_t end(void) const noexcept {
+		return {};
+	}
+
+	private:
+	explicit Generator(handle h):
+		_h(h) {
+	}
+	static void resume(handle h) {
+		h.resume();
+		if (h.promise()._e)
+			std::rethrow_exception(std::exchange(h.promise()._e,
+				nullptr));
+	}
+
+	handle _h;
+};
+#endif // SRC_GENERATOR_H_
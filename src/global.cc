@@ -0,0 +1,3 @@
+#include "./global.h"
+
+thread_local Options opt;
@@ -1,23 +1,20 @@
 #ifndef SRC_GLOBAL_H_
 #define SRC_GLOBAL_H_
 
-#include <string>
+#include <thread>
 
-// readonly after getopt
-namespace opt {
-	extern std::string hash_algo;
-	extern std::string hash_verify;
-	extern bool hash_only;
-	extern bool ignore_dot;
-	extern bool ignore_dot_dir;
-	extern bool ignore_dot_file;
-	extern bool ignore_symlink;
-	extern bool follow_symlink;
-	extern bool abs;
-	extern bool swap;
-	extern bool sort;
-	extern bool squash;
-	extern bool verbose;
-	extern bool debug;
-} // namespace opt
+#include "./option.h"
+
+// readonly after getopt or library call, per thread so that library calls
+// from multiple threads don't interfere
+extern thread_local Options opt;
+
+// std::thread running fn with options of calling thread
+template <typename F>
+std::thread new_thread(F fn) {
+	return std::thread([o = opt, fn](void) mutable {
+		opt = o;
+		fn();
+	});
+}
 #endif // SRC_GLOBAL_H_
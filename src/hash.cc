@@ -2,17 +2,29 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <filesystem>
 #include <array>
+#include <algorithm>
 #include <unordered_map>
 #include <stdexcept>
 
+#include <cstring>
+#include <cerrno>
+#include <cctype>
 #include <cassert>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <openssl/evp.h>
 #include <openssl/err.h>
 
 #include "./global.h"
 #include "./hash.h"
+#include "./util.h"
+
+const std::string QUICK_LABEL("quick");
+const int QUICK_VERSION = 1;
 
 namespace hash {
 	const std::string MD5 = "md5";
@@ -62,9 +74,44 @@ const std::unordered_map<std::string, std::string> hash_algo_openssl_map{
 
 const std::streamsize BUF_SIZE = 65536;
 
-hash_res get_hash(std::istream&, const std::string&);
+hash_res get_hash(std::istream&, const std::string&,
+	const std::function<void(const char*, std::size_t)>& = nullptr);
+void openssl_evp_error(unsigned long);
 } // namespace
 
+HashContext::HashContext(const std::string& hash_algo):
+	_md(new_hash(hash_algo)),
+	_ctx(EVP_MD_CTX_new()) {
+	assert(_md);
+	assert(_ctx);
+	if (EVP_DigestInit_ex(reinterpret_cast<EVP_MD_CTX*>(_ctx),
+		reinterpret_cast<const EVP_MD*>(_md), NULL) == 0)
+		openssl_evp_error(ERR_get_error());
+}
+
+HashContext::~HashContext(void) {
+	EVP_MD_CTX_free(reinterpret_cast<EVP_MD_CTX*>(_ctx));
+}
+
+void HashContext::update(const char* p, std::size_t n) {
+	if (EVP_DigestUpdate(reinterpret_cast<EVP_MD_CTX*>(_ctx), p, n) == 0)
+		openssl_evp_error(ERR_get_error());
+}
+
+std::vector<char> HashContext::get_digest(void) {
+	auto* ctx = reinterpret_cast<EVP_MD_CTX*>(_ctx);
+	std::vector<char> buf(EVP_MAX_MD_SIZE, 0);
+	unsigned int n;
+	if (EVP_DigestFinal_ex(ctx, reinterpret_cast<unsigned char*>(&buf[0]),
+		&n) == 0)
+		openssl_evp_error(ERR_get_error());
+	if (EVP_DigestInit_ex(ctx, reinterpret_cast<const EVP_MD*>(_md),
+		NULL) == 0)
+		openssl_evp_error(ERR_get_error());
+	buf.resize(n);
+	return buf;
+}
+
 void hash_init(void) {
 	OpenSSL_add_all_algorithms();
 	ERR_load_crypto_strings();
@@ -93,7 +140,7 @@ std::vector<std::string> get_available_hash_algo(void) {
 	for (const auto& s : hash_algo_list)
 		if (new_hash(s))
 			ret.push_back(s);
-		else if (opt::verbose || opt::debug)
+		else if (opt.verbose || opt.debug)
 			ret.push_back("*" + s);
 	return ret;
 }
@@ -105,6 +152,85 @@ hash_res get_file_hash(const std::string& f, const std::string& hash_algo) {
 	return get_hash(ifs, hash_algo);
 }
 
+// same as above, but also pass each buffer read to fn
+hash_res get_file_hash(const std::string& f, const std::string& hash_algo,
+	const std::function<void(const char*, std::size_t)>& fn) {
+	std::ifstream ifs;
+	ifs.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	ifs.open(f, std::ifstream::binary);
+	return get_hash(ifs, hash_algo, fn);
+}
+
+// first and last n bytes, or whole file if no larger than 2n bytes
+hash_res get_file_partial_hash(const std::string& f,
+	const std::string& hash_algo, unsigned long n) {
+	std::ifstream ifs;
+	ifs.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	ifs.open(f, std::ifstream::binary);
+	ifs.seekg(0, std::ios::end);
+	auto siz = static_cast<unsigned long>(ifs.tellg());
+	ifs.seekg(0, std::ios::beg);
+	if (siz <= 2 * n)
+		return get_hash(ifs, hash_algo);
+
+	std::vector<char> v(2 * n);
+	ifs.read(v.data(), static_cast<std::streamsize>(n));
+	ifs.seekg(static_cast<std::streamoff>(siz - n), std::ios::beg);
+	ifs.read(v.data() + n, static_cast<std::streamsize>(n));
+	return get_byte_hash(v, hash_algo);
+}
+
+// file size followed by head, n evenly spaced interior and tail blocks,
+// or whole file if small enough, hence constant I/O per file
+hash_res get_file_quick_hash(const std::string& f,
+	const std::string& hash_algo, unsigned long n) {
+	auto fd = open(f.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error(f + ": " + strerror(errno));
+
+	std::vector<char> v;
+	auto siz = lseek(fd, 0, SEEK_END);
+	if (siz == -1) {
+		auto error = errno;
+		close(fd);
+		throw std::runtime_error(f + ": " + strerror(error));
+	}
+	put_le64(v, static_cast<std::uint64_t>(siz));
+
+	std::vector<off_t> off{0};
+	auto bsiz = static_cast<off_t>(QUICK_BLOCK_SIZE);
+	if (siz <= static_cast<off_t>(n + 2) * bsiz) {
+		bsiz = siz;
+	} else {
+		for (unsigned long i = 1; i <= n; i++)
+			off.push_back((siz - bsiz) * static_cast<off_t>(i) /
+				static_cast<off_t>(n + 1));
+		off.push_back(siz - bsiz);
+	}
+
+	for (auto x : off) {
+		auto i = v.size();
+		v.resize(i + static_cast<std::size_t>(bsiz));
+		std::size_t resid = static_cast<std::size_t>(bsiz);
+		while (resid > 0) {
+			auto ret = pread(fd, &v[v.size() - resid], resid,
+				x + bsiz - static_cast<off_t>(resid));
+			if (ret == -1) {
+				auto error = errno;
+				close(fd);
+				throw std::runtime_error(f + ": " +
+					strerror(error));
+			} else if (ret == 0) {
+				break; // truncated
+			}
+			resid -= static_cast<std::size_t>(ret);
+		}
+		v.resize(v.size() - resid);
+	}
+	close(fd);
+	return get_byte_hash(v, hash_algo);
+}
+
 hash_res get_byte_hash(const std::vector<char>& s,
 	const std::string& hash_algo) {
 	std::istringstream iss(std::string(s.begin(), s.end()));
@@ -116,6 +242,10 @@ hash_res get_string_hash(const std::string& s, const std::string& hash_algo) {
 	return get_hash(iss, hash_algo);
 }
 
+hash_res get_stream_hash(std::istream& is, const std::string& hash_algo) {
+	return get_hash(is, hash_algo);
+}
+
 namespace {
 void openssl_evp_error(unsigned long error) {
 	char buf[1024];
@@ -125,7 +255,8 @@ void openssl_evp_error(unsigned long error) {
 	throw std::runtime_error(ss.str());
 }
 
-hash_res get_hash(std::istream& is, const std::string& hash_algo) {
+hash_res get_hash(std::istream& is, const std::string& hash_algo,
+	const std::function<void(const char*, std::size_t)>& fn) {
 	const auto* h = reinterpret_cast<const EVP_MD*>(new_hash(hash_algo));
 	assert(h);
 
@@ -148,6 +279,8 @@ hash_res get_hash(std::istream& is, const std::string& hash_algo) {
 		written += static_cast<unsigned long>(siz);
 		if (EVP_DigestUpdate(ctx, u, siz) == 0)
 			openssl_evp_error(ERR_get_error());
+		if (fn)
+			fn(p, static_cast<std::size_t>(siz));
 	}
 
 	unsigned int n;
@@ -160,6 +293,24 @@ hash_res get_hash(std::istream& is, const std::string& hash_algo) {
 }
 } // namespace
 
+// extendable-output function, not selectable via --hash_algo
+std::vector<char> get_byte_shake256(const std::vector<char>& s,
+	unsigned long len) {
+	auto* ctx = EVP_MD_CTX_new();
+	assert(ctx);
+	if (EVP_DigestInit_ex(ctx, EVP_shake256(), NULL) == 0)
+		openssl_evp_error(ERR_get_error());
+	if (EVP_DigestUpdate(ctx, s.data(), s.size()) == 0)
+		openssl_evp_error(ERR_get_error());
+
+	std::vector<char> buf(len, 0);
+	if (EVP_DigestFinalXOF(ctx, reinterpret_cast<unsigned char*>(&buf[0]),
+		len) == 0)
+		openssl_evp_error(ERR_get_error());
+	EVP_MD_CTX_free(ctx);
+	return buf;
+}
+
 std::string get_hex_sum(const std::vector<char>& sum) {
 	std::ostringstream ss;
 	ss << std::hex;
@@ -169,6 +320,16 @@ std::string get_hex_sum(const std::vector<char>& sum) {
 	return ss.str();
 }
 
+// inverse of get_hex_sum, expects even length valid hex string
+std::vector<char> get_hex_byte(const std::string& s) {
+	std::vector<char> v;
+	v.reserve(s.size() / 2);
+	for (std::size_t i = 0; i + 1 < s.size(); i += 2)
+		v.push_back(static_cast<char>(std::stoi(s.substr(i, 2), nullptr,
+			16)));
+	return v;
+}
+
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestAssert.h>
 
@@ -271,5 +432,77 @@ void HashTest::test_get_string_hash(void) {
 	}
 }
 
+void HashTest::test_get_file_quick_hash(void) {
+	auto f = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-hash-test." + std::to_string(getpid())));
+	std::string s;
+	for (auto i = 0; i < 100000; i++)
+		s += std::to_string(i);
+	std::ofstream(f, std::ofstream::binary) << s;
+	auto get_size = [](std::size_t siz) {
+		std::vector<char> v;
+		put_le64(v, siz);
+		return std::string(v.begin(), v.end());
+	};
+
+	// size and whole file if small enough
+	auto n = s.size() / QUICK_BLOCK_SIZE;
+	auto [b1, n1] = get_file_quick_hash(f, hash::SHA256, n);
+	CPPUNIT_ASSERT(b1 == std::get<0>(get_string_hash(get_size(s.size()) + s,
+		hash::SHA256)));
+	CPPUNIT_ASSERT_EQUAL(n1, static_cast<unsigned long>(s.size() + 8));
+
+	// size, head, one interior block and tail
+	auto x = get_size(s.size()) + s.substr(0, QUICK_BLOCK_SIZE) +
+		s.substr((s.size() - QUICK_BLOCK_SIZE) / 2, QUICK_BLOCK_SIZE) +
+		s.substr(s.size() - QUICK_BLOCK_SIZE);
+	auto [b2, n2] = get_file_quick_hash(f, hash::SHA256, 1);
+	CPPUNIT_ASSERT(b2 == std::get<0>(get_string_hash(x, hash::SHA256)));
+	CPPUNIT_ASSERT_EQUAL(n2, static_cast<unsigned long>(x.size()));
+	CPPUNIT_ASSERT(b2 != b1);
+	std::filesystem::remove(f);
+}
+
+void HashTest::test_get_hex_byte(void) {
+	auto [b, _ignore] = get_string_hash("xxx", hash::SHA256);
+	auto h = get_hex_sum(b);
+	CPPUNIT_ASSERT(get_hex_byte(h) == b);
+	for (auto& c : h)
+		c = static_cast<char>(toupper(c));
+	CPPUNIT_ASSERT(get_hex_byte(h) == b);
+	CPPUNIT_ASSERT(get_hex_byte("").empty());
+}
+
+void HashTest::test_get_byte_shake256(void) {
+	auto b = get_byte_shake256(std::vector<char>{}, 32);
+	CPPUNIT_ASSERT_EQUAL(get_hex_sum(b), std::string("46b9dd2b0ba88d13233b3feb743eeb243fcd52ea62b81b82b50c27646ed5762f"));
+
+	// longer output has shorter output as prefix
+	auto b1 = get_byte_shake256(std::vector<char>{'x'}, 2048);
+	auto b2 = get_byte_shake256(std::vector<char>{'x'}, 64);
+	CPPUNIT_ASSERT_EQUAL(b1.size(), static_cast<std::size_t>(2048));
+	CPPUNIT_ASSERT(std::equal(b2.begin(), b2.end(), b1.begin()));
+}
+
+void HashTest::test_get_file_partial_hash(void) {
+	auto f = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-hash-test." + std::to_string(getpid())));
+	std::string s;
+	for (auto i = 0; i < 100; i++)
+		s += std::to_string(i);
+	std::ofstream(f, std::ofstream::binary) << s;
+
+	// whole file if small enough
+	auto [b1, n1] = get_file_partial_hash(f, hash::SHA256, s.size() / 2);
+	CPPUNIT_ASSERT(b1 == std::get<0>(get_file_hash(f, hash::SHA256)));
+	CPPUNIT_ASSERT_EQUAL(n1, static_cast<unsigned long>(s.size()));
+
+	auto x = s.substr(0, 10) + s.substr(s.size() - 10);
+	auto [b2, n2] = get_file_partial_hash(f, hash::SHA256, 10);
+	CPPUNIT_ASSERT(b2 == std::get<0>(get_string_hash(x, hash::SHA256)));
+	CPPUNIT_ASSERT_EQUAL(n2, 20lu);
+	std::filesystem::remove(f);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(HashTest);
 #endif
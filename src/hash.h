@@ -1,12 +1,18 @@
 #ifndef SRC_HASH_H_
 #define SRC_HASH_H_
 
+#include <istream>
 #include <vector>
 #include <tuple>
+#include <functional>
 #include <string>
 
 typedef std::tuple<std::vector<char>, unsigned long> hash_res;
 
+extern const std::string QUICK_LABEL;
+extern const int QUICK_VERSION;
+const unsigned long QUICK_BLOCK_SIZE = 65536;
+
 namespace hash {
 	extern const std::string MD5;
 	extern const std::string SHA1;
@@ -22,15 +28,39 @@ namespace hash {
 	extern const std::string SHA3_512;
 } // namespace hash
 
+// incremental digest, starts over after each get_digest()
+class HashContext {
+	public:
+	explicit HashContext(const std::string&);
+	~HashContext(void);
+	HashContext(const HashContext&) = delete;
+	HashContext& operator=(const HashContext&) = delete;
+	void update(const char*, std::size_t);
+	std::vector<char> get_digest(void);
+
+	private:
+	const void* _md;
+	void* _ctx;
+};
+
 void hash_init(void);
 void hash_cleanup(void);
 std::string get_openssl_evp_name(const std::string&);
 const void* new_hash(const std::string&);
 std::vector<std::string> get_available_hash_algo(void);
 hash_res get_file_hash(const std::string&, const std::string&);
+hash_res get_file_hash(const std::string&, const std::string&,
+	const std::function<void(const char*, std::size_t)>&);
+hash_res get_file_partial_hash(const std::string&, const std::string&,
+	unsigned long);
+hash_res get_file_quick_hash(const std::string&, const std::string&,
+	unsigned long);
 hash_res get_byte_hash(const std::vector<char>&, const std::string&);
 hash_res get_string_hash(const std::string&, const std::string&);
+hash_res get_stream_hash(std::istream&, const std::string&);
+std::vector<char> get_byte_shake256(const std::vector<char>&, unsigned long);
 std::string get_hex_sum(const std::vector<char>&);
+std::vector<char> get_hex_byte(const std::string&);
 
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestFixture.h>
@@ -45,6 +75,10 @@ class HashTest: public CPPUNIT_NS::TestFixture {
 	CPPUNIT_TEST(test_new_hash);
 	CPPUNIT_TEST(test_get_byte_hash);
 	CPPUNIT_TEST(test_get_string_hash);
+	CPPUNIT_TEST(test_get_file_quick_hash);
+	CPPUNIT_TEST(test_get_hex_byte);
+	CPPUNIT_TEST(test_get_byte_shake256);
+	CPPUNIT_TEST(test_get_file_partial_hash);
 	CPPUNIT_TEST_SUITE_END();
 
 	private:
@@ -53,6 +87,10 @@ class HashTest: public CPPUNIT_NS::TestFixture {
 	void test_new_hash(void);
 	void test_get_byte_hash(void);
 	void test_get_string_hash(void);
+	void test_get_file_quick_hash(void);
+	void test_get_hex_byte(void);
+	void test_get_byte_shake256(void);
+	void test_get_file_partial_hash(void);
 };
 #endif
 #endif // SRC_HASH_H_
@@ -1,42 +1,49 @@
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <iterator>
 #include <array>
+#include <vector>
+#include <set>
 #include <string>
+#include <tuple>
 #include <algorithm>
+#include <thread>
 #include <exception>
+#include <stdexcept>
 
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <cstdint>
 
 #include <getopt.h>
+#include <sys/stat.h>
 
+#include "./cache.h"
+#include "./cdc.h"
+#include "./check.h"
+#include "./checkpoint.h"
 #include "./cppunit.h"
+#include "./diff.h"
 #include "./dir.h"
+#include "./dirhash.h"
+#include "./dups.h"
 #include "./global.h"
 #include "./hash.h"
+#include "./manifest.h"
+#include "./output.h"
+#include "./serve.h"
+#include "./shard.h"
+#include "./sync.h"
 #include "./util.h"
+#include "./verify.h"
+#include "./watch.h"
+#include "./xattr.h"
 
 extern char* optarg;
 extern int optind;
 
-namespace opt {
-	std::string hash_algo("sha256");
-	std::string hash_verify;
-	bool hash_only;
-	bool ignore_dot;
-	bool ignore_dot_dir;
-	bool ignore_dot_file;
-	bool ignore_symlink;
-	bool follow_symlink;
-	bool abs;
-	bool swap;
-	bool sort;
-	bool squash;
-	bool verbose;
-	bool debug;
-} // namespace opt
-
 namespace {
 const std::array<int, 3> _version{0, 4, 6};
 
@@ -61,19 +68,47 @@ void print_build_options(void) {
 #ifdef CONFIG_SQUASH2
 		<< "  squash2" << std::endl
 #endif
+#ifdef CONFIG_SQUASH3
+		<< "  squash3" << std::endl
+#endif
 #ifdef CONFIG_CPPUNIT
 		<< "  cppunit" << std::endl
+#endif
+#ifdef CONFIG_ZLIB
+		<< "  zlib" << std::endl
+#endif
+#ifdef CONFIG_ZSTD
+		<< "  zstd" << std::endl
 #endif
 		;
 }
 
 void usage(const std::string& arg) {
 	std::cout << "Usage: " << arg << " [options] <paths>" << std::endl
+		<< "Usage: " << arg << " [options] --check <manifest> [<path>]"
+		<< std::endl
+		<< "Usage: " << arg << " [options] --manifest_to_text <manifest>"
+		<< std::endl
+		<< "Usage: " << arg << " [options] --manifest <manifest> "
+		"--manifest_from_text <text>" << std::endl
+		<< "Usage: " << arg << " [options] --diff <path|manifest> "
+		"<path|manifest>" << std::endl
+		<< "Usage: " << arg << " [options] --merge_partials <partials>"
+		<< std::endl
+		<< "Usage: " << arg << " [options] --sync_client <command> <path>"
+		<< std::endl
+		<< "Usage: " << arg << " [options] --serve <socket>" << std::endl
+		<< "Usage: " << arg << " [options] --files_from <file|-> [<base>]"
+		<< std::endl
 		<< "Options:" << std::endl
 		<< "  --hash_algo - Hash algorithm to use (default \"sha256\")"
 		<< std::endl
 		<< "  --hash_verify - Message digest to verify in hex string"
 		<< std::endl
+		<< "  --hash_verify_from - File with message digests to verify, "
+		"one per line" << std::endl
+		<< "  --first - Stop after first file matching message digest to "
+		"verify" << std::endl
 		<< "  --hash_only - Do not print file paths" << std::endl
 		<< "  --ignore_dot - Ignore entries start with ." << std::endl
 		<< "  --ignore_dot_dir - Ignore directories start with ."
@@ -88,41 +123,190 @@ void usage(const std::string& arg) {
 		<< "  --sort - Print sorted file paths" << std::endl
 		<< "  --squash - Print squashed message digest instead of per file"
 		<< std::endl
+		<< "  --squash_buffer_limit - Squash buffer size in MiB before "
+		"spilling to disk (default 1024)" << std::endl
+		<< "  --dir_digests - Print per directory message digest instead "
+		"of per file" << std::endl
+		<< "  --dir_digests_depth - Max directory depth to print with "
+		"--dir_digests (default -1 for unlimited)" << std::endl
+		<< "  --cache - Path to persistent message digest cache"
+		<< std::endl
+		<< "  --cache_strict - Percentage of cache hits to revalidate "
+		"(default 0)" << std::endl
+		<< "  --xattr_cache - Store message digest in user.dirhash.* "
+		"extended attribute" << std::endl
+		<< "  --checkpoint - Path to journal of hashed files to resume "
+		"interrupted run from, implies --sort" << std::endl
+		<< "  --check - Verify files listed in manifest relative to path "
+		"(default \".\")" << std::endl
+		<< "  --fail_fast - Stop verifying on first failure" << std::endl
+		<< "  --jobs - Number of threads to hash files or paths in "
+		"parallel (default number of CPUs)" << std::endl
+		<< "  --manifest - Write binary manifest of printed files of a "
+		"single input" << std::endl
+		<< "  --manifest_to_text - Print binary manifest in text"
+		<< std::endl
+		<< "  --manifest_from_text - Convert text manifest to binary "
+		"manifest" << std::endl
+		<< "  --diff - Print files added, removed or modified between two "
+		"paths or manifests" << std::endl
+		<< "  --find_dups - Print regular files with identical content "
+		"grouped by message digest" << std::endl
+		<< "  --quick - Print message digest of file size and sampled "
+		"blocks instead of whole file" << std::endl
+		<< "  --quick_blocks - Number of interior blocks to sample with "
+		"--quick (default 8)" << std::endl
+		<< "  --metadata_only - Print squashed message digest of path, "
+		"type, size, mode and mtime instead of file contents" << std::endl
+		<< "  --cdc - Also print message digest of each content defined "
+		"chunk and unique chunk bytes" << std::endl
+		<< "  --cdc_size - Average chunk size in bytes with --cdc, power "
+		"of 2 (default 8192)" << std::endl
+		<< "  --tar - Hash tar archive paths as directories, optionally "
+		"gzip or zstd compressed" << std::endl
+		<< "  --files_from - Hash paths listed in file or stdin "
+		"relative to base (default \".\") instead of walking" << std::endl
+		<< "  -0, --null - Paths in --files_from are NUL separated"
+		<< std::endl
+		<< "  --output_format - Print text (default), jsonl, csv or "
+		"binary records with size and mtime" << std::endl
+		<< "  --newer - Only hash files modified after timestamp in "
+		"seconds since epoch or YYYY-MM-DD[ HH:MM[:SS]]" << std::endl
+		<< "  --newer_than - Only hash files modified after given file"
+		<< std::endl
+		<< "  --shard - Only hash entries in shard i/N of parent "
+		"directories" << std::endl
+		<< "  --emit_partial - Write partial output of path to merge "
+		"later, implies --sort" << std::endl
+		<< "  --merge_partials - Print output of all shards merged from "
+		"partial outputs" << std::endl
+		<< "  --sync_server - Serve per directory message digests of path "
+		"on stdin and stdout" << std::endl
+		<< "  --sync_client - Print files added, removed or modified "
+		"between path and --sync_server run by command" << std::endl
+		<< "  --serve - Answer hash requests on Unix domain socket "
+		"with digests cached in memory" << std::endl
+		<< "  --serve_client - Hash paths by --serve process listening "
+		"on Unix domain socket" << std::endl
+		<< "  --watch - Keep printing changed message digests of path "
+		"using inotify" << std::endl
 		<< "  --verbose - Enable verbose print" << std::endl
 		<< "  --debug - Enable debug mode" << std::endl
 		<< "  -v, --version - Print version and exit" << std::endl
 		<< "  -h, --help - Print usage and exit" << std::endl;
 }
 
+std::int64_t get_newer_than(const std::string& f) {
+	struct stat st;
+	if (stat(f.c_str(), &st) == -1)
+		throw std::runtime_error(f + ": " + strerror(errno));
+	return get_mtime_ns(st);
+}
+
 int handle_long_option(const std::string& name, const std::string& arg) {
 	if (name == "hash_algo")
-		opt::hash_algo = arg;
+		opt.hash_algo = arg;
 	else if (name == "hash_verify")
-		opt::hash_verify = arg;
+		opt.hash_verify = arg;
+	else if (name == "hash_verify_from")
+		opt.hash_verify_from = arg;
+	else if (name == "first")
+		opt.first = true;
 	else if (name == "hash_only")
-		opt::hash_only = true;
+		opt.hash_only = true;
 	else if (name == "ignore_dot")
-		opt::ignore_dot = true;
+		opt.ignore_dot = true;
 	else if (name == "ignore_dot_dir")
-		opt::ignore_dot_dir = true;
+		opt.ignore_dot_dir = true;
 	else if (name == "ignore_dot_file")
-		opt::ignore_dot_file = true;
+		opt.ignore_dot_file = true;
 	else if (name == "ignore_symlink")
-		opt::ignore_symlink = true;
+		opt.ignore_symlink = true;
 	else if (name == "follow_symlink")
-		opt::follow_symlink = true;
+		opt.follow_symlink = true;
 	else if (name == "abs")
-		opt::abs = true;
+		opt.abs = true;
 	else if (name == "swap")
-		opt::swap = true;
+		opt.swap = true;
 	else if (name == "sort")
-		opt::sort = true;
+		opt.sort = true;
 	else if (name == "squash")
-		opt::squash = true;
+		opt.squash = true;
+	else if (name == "squash_buffer_limit")
+		opt.squash_buffer_limit = std::stoul(arg);
+	else if (name == "dir_digests")
+		opt.dir_digests = true;
+	else if (name == "dir_digests_depth")
+		opt.dir_digests_depth = std::stol(arg);
+	else if (name == "cache")
+		opt.cache = arg;
+	else if (name == "cache_strict")
+		opt.cache_strict = std::stoul(arg);
+	else if (name == "xattr_cache")
+		opt.xattr_cache = true;
+	else if (name == "checkpoint") {
+		// resumed run must walk in the same order
+		opt.checkpoint = arg;
+		opt.sort = true;
+	}
+	else if (name == "check")
+		opt.check = arg;
+	else if (name == "fail_fast")
+		opt.fail_fast = true;
+	else if (name == "jobs")
+		opt.jobs = std::stoul(arg);
+	else if (name == "manifest")
+		opt.manifest = arg;
+	else if (name == "manifest_to_text")
+		opt.manifest_to_text = arg;
+	else if (name == "manifest_from_text")
+		opt.manifest_from_text = arg;
+	else if (name == "diff")
+		opt.diff = true;
+	else if (name == "find_dups")
+		opt.find_dups = true;
+	else if (name == "quick")
+		opt.quick = true;
+	else if (name == "quick_blocks")
+		opt.quick_blocks = std::stoul(arg);
+	else if (name == "metadata_only")
+		opt.metadata_only = opt.squash = true;
+	else if (name == "cdc")
+		opt.cdc = true;
+	else if (name == "cdc_size")
+		opt.cdc_size = std::stoul(arg);
+	else if (name == "tar")
+		opt.tar = true;
+	else if (name == "files_from")
+		opt.files_from = arg;
+	else if (name == "output_format")
+		opt.output_format = arg;
+	else if (name == "newer")
+		opt.newer = get_timestamp_ns(arg);
+	else if (name == "newer_than")
+		opt.newer = get_newer_than(arg);
+	else if (name == "shard")
+		std::tie(opt.shard_index, opt.shard_count) = get_shard(arg);
+	else if (name == "emit_partial") {
+		// partial outputs are merged in walk order
+		opt.emit_partial = arg;
+		opt.sort = true;
+	} else if (name == "merge_partials")
+		opt.merge_partials = true;
+	else if (name == "sync_server")
+		opt.sync_server = true;
+	else if (name == "sync_client")
+		opt.sync_client = arg;
+	else if (name == "serve")
+		opt.serve = arg;
+	else if (name == "serve_client")
+		opt.serve_client = arg;
+	else if (name == "watch")
+		opt.watch = true;
 	else if (name == "verbose")
-		opt::verbose = true;
+		opt.verbose = true;
 	else if (name == "debug")
-		opt::debug = true;
+		opt.debug = true;
 	else
 		return -1;
 	return 0;
@@ -137,6 +321,8 @@ int main(int argc, char** argv) {
 	option lo[] = {
 		{ "hash_algo", 1, nullptr, 0 },
 		{ "hash_verify", 1, nullptr, 0 },
+		{ "hash_verify_from", 1, nullptr, 0 },
+		{ "first", 0, nullptr, 0 },
 		{ "hash_only", 0, nullptr, 0 },
 		{ "ignore_dot", 0, nullptr, 0 },
 		{ "ignore_dot_dir", 0, nullptr, 0 },
@@ -147,6 +333,40 @@ int main(int argc, char** argv) {
 		{ "swap", 0, nullptr, 0 },
 		{ "sort", 0, nullptr, 0 },
 		{ "squash", 0, nullptr, 0 },
+		{ "squash_buffer_limit", 1, nullptr, 0 },
+		{ "dir_digests", 0, nullptr, 0 },
+		{ "dir_digests_depth", 1, nullptr, 0 },
+		{ "cache", 1, nullptr, 0 },
+		{ "cache_strict", 1, nullptr, 0 },
+		{ "xattr_cache", 0, nullptr, 0 },
+		{ "checkpoint", 1, nullptr, 0 },
+		{ "check", 1, nullptr, 0 },
+		{ "fail_fast", 0, nullptr, 0 },
+		{ "jobs", 1, nullptr, 0 },
+		{ "manifest", 1, nullptr, 0 },
+		{ "manifest_to_text", 1, nullptr, 0 },
+		{ "manifest_from_text", 1, nullptr, 0 },
+		{ "diff", 0, nullptr, 0 },
+		{ "find_dups", 0, nullptr, 0 },
+		{ "quick", 0, nullptr, 0 },
+		{ "quick_blocks", 1, nullptr, 0 },
+		{ "metadata_only", 0, nullptr, 0 },
+		{ "cdc", 0, nullptr, 0 },
+		{ "cdc_size", 1, nullptr, 0 },
+		{ "tar", 0, nullptr, 0 },
+		{ "files_from", 1, nullptr, 0 },
+		{ "null", 0, nullptr, '0' },
+		{ "output_format", 1, nullptr, 0 },
+		{ "newer", 1, nullptr, 0 },
+		{ "newer_than", 1, nullptr, 0 },
+		{ "shard", 1, nullptr, 0 },
+		{ "emit_partial", 1, nullptr, 0 },
+		{ "merge_partials", 0, nullptr, 0 },
+		{ "sync_server", 0, nullptr, 0 },
+		{ "sync_client", 1, nullptr, 0 },
+		{ "serve", 1, nullptr, 0 },
+		{ "serve_client", 1, nullptr, 0 },
+		{ "watch", 0, nullptr, 0 },
 		{ "verbose", 0, nullptr, 0 },
 		{ "debug", 0, nullptr, 0 },
 		{ "version", 0, nullptr, 'v' },
@@ -154,7 +374,7 @@ int main(int argc, char** argv) {
 		{ nullptr, 0, nullptr, 0 },
 	};
 
-	while ((c = getopt_long(argc, argv, "vhxX", lo, &i)) != -1) {
+	while ((c = getopt_long(argc, argv, "0vhxX", lo, &i)) != -1) {
 		switch (c) {
 		case 0:
 			try {
@@ -170,6 +390,9 @@ int main(int argc, char** argv) {
 				exit(1);
 			}
 			break;
+		case '0':
+			opt.null = true;
+			break;
 		case 'v':
 			print_version();
 			exit(1);
@@ -187,39 +410,182 @@ int main(int argc, char** argv) {
 	argv += optind;
 	argc -= optind;
 
-	if (argc == 0) {
+	if (!opt.manifest_to_text.empty()) {
+		auto ret = print_manifest_text(opt.manifest_to_text);
+		if (ret < 0) {
+			std::cout << opt.manifest_to_text << ": "
+				<< strerror(-ret) << std::endl;
+			exit(1);
+		}
+		return 0;
+	}
+
+	if (argc == 0 && opt.check.empty() &&
+		opt.manifest_from_text.empty() && opt.serve.empty() &&
+		opt.files_from.empty()) {
+		usage(progname);
+		exit(1);
+	} else if (argc > 1 && !opt.check.empty()) {
+		usage(progname);
+		exit(1);
+	} else if (opt.diff && (argc != 2 || opt.abs)) {
+		usage(progname);
+		exit(1);
+	} else if (opt.first && opt.hash_verify.empty() &&
+		opt.hash_verify_from.empty()) {
+		usage(progname);
+		exit(1);
+	} else if (opt.quick && (opt.squash || opt.dir_digests ||
+		!opt.manifest.empty())) {
+		// sampled digests must not pass as whole file digests
+		usage(progname);
+		exit(1);
+	} else if (opt.metadata_only && (opt.quick || opt.dir_digests)) {
+		usage(progname);
+		exit(1);
+	} else if (opt.cdc && (!is_valid_cdc_size(opt.cdc_size) ||
+		opt.squash || opt.dir_digests || opt.quick ||
+		opt.metadata_only || !opt.manifest.empty() ||
+		!opt.checkpoint.empty() || !opt.check.empty() || opt.diff ||
+		opt.find_dups || opt.watch || !opt.emit_partial.empty() ||
+		opt.merge_partials || opt.sync_server ||
+		!opt.sync_client.empty())) {
+		// chunk digests are printed per file and counted per run
+		usage(progname);
+		exit(1);
+	} else if (opt.tar && (opt.follow_symlink || opt.quick ||
+		opt.metadata_only || opt.cdc || !opt.manifest.empty() ||
+		!opt.checkpoint.empty() || !opt.check.empty() || opt.diff ||
+		opt.find_dups || opt.watch || opt.shard_count ||
+		!opt.emit_partial.empty() || opt.merge_partials ||
+		opt.sync_server || !opt.sync_client.empty())) {
+		// members only exist while the archive is read
+		usage(progname);
+		exit(1);
+	} else if (opt.watch && (argc != 1 || opt.follow_symlink ||
+		opt.quick || opt.metadata_only || opt.newer >= 0 ||
+		!opt.manifest.empty())) {
+		// targets of followed symlinks may be outside watched tree
+		usage(progname);
+		exit(1);
+	} else if (!opt.checkpoint.empty() && (!opt.check.empty() ||
+		opt.diff || opt.find_dups || opt.watch)) {
+		usage(progname);
+		exit(1);
+	} else if ((opt.shard_count || !opt.emit_partial.empty() ||
+		opt.merge_partials) && (!opt.check.empty() || opt.diff ||
+		opt.find_dups || opt.watch)) {
+		usage(progname);
+		exit(1);
+	} else if ((!opt.emit_partial.empty() || opt.merge_partials) &&
+		(opt.verbose || !opt.hash_verify.empty() ||
+		!opt.hash_verify_from.empty() || !opt.manifest.empty())) {
+		// per input stats and early exit don't merge
+		usage(progname);
+		exit(1);
+	} else if (!opt.emit_partial.empty() && argc != 1) {
+		usage(progname);
+		exit(1);
+	} else if (opt.merge_partials && (opt.shard_count ||
+		!opt.emit_partial.empty() || !opt.checkpoint.empty())) {
+		usage(progname);
+		exit(1);
+	} else if ((opt.sync_server || !opt.sync_client.empty()) &&
+		(argc != 1 || opt.abs || (opt.sync_server &&
+		!opt.sync_client.empty()) || !opt.check.empty() ||
+		opt.diff || opt.find_dups || opt.watch || opt.shard_count ||
+		!opt.emit_partial.empty() || opt.merge_partials)) {
+		usage(progname);
+		exit(1);
+	} else if (opt.sync_server && opt.verbose) {
+		// stdout is for sync client only
+		usage(progname);
+		exit(1);
+	} else if (!opt.serve.empty() && (argc != 0 ||
+		!opt.serve_client.empty())) {
+		// options other than --jobs and --cache are per request
+		usage(progname);
+		exit(1);
+	} else if (!opt.files_from.empty() && (argc > 1 || opt.tar ||
+		!opt.check.empty() || opt.diff || opt.find_dups || opt.watch ||
+		!opt.emit_partial.empty() || opt.merge_partials ||
+		opt.sync_server || !opt.sync_client.empty() ||
+		!opt.serve.empty() || !opt.serve_client.empty())) {
+		// single base directory instead of paths to walk
+		usage(progname);
+		exit(1);
+	} else if (opt.null && opt.files_from.empty()) {
+		usage(progname);
+		exit(1);
+	} else if (!is_valid_output_format(opt.output_format) ||
+		(is_record_output() && (opt.hash_only || opt.cdc ||
+		opt.cache_strict || !opt.check.empty() || opt.diff ||
+		opt.find_dups || opt.watch || !opt.emit_partial.empty() ||
+		opt.merge_partials || opt.sync_server ||
+		!opt.sync_client.empty() || !opt.serve.empty() ||
+		!opt.serve_client.empty() || opt.verbose || opt.debug))) {
+		// records only, nothing else printed in between
+		usage(progname);
+		exit(1);
+	} else if (!opt.serve_client.empty() &&
+		(test_library_option(opt) < 0 || opt.follow_symlink)) {
+		// link -> target format isn't passed to library caller
 		usage(progname);
 		exit(1);
 	}
 
-	if (opt::hash_algo.empty()) {
+	if (opt.hash_algo.empty()) {
 		std::cout << "No hash algorithm specified" << std::endl;
 		exit(1);
 	}
 
-	if (opt::verbose)
-		std::cout << opt::hash_algo << std::endl;
+	if (opt.jobs == 0)
+		opt.jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+	if (opt.verbose)
+		std::cout << opt.hash_algo << std::endl;
 
 	hash_init();
-	if (!new_hash(opt::hash_algo)) {
+	if (!new_hash(opt.hash_algo)) {
 		auto a = get_available_hash_algo();
 		std::ostringstream ss;
 		std::copy(a.begin(), a.end()-1,
 			std::ostream_iterator<std::string>(ss, " "));
-		std::cout << "Unsupported hash algorithm " << opt::hash_algo
+		std::cout << "Unsupported hash algorithm " << opt.hash_algo
 			<< std::endl << "Available hash algorithm [" << ss.str()
 			<< a.back() << "]" << std::endl;
 		exit(1);
 	}
 
-	if (!opt::hash_verify.empty()) {
-		auto [s, valid] = is_valid_hexsum(opt::hash_verify);
+	if (!opt.hash_verify.empty()) {
+		auto [s, valid] = is_valid_hexsum(opt.hash_verify);
 		if (!valid) {
 			std::cout << "Invalid verify string "
-				<< opt::hash_verify << std::endl;
+				<< opt.hash_verify << std::endl;
+			exit(1);
+		}
+		opt.hash_verify = s;
+	}
+
+	auto ret = verify_init();
+	if (ret < 0) {
+		std::cout << opt.hash_verify_from << ": " << strerror(-ret)
+			<< std::endl;
+		exit(1);
+	}
+
+	if (opt.xattr_cache && !is_xattr_supported()) {
+		std::cout << "Extended attribute unsupported" << std::endl;
+		exit(1);
+	}
+
+	if (!opt.cache.empty()) {
+		auto ret = cache_init(opt.cache);
+		if (ret < 0) {
+			std::cout << opt.cache << ": " << strerror(-ret)
+				<< std::endl;
 			exit(1);
 		}
-		opt::hash_verify = s;
 	}
 
 	if (is_windows()) {
@@ -233,15 +599,224 @@ int main(int argc, char** argv) {
 		exit(1);
 	}
 
-	for (auto i = 0; i < argc; i++) {
-		auto ret = print_input(argv[i]);
+	if (!opt.manifest_from_text.empty()) {
+		if (opt.manifest.empty()) {
+			usage(progname);
+			exit(1);
+		}
+		auto ret = write_manifest_text(opt.manifest_from_text,
+			opt.manifest);
+		if (ret < 0) {
+			std::cout << opt.manifest_from_text << ": "
+				<< strerror(-ret) << std::endl;
+			exit(1);
+		}
+		hash_cleanup();
+		return 0;
+	}
+
+	if (!opt.check.empty()) {
+		auto ret = check_manifest(opt.check, argc ? argv[0] : ".");
+		if (ret < 0) {
+			std::cout << opt.check << ": " << strerror(-ret)
+				<< std::endl;
+			exit(1);
+		}
+		cache_cleanup();
+		hash_cleanup();
+		return ret ? 1 : 0;
+	}
+
+	if (opt.diff) {
+		auto ret = diff_input(argv[0], argv[1]);
 		if (ret < 0) {
 			std::cout << strerror(-ret) << std::endl;
 			exit(1);
 		}
-		if (opt::verbose && i != argc - 1)
-			std::cout << std::endl;
+		cache_cleanup();
+		hash_cleanup();
+		return ret ? 1 : 0;
+	}
+
+	if (opt.find_dups) {
+		auto ret = find_dups(std::vector<std::string>(argv,
+			argv + argc));
+		if (ret < 0) {
+			std::cout << strerror(-ret) << std::endl;
+			exit(1);
+		}
+		cache_cleanup();
+		hash_cleanup();
+		return 0;
+	}
+
+	if (opt.merge_partials) {
+		auto ret = merge_partial_input(std::vector<std::string>(argv,
+			argv + argc));
+		if (ret < 0) {
+			std::cout << strerror(-ret) << std::endl;
+			exit(1);
+		}
+		hash_cleanup();
+		return 0;
+	}
+
+	if (opt.sync_server) {
+		// nothing to print, stdout belongs to sync client
+		auto ret = sync_server(argv[0]);
+		if (ret < 0)
+			exit(1);
+		cache_cleanup();
+		hash_cleanup();
+		return 0;
+	}
+
+	if (!opt.sync_client.empty()) {
+		auto ret = sync_client(opt.sync_client, argv[0]);
+		if (ret < 0) {
+			std::cout << strerror(-ret) << std::endl;
+			exit(1);
+		}
+		cache_cleanup();
+		hash_cleanup();
+		return ret ? 1 : 0;
+	}
+
+	if (!opt.serve.empty()) {
+		auto ret = serve(opt.serve);
+		std::cout << opt.serve << ": " << strerror(-ret) << std::endl;
+		exit(1);
+	}
+
+	if (!opt.serve_client.empty()) {
+		auto ret = serve_client(opt.serve_client,
+			std::vector<std::string>(argv, argv + argc));
+		if (ret < 0)
+			exit(1);
+		hash_cleanup();
+		return 0;
+	}
+
+	if (opt.watch) {
+		auto ret = watch_input(argv[0]);
+		std::cout << argv[0] << ": " << strerror(-ret) << std::endl;
+		exit(1);
+	}
+
+	if (!opt.checkpoint.empty()) {
+		auto ret = checkpoint_init(opt.checkpoint);
+		if (ret < 0) {
+			std::cout << opt.checkpoint << ": " << strerror(-ret)
+				<< std::endl;
+			exit(1);
+		}
+	}
+
+	if (!opt.emit_partial.empty()) {
+		auto ret = partial_init(opt.emit_partial);
+		if (ret < 0) {
+			std::cout << opt.emit_partial << ": " << strerror(-ret)
+				<< std::endl;
+			exit(1);
+		}
+	}
+
+	if (!opt.manifest.empty()) {
+		// paths are stored relative to their input, hence ambiguous
+		// across inputs, while repeating the same input is fine
+		std::set<std::string> inputs;
+		for (auto i = 0; i < argc; i++)
+			inputs.insert(canonicalize_path(get_abspath(argv[i])));
+		if (inputs.size() > 1) {
+			std::cout << opt.manifest << ": Multiple inputs"
+				<< std::endl;
+			exit(1);
+		}
+		auto ret = manifest_init(opt.manifest);
+		if (ret < 0) {
+			std::cout << opt.manifest << ": " << strerror(-ret)
+				<< std::endl;
+			exit(1);
+		}
+	}
+
+	// resumed runs rely on printed lines being written
+	if (opt.checkpoint.empty())
+		output_init();
+	print_output_header();
+
+	try {
+		if (!opt.files_from.empty()) {
+			auto delim = opt.null ? '\0' : '\n';
+			std::string base = argc ? argv[0] : ".";
+			int ret;
+			if (opt.files_from == "-") {
+				ret = print_input_list(base, std::cin, delim);
+			} else {
+				std::ifstream ifs(opt.files_from);
+				if (!ifs) {
+					std::cout << opt.files_from << ": "
+						<< strerror(errno) << std::endl;
+					exit(1);
+				}
+				ret = print_input_list(base, ifs, delim);
+			}
+			if (ret < 0) {
+				std::cout << base << ": " << strerror(-ret)
+					<< std::endl;
+				checkpoint_cleanup(false);
+				exit(1);
+			}
+		}
+
+		if (opt.files_from.empty()) {
+			auto ret = print_inputs(std::vector<std::string>(argv,
+				argv + argc));
+			if (ret < 0) {
+				std::cout << strerror(-ret) << std::endl;
+				checkpoint_cleanup(false);
+				exit(1);
+			}
+		}
+	} catch (...) {
+		// write what was printed before terminating
+		output_cleanup();
+		throw;
+	}
+
+	// nowhere to print error if stdout failed
+	ret = output_cleanup();
+	if (ret < 0)
+		exit(1);
+
+	ret = manifest_cleanup();
+	if (ret < 0) {
+		std::cout << opt.manifest << ": " << strerror(-ret)
+			<< std::endl;
+		exit(1);
+	}
+
+	ret = cache_cleanup();
+	if (ret < 0) {
+		std::cout << opt.cache << ": " << strerror(-ret) << std::endl;
+		exit(1);
+	}
+
+	ret = partial_cleanup();
+	if (ret < 0) {
+		std::cout << opt.emit_partial << ": " << strerror(-ret)
+			<< std::endl;
+		exit(1);
+	}
+
+	// completed, nothing left to resume
+	ret = checkpoint_cleanup(true);
+	if (ret < 0) {
+		std::cout << opt.checkpoint << ": " << strerror(-ret)
+			<< std::endl;
+		exit(1);
 	}
+	verify_cleanup();
 	hash_cleanup();
 
 	return 0;
@@ -0,0 +1,705 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <queue>
+#include <tuple>
+#include <unordered_set>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "./check.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./manifest.h"
+#include "./util.h"
+
+namespace {
+const std::string MANIFEST_MAGIC("DHMANIF1");
+const std::uint32_t MANIFEST_VERSION = 1;
+const std::size_t MANIFEST_HEADER_SIZE = 64;
+const std::size_t MANIFEST_HASH_ALGO_SIZE = 16;
+const std::uint64_t MANIFEST_BLOCK = 16; // paths per front coding block
+const std::size_t MANIFEST_SPILL_LIMIT = 65536; // entries per sorted run
+const std::size_t MANIFEST_FAN_IN = 16; // runs per merge, bounds open files
+
+ManifestWriter* _writer;
+std::string _writer_path;
+std::unordered_set<std::string> _writer_input;
+bool _writer_skip;
+
+std::size_t get_record_size(std::uint32_t digest_size) {
+	return 1 + 8 + 8 + digest_size; // type, size, mtime_ns, digest
+}
+
+void put_varint(std::vector<char>& v, std::uint64_t x) {
+	while (x >= 0x80) {
+		v.push_back(static_cast<char>(x | 0x80));
+		x >>= 7;
+	}
+	v.push_back(static_cast<char>(x));
+}
+
+std::uint64_t get_varint(const char*& p, const char* end) {
+	std::uint64_t x = 0;
+	for (auto shift = 0; shift < 64; shift += 7) {
+		if (p >= end)
+			break;
+		auto c = static_cast<unsigned char>(*p++);
+		x |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return x;
+	}
+	throw std::runtime_error("Corrupted manifest string table");
+}
+
+void write_file(std::FILE* fp, const std::vector<char>& v) {
+	if (std::fwrite(v.data(), 1, v.size(), fp) != v.size())
+		throw std::runtime_error(std::string("fwrite: ") +
+			strerror(errno));
+}
+
+bool read_file(std::FILE* fp, char* p, std::size_t n) {
+	if (std::fread(p, 1, n, fp) == n)
+		return true;
+	if (std::ferror(fp))
+		throw std::runtime_error(std::string("fread: ") +
+			strerror(errno));
+	return false;
+}
+
+// entry in sorted run, unlike manifest records digest size may vary
+void put_run_entry(std::FILE* fp, const ManifestEntry& e) {
+	std::vector<char> v;
+	put_le32(v, static_cast<std::uint32_t>(e.path.size()));
+	v.insert(v.end(), e.path.begin(), e.path.end());
+	v.push_back(static_cast<char>(e.type));
+	put_le64(v, e.size);
+	put_le64(v, static_cast<std::uint64_t>(e.mtime_ns));
+	put_le32(v, static_cast<std::uint32_t>(e.digest.size()));
+	v.insert(v.end(), e.digest.begin(), e.digest.end());
+	write_file(fp, v);
+}
+
+bool get_run_entry(std::FILE* fp, ManifestEntry& e) {
+	char b[17];
+	if (!read_file(fp, b, 4))
+		return false;
+	e.path.resize(get_le32(b));
+	if (!read_file(fp, e.path.data(), e.path.size()) ||
+		!read_file(fp, b, 17))
+		throw std::runtime_error("Truncated manifest run");
+	e.type = static_cast<FileType>(b[0]);
+	e.size = get_le64(b + 1);
+	e.mtime_ns = static_cast<std::int64_t>(get_le64(b + 9));
+	if (!read_file(fp, b, 4))
+		throw std::runtime_error("Truncated manifest run");
+	e.digest.resize(get_le32(b));
+	if (!read_file(fp, e.digest.data(), e.digest.size()))
+		throw std::runtime_error("Truncated manifest run");
+	return true;
+}
+
+// decode next front coded path in place
+void get_next_path(const char*& p, const char* end, std::string& s) {
+	auto shared = get_varint(p, end);
+	auto n = get_varint(p, end);
+	if (shared > s.size() || n > static_cast<std::uint64_t>(end - p))
+		throw std::runtime_error("Corrupted manifest string table");
+	s.resize(shared);
+	s.append(p, n);
+	p += n;
+}
+} // namespace
+
+ManifestWriter::ManifestWriter(void):
+	ManifestWriter(MANIFEST_SPILL_LIMIT) {
+}
+
+ManifestWriter::ManifestWriter(std::size_t limit):
+	_entry{},
+	_run{},
+	_level{},
+	_num_run(0),
+	_limit(limit) {
+}
+
+ManifestWriter::~ManifestWriter(void) {
+	for (auto* fp : _run)
+		std::fclose(fp);
+}
+
+void ManifestWriter::add_entry(const ManifestEntry& e) {
+	_entry.push_back(e);
+	if (_limit && _entry.size() >= _limit)
+		spill_entry();
+}
+
+void ManifestWriter::spill_entry(void) {
+	std::stable_sort(_entry.begin(), _entry.end(),
+		[](const ManifestEntry& a, const ManifestEntry& b) {
+		return a.path < b.path;
+	});
+	auto* fp = new_tmpfile();
+	_run.push_back(fp);
+	_level.push_back(0);
+	for (const auto& e : _entry)
+		put_run_entry(fp, e);
+	_num_run += _entry.size();
+	_entry.clear();
+
+	// merge in rounds of MANIFEST_FAN_IN runs of the same level, same as
+	// squash1 spilled runs
+	while (_run.size() >= MANIFEST_FAN_IN) {
+		auto first = _run.size() - MANIFEST_FAN_IN;
+		if (_level[first] != _level.back())
+			break;
+		auto level = _level.back() + 1;
+		reduce_run(first);
+		_level.back() = level;
+	}
+}
+
+// pass entries of runs from first, and buffered entries if mem (moved out),
+// to fn in path order, earlier entries first if same path
+void ManifestWriter::merge_run(std::size_t first, bool mem,
+	const entry_fn& fn) {
+	if (mem)
+		std::stable_sort(_entry.begin(), _entry.end(),
+			[](const ManifestEntry& a, const ManifestEntry& b) {
+			return a.path < b.path;
+		});
+	auto n = _run.size() - first;
+	for (auto i = first; i < _run.size(); i++)
+		if (std::fflush(_run[i]) || std::fseek(_run[i], 0, SEEK_SET))
+			throw std::runtime_error(std::string("fseek: ") +
+				strerror(errno));
+
+	// head of each run, and of buffered entries at n
+	std::vector<ManifestEntry> head(n + 1);
+	std::size_t pos = 0;
+	auto fill = [&](std::size_t i) {
+		if (i < n)
+			return get_run_entry(_run[first + i], head[i]);
+		if (!mem || pos == _entry.size())
+			return false;
+		head[i] = std::move(_entry[pos++]);
+		return true;
+	};
+	auto cmp = [&](std::size_t a, std::size_t b) {
+		return std::tie(head[b].path, b) < std::tie(head[a].path, a);
+	};
+	std::priority_queue<std::size_t, std::vector<std::size_t>,
+		decltype(cmp)> heap(cmp);
+	for (std::size_t i = 0; i <= n; i++)
+		if (fill(i))
+			heap.push(i);
+	while (!heap.empty()) {
+		auto i = heap.top();
+		heap.pop();
+		fn(head[i]);
+		if (fill(i))
+			heap.push(i);
+	}
+	if (mem)
+		_entry.clear();
+}
+
+// replace runs from first by a single merged run
+void ManifestWriter::reduce_run(std::size_t first) {
+	assert(first < _run.size());
+	auto* fp = new_tmpfile();
+	try {
+		merge_run(first, false, [&](const ManifestEntry& e) {
+			put_run_entry(fp, e);
+		});
+	} catch (...) {
+		std::fclose(fp);
+		throw;
+	}
+	for (auto i = first; i < _run.size(); i++)
+		std::fclose(_run[i]);
+	_run.resize(first);
+	_level.resize(first);
+	_run.push_back(fp);
+	_level.push_back(0);
+}
+
+// records are written as runs are merged, string table goes through
+// a temporary file as it follows the block index
+int ManifestWriter::write_manifest(const std::string& f,
+	const std::string& hash_algo) {
+	// final merge reads at most MANIFEST_FAN_IN runs at once
+	while (_run.size() > MANIFEST_FAN_IN)
+		reduce_run(_run.size() - MANIFEST_FAN_IN);
+
+	std::ofstream ofs(f, std::ofstream::binary | std::ofstream::trunc);
+	if (!ofs)
+		return errno ? -errno : -EIO;
+	std::vector<char> hdr(MANIFEST_HEADER_SIZE, '\0');
+	ofs.write(hdr.data(), static_cast<std::streamsize>(hdr.size()));
+
+	std::uint64_t num_entry = 0, str_size = 0;
+	std::uint32_t digest_size = 0;
+	auto valid = true;
+	std::string prev;
+	std::vector<char> rec, index, str;
+	auto* fp = new_tmpfile();
+	try {
+		merge_run(0, true, [&](const ManifestEntry& e) {
+			if (num_entry == 0)
+				digest_size = static_cast<std::uint32_t>(
+					e.digest.size());
+			else if (e.digest.size() != digest_size)
+				valid = false;
+			rec.clear();
+			rec.push_back(static_cast<char>(e.type));
+			put_le64(rec, e.size);
+			put_le64(rec, static_cast<std::uint64_t>(e.mtime_ns));
+			rec.insert(rec.end(), e.digest.begin(), e.digest.end());
+			ofs.write(rec.data(),
+				static_cast<std::streamsize>(rec.size()));
+
+			std::size_t shared = 0;
+			if (num_entry % MANIFEST_BLOCK == 0) {
+				put_le64(index, str_size);
+			} else {
+				while (shared < prev.size() &&
+					shared < e.path.size() &&
+					prev[shared] == e.path[shared])
+					shared++;
+			}
+			str.clear();
+			put_varint(str, shared);
+			put_varint(str, e.path.size() - shared);
+			str.insert(str.end(), e.path.begin() + shared,
+				e.path.end());
+			write_file(fp, str);
+			str_size += str.size();
+			prev = e.path;
+			num_entry++;
+		});
+		for (auto* x : _run)
+			std::fclose(x);
+		_run.clear();
+		_level.clear();
+		_num_run = 0;
+
+		ofs.write(index.data(), static_cast<std::streamsize>(
+			index.size()));
+		if (std::fflush(fp) || std::fseek(fp, 0, SEEK_SET))
+			throw std::runtime_error(std::string("fseek: ") +
+				strerror(errno));
+		std::vector<char> buf(65536);
+		std::size_t n;
+		while ((n = std::fread(buf.data(), 1, buf.size(), fp)) > 0)
+			ofs.write(buf.data(), static_cast<std::streamsize>(n));
+		if (std::ferror(fp))
+			throw std::runtime_error(std::string("fread: ") +
+				strerror(errno));
+	} catch (...) {
+		std::fclose(fp);
+		throw;
+	}
+	std::fclose(fp);
+	if (!valid) {
+		ofs.close();
+		std::ofstream(f, std::ofstream::trunc);
+		return -EINVAL;
+	}
+
+	hdr.assign(MANIFEST_MAGIC.begin(), MANIFEST_MAGIC.end());
+	put_le32(hdr, MANIFEST_VERSION);
+	put_le32(hdr, digest_size);
+	put_le64(hdr, num_entry);
+	put_le64(hdr, (num_entry + MANIFEST_BLOCK - 1) / MANIFEST_BLOCK);
+	put_le64(hdr, str_size);
+	auto s = hash_algo.substr(0, MANIFEST_HASH_ALGO_SIZE);
+	hdr.insert(hdr.end(), s.begin(), s.end());
+	hdr.resize(MANIFEST_HEADER_SIZE, '\0');
+	ofs.seekp(0);
+	ofs.write(hdr.data(), static_cast<std::streamsize>(hdr.size()));
+	ofs.close();
+	if (!ofs)
+		return -EIO;
+	return 0;
+}
+
+Manifest::Manifest(void):
+	_map(nullptr),
+	_map_size(0),
+	_num_entry(0),
+	_num_block(0),
+	_digest_size(0),
+	_hash_algo{},
+	_record(nullptr),
+	_index(nullptr),
+	_string(nullptr),
+	_string_size(0) {
+}
+
+Manifest::~Manifest(void) {
+	close_manifest();
+}
+
+int Manifest::open_manifest(const std::string& f) {
+	assert(!_map);
+	auto fd = open(f.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		auto error = errno;
+		close(fd);
+		return -error;
+	}
+	auto siz = static_cast<std::size_t>(st.st_size);
+	if (siz < MANIFEST_HEADER_SIZE) {
+		close(fd);
+		return -EINVAL;
+	}
+	auto* p = mmap(nullptr, siz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -errno;
+	_map = static_cast<const char*>(p);
+	_map_size = siz;
+
+	if (std::memcmp(_map, MANIFEST_MAGIC.data(), MANIFEST_MAGIC.size()) ||
+		get_le32(_map + 8) != MANIFEST_VERSION) {
+		close_manifest();
+		return -EINVAL;
+	}
+	_digest_size = get_le32(_map + 12);
+	_num_entry = get_le64(_map + 16);
+	_num_block = get_le64(_map + 24);
+	_string_size = get_le64(_map + 32);
+	_hash_algo = std::string(_map + 40, MANIFEST_HASH_ALGO_SIZE);
+	_hash_algo.resize(std::strlen(_hash_algo.c_str()));
+
+	// sections must exactly fill the file
+	auto record_size = get_record_size(_digest_size);
+	if (_num_entry > siz / record_size ||
+		_num_block != (_num_entry + MANIFEST_BLOCK - 1) /
+		MANIFEST_BLOCK ||
+		MANIFEST_HEADER_SIZE + _num_entry * record_size +
+		_num_block * 8 + _string_size != siz) {
+		close_manifest();
+		return -EINVAL;
+	}
+	_record = _map + MANIFEST_HEADER_SIZE;
+	_index = _record + _num_entry * record_size;
+	_string = _index + _num_block * 8;
+	return 0;
+}
+
+void Manifest::close_manifest(void) {
+	if (_map)
+		munmap(const_cast<char*>(_map), _map_size);
+	_map = nullptr;
+	_map_size = 0;
+	_num_entry = 0;
+	_num_block = 0;
+}
+
+std::string Manifest::get_block_path(std::uint64_t b) const {
+	assert(b < _num_block);
+	auto off = get_le64(_index + b * 8);
+	if (off >= _string_size)
+		throw std::runtime_error("Corrupted manifest block index");
+	const auto* p = _string + off;
+	std::string s;
+	get_next_path(p, _string + _string_size, s);
+	return s;
+}
+
+void Manifest::get_record(std::uint64_t i, ManifestEntry& e) const {
+	assert(i < _num_entry);
+	const auto* p = _record + i * get_record_size(_digest_size);
+	e.type = static_cast<FileType>(p[0]);
+	e.size = get_le64(p + 1);
+	e.mtime_ns = static_cast<std::int64_t>(get_le64(p + 9));
+	e.digest.assign(p + 17, p + 17 + _digest_size);
+}
+
+ManifestEntry Manifest::get_entry(unsigned long i) const {
+	assert(i < _num_entry);
+	auto b = i / MANIFEST_BLOCK;
+	const auto* p = _string + get_le64(_index + b * 8);
+	ManifestEntry e;
+	for (auto j = b * MANIFEST_BLOCK; j <= i; j++)
+		get_next_path(p, _string + _string_size, e.path);
+	get_record(i, e);
+	return e;
+}
+
+// O(log n) binary search on block index, then scan within block
+bool Manifest::find_entry(const std::string& f, ManifestEntry& e) const {
+	if (_num_block == 0)
+		return false;
+	std::uint64_t lo = 0, hi = _num_block;
+	while (hi - lo > 1) {
+		auto mid = lo + (hi - lo) / 2;
+		if (get_block_path(mid) <= f)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	const auto* p = _string + get_le64(_index + lo * 8);
+	std::string s;
+	auto end = std::min((lo + 1) * MANIFEST_BLOCK, _num_entry);
+	for (auto i = lo * MANIFEST_BLOCK; i < end; i++) {
+		get_next_path(p, _string + _string_size, s);
+		if (s == f) {
+			e.path = s;
+			get_record(i, e);
+			return true;
+		} else if (s > f) {
+			break;
+		}
+	}
+	return false;
+}
+
+// all entries in path order
+void Manifest::read_entry(
+	const std::function<void(const ManifestEntry&)>& fn) const {
+	const auto* p = _string;
+	ManifestEntry e;
+	for (std::uint64_t i = 0; i < _num_entry; i++) {
+		if (i % MANIFEST_BLOCK == 0)
+			e.path.clear();
+		get_next_path(p, _string + _string_size, e.path);
+		get_record(i, e);
+		fn(e);
+	}
+}
+
+bool is_binary_manifest(const std::string& f) {
+	std::ifstream ifs(f, std::ifstream::binary);
+	std::string s(MANIFEST_MAGIC.size(), '\0');
+	return ifs.read(&s[0], static_cast<std::streamsize>(s.size())) &&
+		s == MANIFEST_MAGIC;
+}
+
+int manifest_init(const std::string& f) {
+	assert(!_writer);
+	// fail early if not writable
+	std::ofstream ofs(f, std::ofstream::binary | std::ofstream::trunc);
+	if (!ofs)
+		return errno ? -errno : -EIO;
+	_writer = new ManifestWriter();
+	_writer_path = f;
+	_writer_input.clear();
+	_writer_skip = false;
+	return 0;
+}
+
+int manifest_cleanup(void) {
+	if (!_writer)
+		return 0;
+	auto ret = _writer->write_manifest(_writer_path, opt.hash_algo);
+	delete _writer;
+	_writer = nullptr;
+	_writer_input.clear();
+	return ret;
+}
+
+// input f (absolute) given again is walked, but not recorded twice
+void set_manifest_input(const std::string& f) {
+	if (!_writer)
+		return;
+	_writer_skip = !_writer_input.insert(f).second;
+}
+
+// f is used to get size and mtime, realf is the path to record
+void add_manifest_entry(const std::string& f, const std::string& realf,
+	const std::vector<char>& b, const FileType& t) {
+	if (!_writer || _writer_skip)
+		return;
+	struct stat st;
+	auto ret = t == FileType::Symlink ? lstat(f.c_str(), &st) :
+		stat(f.c_str(), &st);
+	if (ret == -1)
+		std::memset(&st, 0, sizeof(st));
+	_writer->add_entry({realf, b, t, static_cast<std::uint64_t>(st.st_size),
+		get_mtime_ns(st)});
+}
+
+// binary manifest to text in per file output format
+int print_manifest_text(const std::string& f) {
+	Manifest m;
+	auto ret = m.open_manifest(f);
+	if (ret < 0)
+		return ret;
+	m.read_entry([](const ManifestEntry& e) {
+		auto hex_sum = get_hex_sum(e.digest);
+		if (opt.hash_only)
+			std::cout << hex_sum << std::endl;
+		else
+			std::cout << get_xsum_format_string(e.path, hex_sum,
+				opt.swap) << std::endl;
+	});
+	return 0;
+}
+
+// text manifest to binary, size and mtime are unknown
+int write_manifest_text(const std::string& f, const std::string& out) {
+	std::ifstream ifs(f);
+	if (!ifs.is_open())
+		return errno ? -errno : -ENOENT;
+	ManifestWriter w;
+	std::string line;
+	while (std::getline(ifs, line)) {
+		auto [path, h, valid] = parse_manifest_line(line, opt.swap);
+		if (!valid)
+			continue;
+		// no tree to tell followed symlinks from names with " -> "
+		w.add_entry({strip_link_target(path, ""), get_hex_byte(h),
+			FileType::Reg, 0, 0});
+	}
+	return w.write_manifest(out, opt.hash_algo);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+namespace {
+std::string get_test_manifest_path(void) {
+	auto d = std::filesystem::temp_directory_path();
+	return d / ("dirhash-cpp-manifest-test." + std::to_string(getpid()));
+}
+
+std::vector<ManifestEntry> get_test_entry(unsigned long n) {
+	std::vector<ManifestEntry> l;
+	for (unsigned long i = 0; i < n; i++) {
+		auto s = std::to_string(i);
+		auto [b, _ignore] = get_string_hash(s, hash::SHA256);
+		l.push_back({"dir/sub/" + s, b, FileType::Reg, i, -1});
+	}
+	std::sort(l.begin(), l.end(), [](const ManifestEntry& a,
+		const ManifestEntry& b) {
+		return a.path < b.path;
+	});
+	return l;
+}
+} // namespace
+
+void ManifestTest::test_write_manifest(void) {
+	auto f = get_test_manifest_path();
+	for (const auto n : {0lu, 1lu, 16lu, 17lu, 1000lu}) {
+		auto l = get_test_entry(n);
+		ManifestWriter w;
+		for (auto it = l.rbegin(); it != l.rend(); it++)
+			w.add_entry(*it);
+		CPPUNIT_ASSERT_EQUAL(w.write_manifest(f, hash::SHA256), 0);
+		CPPUNIT_ASSERT(is_binary_manifest(f));
+
+		Manifest m;
+		CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), 0);
+		CPPUNIT_ASSERT_EQUAL(m.num_entry(), n);
+		CPPUNIT_ASSERT_EQUAL(m.get_hash_algo(), hash::SHA256);
+		std::size_t i = 0;
+		m.read_entry([&](const ManifestEntry& e) {
+			CPPUNIT_ASSERT_EQUAL(e.path, l[i].path);
+			CPPUNIT_ASSERT(e.digest == l[i].digest);
+			CPPUNIT_ASSERT_EQUAL(e.size, l[i].size);
+			CPPUNIT_ASSERT_EQUAL(e.mtime_ns, l[i].mtime_ns);
+			CPPUNIT_ASSERT_EQUAL(e.type, l[i].type);
+			i++;
+		});
+		CPPUNIT_ASSERT_EQUAL(i, l.size());
+		for (i = 0; i < l.size(); i += 7)
+			CPPUNIT_ASSERT_EQUAL(m.get_entry(i).path, l[i].path);
+	}
+	std::filesystem::remove(f);
+}
+
+void ManifestTest::test_spill_entry(void) {
+	auto f = get_test_manifest_path();
+	auto l = get_test_entry(3000);
+	ManifestWriter w(7);
+	for (auto it = l.rbegin(); it != l.rend(); it++) {
+		w.add_entry(*it);
+		// about 400 runs merged in rounds
+		CPPUNIT_ASSERT(w.num_run() < 16 * 3);
+	}
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 3000lu);
+	CPPUNIT_ASSERT_EQUAL(w.write_manifest(f, hash::SHA256), 0);
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 0lu);
+
+	Manifest m;
+	CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), 0);
+	CPPUNIT_ASSERT_EQUAL(m.num_entry(), 3000lu);
+	std::size_t i = 0;
+	m.read_entry([&](const ManifestEntry& e) {
+		CPPUNIT_ASSERT_EQUAL(e.path, l[i].path);
+		CPPUNIT_ASSERT(e.digest == l[i].digest);
+		CPPUNIT_ASSERT_EQUAL(e.size, l[i].size);
+		i++;
+	});
+	CPPUNIT_ASSERT_EQUAL(i, l.size());
+
+	// digest size must be the same
+	ManifestWriter w2(2);
+	for (const auto& e : get_test_entry(5))
+		w2.add_entry(e);
+	w2.add_entry({"x", {'\0'}, FileType::Reg, 0, 0});
+	CPPUNIT_ASSERT_EQUAL(w2.write_manifest(f, hash::SHA256), -EINVAL);
+	std::filesystem::remove(f);
+}
+
+void ManifestTest::test_find_entry(void) {
+	auto f = get_test_manifest_path();
+	auto l = get_test_entry(1000);
+	ManifestWriter w;
+	for (const auto& e : l)
+		w.add_entry(e);
+	CPPUNIT_ASSERT_EQUAL(w.write_manifest(f, hash::SHA256), 0);
+
+	Manifest m;
+	CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), 0);
+	ManifestEntry e;
+	for (const auto& x : l) {
+		CPPUNIT_ASSERT_MESSAGE(x.path, m.find_entry(x.path, e));
+		CPPUNIT_ASSERT(e.digest == x.digest);
+	}
+	for (const auto& s : {"", "dir", "dir/sub/", "dir/sub/1000", "zzz"})
+		CPPUNIT_ASSERT_MESSAGE(s, !m.find_entry(s, e));
+	std::filesystem::remove(f);
+}
+
+void ManifestTest::test_open_manifest(void) {
+	auto f = get_test_manifest_path();
+	Manifest m;
+	CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), -ENOENT);
+
+	std::ofstream ofs(f);
+	ofs << std::string(100, 'x');
+	ofs.close();
+	CPPUNIT_ASSERT(!is_binary_manifest(f));
+	CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), -EINVAL);
+
+	// truncated
+	auto l = get_test_entry(100);
+	ManifestWriter w;
+	for (const auto& e : l)
+		w.add_entry(e);
+	CPPUNIT_ASSERT_EQUAL(w.write_manifest(f, hash::SHA256), 0);
+	std::filesystem::resize_file(f, std::filesystem::file_size(f) - 1);
+	CPPUNIT_ASSERT_EQUAL(m.open_manifest(f), -EINVAL);
+	std::filesystem::remove(f);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ManifestTest);
+#endif
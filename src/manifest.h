@@ -0,0 +1,121 @@
+#ifndef SRC_MANIFEST_H_
+#define SRC_MANIFEST_H_
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+
+#include "./util.h"
+
+struct ManifestEntry {
+	std::string path;
+	std::vector<char> digest;
+	FileType type;
+	std::uint64_t size;
+	std::int64_t mtime_ns;
+};
+
+// Binary manifest file layout (little endian)
+// * header
+// * fixed width records (type, size, mtime_ns, digest) in path order
+// * block index, string table offset of every MANIFEST_BLOCK-th path
+// * string table, front coded paths restarting at each block
+//
+// Entries are spilled to temporary files as sorted runs once limit entries
+// are buffered, and the runs are merged into the manifest when written.
+class ManifestWriter {
+	public:
+	ManifestWriter(void);
+	explicit ManifestWriter(std::size_t);
+	~ManifestWriter(void);
+	ManifestWriter(const ManifestWriter&) = delete;
+	ManifestWriter& operator=(const ManifestWriter&) = delete;
+	void add_entry(const ManifestEntry&);
+	unsigned long num_entry(void) const {
+		return _num_run + static_cast<unsigned long>(_entry.size());
+	}
+	unsigned long num_run(void) const {
+		return static_cast<unsigned long>(_run.size());
+	}
+	int write_manifest(const std::string&, const std::string&);
+
+	private:
+	typedef std::function<void(const ManifestEntry&)> entry_fn;
+	void spill_entry(void);
+	void merge_run(std::size_t, bool, const entry_fn&);
+	void reduce_run(std::size_t);
+
+	std::vector<ManifestEntry> _entry; // unsorted until spilled
+	std::vector<std::FILE*> _run; // sorted runs in temporary files
+	std::vector<unsigned int> _level; // merge rounds of each run
+	unsigned long _num_run; // number of entries in _run
+	std::size_t _limit; // max number of entries in _entry
+};
+
+class Manifest {
+	public:
+	Manifest(void);
+	~Manifest(void);
+	Manifest(const Manifest&) = delete;
+	Manifest& operator=(const Manifest&) = delete;
+	int open_manifest(const std::string&);
+	void close_manifest(void);
+	unsigned long num_entry(void) const {
+		return static_cast<unsigned long>(_num_entry);
+	}
+	const std::string& get_hash_algo(void) const {
+		return _hash_algo;
+	}
+	ManifestEntry get_entry(unsigned long) const;
+	bool find_entry(const std::string&, ManifestEntry&) const;
+	void read_entry(const std::function<void(const ManifestEntry&)>&) const;
+
+	private:
+	std::string get_block_path(std::uint64_t) const;
+	void get_record(std::uint64_t, ManifestEntry&) const;
+
+	const char* _map;
+	std::size_t _map_size;
+	std::uint64_t _num_entry;
+	std::uint64_t _num_block;
+	std::uint32_t _digest_size;
+	std::string _hash_algo;
+	const char* _record;
+	const char* _index;
+	const char* _string;
+	std::uint64_t _string_size;
+};
+
+bool is_binary_manifest(const std::string&);
+int manifest_init(const std::string&);
+int manifest_cleanup(void);
+void set_manifest_input(const std::string&);
+void add_manifest_entry(const std::string&, const std::string&,
+	const std::vector<char>&, const FileType&);
+int print_manifest_text(const std::string&);
+int write_manifest_text(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class ManifestTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(ManifestTest);
+	CPPUNIT_TEST(test_write_manifest);
+	CPPUNIT_TEST(test_spill_entry);
+	CPPUNIT_TEST(test_find_entry);
+	CPPUNIT_TEST(test_open_manifest);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_write_manifest(void);
+	void test_spill_entry(void);
+	void test_find_entry(void);
+	void test_open_manifest(void);
+};
+#endif
+#endif // SRC_MANIFEST_H_
@@ -0,0 +1,277 @@
+#include <vector>
+#include <string>
+#include <functional>
+#include <tuple>
+
+#include <cassert>
+
+#include "./global.h"
+#include "./hash.h"
+#include "./merkle.h"
+
+std::string get_merkle_parent(const std::string& f) {
+	assert(f != ".");
+	auto i = f.rfind('/');
+	return i == std::string::npos ? "." : f.substr(0, i);
+}
+
+long get_merkle_depth(const std::string& f) {
+	if (f == ".")
+		return 0;
+	long n = 1;
+	for (const auto& c : f)
+		if (c == '/')
+			n++;
+	return n;
+}
+
+namespace {
+std::string get_merkle_basename(const std::string& f) {
+	auto i = f.rfind('/');
+	return i == std::string::npos ? f : f.substr(i + 1);
+}
+
+std::string get_merkle_path(const std::string& d, const std::string& name) {
+	return d == "." ? name : d + "/" + name;
+}
+} // namespace
+
+Merkle::Node& Merkle::get_node(const std::string& f) {
+	auto it = _tree.find(f);
+	if (it != _tree.end())
+		return it->second;
+	auto& node = _tree[f];
+	if (f != ".")
+		get_node(get_merkle_parent(f)).child[get_merkle_basename(f)] =
+			Child{true, {}};
+	return node;
+}
+
+void Merkle::invalidate(const std::string& f) {
+	auto x = f;
+	while (1) {
+		auto it = _tree.find(x);
+		if (it != _tree.end())
+			it->second.digest.clear();
+		if (x == ".")
+			break;
+		x = get_merkle_parent(x);
+	}
+}
+
+void Merkle::update_directory(const std::string& f) {
+	if (has_directory(f))
+		return;
+	get_node(f);
+	if (f != ".")
+		invalidate(get_merkle_parent(f));
+}
+
+void Merkle::update_entry(const std::string& f, const std::vector<char>& b) {
+	assert(f != ".");
+	auto d = get_merkle_parent(f);
+	get_node(d).child[get_merkle_basename(f)] = Child{false, b};
+	invalidate(d);
+}
+
+void Merkle::remove_entry(const std::string& f) {
+	assert(f != ".");
+	auto d = get_merkle_parent(f);
+	auto it = _tree.find(d);
+	if (it == _tree.end())
+		return;
+	it->second.child.erase(get_merkle_basename(f));
+	invalidate(d);
+
+	// remove subtree if directory
+	auto prefix = f + "/";
+	_tree.erase(f);
+	auto x = _tree.lower_bound(prefix);
+	while (x != _tree.end() && x->first.starts_with(prefix))
+		x = _tree.erase(x);
+}
+
+// digest of "name\0type digest" records of children sorted by name
+std::vector<char> Merkle::get_digest(const std::string& f) {
+	auto it = _tree.find(f);
+	if (it == _tree.end())
+		return {};
+	auto& node = it->second;
+	if (!node.digest.empty())
+		return node.digest;
+
+	std::vector<char> v;
+	for (const auto& [name, c] : node.child) {
+		v.insert(v.end(), name.begin(), name.end());
+		v.push_back('\0');
+		if (c.dir) {
+			v.push_back('d');
+			auto b = get_digest(get_merkle_path(f, name));
+			v.insert(v.end(), b.begin(), b.end());
+		} else {
+			v.push_back('f');
+			v.insert(v.end(), c.digest.begin(), c.digest.end());
+		}
+	}
+	const auto [b, _ignore] = get_byte_hash(v, opt.hash_algo);
+	assert(!b.empty());
+	node.digest = b;
+	return b;
+}
+
+// directories in post-order (children first as in du(1)),
+// up to given depth unless negative
+std::vector<std::string> Merkle::get_directory(long depth) const {
+	std::vector<std::string> l;
+	std::function<void(const std::string&, long)> walk =
+		[&](const std::string& f, long n) {
+		const auto it = _tree.find(f);
+		assert(it != _tree.end());
+		if (depth < 0 || n < depth)
+			for (const auto& [name, c] : it->second.child)
+				if (c.dir)
+					walk(get_merkle_path(f, name), n + 1);
+		l.push_back(f);
+	};
+	if (has_directory("."))
+		walk(".", 0);
+	return l;
+}
+
+// children of given directory sorted by name, with digests of
+// subdirectories computed as needed
+void Merkle::read_child(const std::string& f, const std::function<void(
+	const std::string&, bool, const std::vector<char>&)>& fn) {
+	auto it = _tree.find(f);
+	if (it == _tree.end())
+		return;
+	for (const auto& [name, c] : it->second.child)
+		fn(name, c.dir, c.dir ? get_digest(get_merkle_path(f, name)) :
+			c.digest);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void MerkleTest::test_get_merkle_parent(void) {
+	const std::vector<std::tuple<std::string, std::string>> path_list{
+		{"a", "."},
+		{"a/b", "a"},
+		{"a/b/c", "a/b"},
+		{".x/y", ".x"},
+	};
+	for (const auto& x : path_list) {
+		const auto [input, output] = x;
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(input, get_merkle_parent(input),
+			output);
+	}
+}
+
+void MerkleTest::test_get_merkle_depth(void) {
+	const std::vector<std::tuple<std::string, long>> path_list{
+		{".", 0},
+		{"a", 1},
+		{"a/b", 2},
+		{"a/b/c", 3},
+	};
+	for (const auto& x : path_list) {
+		const auto [input, output] = x;
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(input, get_merkle_depth(input),
+			output);
+	}
+}
+
+void MerkleTest::test_update_entry(void) {
+	std::vector<char> b1{'1'}, b2{'2'};
+
+	// order independent
+	Merkle merkle1;
+	merkle1.update_directory(".");
+	merkle1.update_directory("a");
+	merkle1.update_entry("a/x", b1);
+	merkle1.update_entry("y", b2);
+	Merkle merkle2;
+	merkle2.update_entry("y", b2);
+	merkle2.update_entry("a/x", b1);
+	CPPUNIT_ASSERT(!merkle1.get_digest(".").empty());
+	CPPUNIT_ASSERT(merkle1.get_digest(".") == merkle2.get_digest("."));
+	CPPUNIT_ASSERT(merkle1.get_digest("a") == merkle2.get_digest("a"));
+	CPPUNIT_ASSERT(merkle1.get_digest(".") != merkle1.get_digest("a"));
+	CPPUNIT_ASSERT(merkle1.get_digest("x").empty());
+
+	// change propagates to ancestors only
+	merkle1.update_directory("b");
+	merkle2.update_directory("b");
+	merkle1.update_entry("b/z", b1);
+	merkle2.update_entry("b/z", b2);
+	CPPUNIT_ASSERT(merkle1.get_digest("a") == merkle2.get_digest("a"));
+	CPPUNIT_ASSERT(merkle1.get_digest("b") != merkle2.get_digest("b"));
+	CPPUNIT_ASSERT(merkle1.get_digest(".") != merkle2.get_digest("."));
+
+	merkle2.update_entry("b/z", b1);
+	CPPUNIT_ASSERT(merkle1.get_digest(".") == merkle2.get_digest("."));
+}
+
+void MerkleTest::test_remove_entry(void) {
+	std::vector<char> b1{'1'};
+
+	Merkle merkle1;
+	merkle1.update_directory(".");
+	auto b = merkle1.get_digest(".");
+
+	merkle1.update_entry("a/b/x", b1);
+	CPPUNIT_ASSERT_EQUAL(merkle1.num_directory(), 3lu);
+	CPPUNIT_ASSERT(merkle1.get_digest(".") != b);
+
+	merkle1.remove_entry("a");
+	CPPUNIT_ASSERT_EQUAL(merkle1.num_directory(), 1lu);
+	CPPUNIT_ASSERT(merkle1.get_digest(".") == b);
+}
+
+void MerkleTest::test_get_directory(void) {
+	std::vector<char> b1{'1'};
+
+	Merkle merkle;
+	CPPUNIT_ASSERT(merkle.get_directory(-1).empty());
+	merkle.update_entry("a-c/x", b1);
+	merkle.update_entry("a/b/x", b1);
+	merkle.update_entry("x", b1);
+
+	const std::vector<std::string> l1{"a/b", "a", "a-c", "."};
+	CPPUNIT_ASSERT(merkle.get_directory(-1) == l1);
+	const std::vector<std::string> l2{"a", "a-c", "."};
+	CPPUNIT_ASSERT(merkle.get_directory(1) == l2);
+	const std::vector<std::string> l3{"."};
+	CPPUNIT_ASSERT(merkle.get_directory(0) == l3);
+}
+
+void MerkleTest::test_read_child(void) {
+	std::vector<char> b1{'1'}, b2{'2'};
+
+	Merkle merkle;
+	merkle.update_entry("b", b1);
+	merkle.update_entry("a/x", b2);
+	merkle.update_directory("c");
+
+	std::vector<std::tuple<std::string, bool, std::vector<char>>> l;
+	auto fn = [&](const std::string& name, bool dir,
+		const std::vector<char>& b) {
+		l.push_back({name, dir, b});
+	};
+	merkle.read_child(".", fn);
+	CPPUNIT_ASSERT_EQUAL(l.size(), 3lu);
+	CPPUNIT_ASSERT(l[0] == std::make_tuple(std::string("a"), true,
+		merkle.get_digest("a")));
+	CPPUNIT_ASSERT(l[1] == std::make_tuple(std::string("b"), false, b1));
+	CPPUNIT_ASSERT(l[2] == std::make_tuple(std::string("c"), true,
+		merkle.get_digest("c")));
+
+	l.clear();
+	merkle.read_child("x", fn);
+	CPPUNIT_ASSERT(l.empty());
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(MerkleTest);
+#endif
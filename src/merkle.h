@@ -0,0 +1,76 @@
+#ifndef SRC_MERKLE_H_
+#define SRC_MERKLE_H_
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <string>
+
+// Per directory digests computed bottom-up from children.
+// Paths are relative to input prefix, and "." is the input prefix itself.
+class Merkle {
+	public:
+	Merkle(void):
+		_tree{} {
+	}
+	void init_tree(void) {
+		_tree.clear();
+	}
+	void update_directory(const std::string&);
+	void update_entry(const std::string&, const std::vector<char>&);
+	void remove_entry(const std::string&);
+	bool has_directory(const std::string& f) const {
+		return _tree.find(f) != _tree.end();
+	}
+	std::vector<char> get_digest(const std::string&);
+	std::vector<std::string> get_directory(long) const;
+	void read_child(const std::string&, const std::function<void(
+		const std::string&, bool, const std::vector<char>&)>&);
+	unsigned long num_directory(void) const {
+		return static_cast<unsigned long>(_tree.size());
+	}
+
+	private:
+	struct Child {
+		bool dir;
+		std::vector<char> digest; // unused if dir
+	};
+	struct Node {
+		std::map<std::string, Child> child; // sorted by base name
+		std::vector<char> digest; // empty if not yet computed
+	};
+	Node& get_node(const std::string&);
+	void invalidate(const std::string&);
+
+	std::map<std::string, Node> _tree;
+};
+
+std::string get_merkle_parent(const std::string&);
+long get_merkle_depth(const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class MerkleTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(MerkleTest);
+	CPPUNIT_TEST(test_get_merkle_parent);
+	CPPUNIT_TEST(test_get_merkle_depth);
+	CPPUNIT_TEST(test_update_entry);
+	CPPUNIT_TEST(test_remove_entry);
+	CPPUNIT_TEST(test_get_directory);
+	CPPUNIT_TEST(test_read_child);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_merkle_parent(void);
+	void test_get_merkle_depth(void);
+	void test_update_entry(void);
+	void test_remove_entry(void);
+	void test_get_directory(void);
+	void test_read_child(void);
+};
+#endif
+#endif // SRC_MERKLE_H_
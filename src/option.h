@@ -0,0 +1,60 @@
+#ifndef SRC_OPTION_H_
+#define SRC_OPTION_H_
+
+#include <string>
+#include <cstdint>
+
+// command line options, or options of a library call
+struct Options {
+	std::string hash_algo = "sha256";
+	std::string hash_verify;
+	std::string hash_verify_from;
+	bool first = false;
+	bool hash_only = false;
+	bool ignore_dot = false;
+	bool ignore_dot_dir = false;
+	bool ignore_dot_file = false;
+	bool ignore_symlink = false;
+	bool follow_symlink = false;
+	bool abs = false;
+	bool swap = false;
+	bool sort = false;
+	bool squash = false;
+	unsigned long squash_buffer_limit = 1024;
+	bool dir_digests = false;
+	long dir_digests_depth = -1;
+	std::string cache;
+	unsigned long cache_strict = 0;
+	bool xattr_cache = false;
+	std::string checkpoint;
+	std::string check;
+	bool fail_fast = false;
+	unsigned long jobs = 0;
+	std::string manifest;
+	std::string manifest_to_text;
+	std::string manifest_from_text;
+	bool diff = false;
+	bool find_dups = false;
+	bool quick = false;
+	unsigned long quick_blocks = 8;
+	bool metadata_only = false;
+	bool cdc = false;
+	unsigned long cdc_size = 8192;
+	bool tar = false;
+	std::string files_from;
+	bool null = false;
+	std::int64_t newer = -1;
+	unsigned long shard_index = 0;
+	unsigned long shard_count = 0;
+	std::string emit_partial;
+	bool merge_partials = false;
+	bool sync_server = false;
+	std::string sync_client;
+	std::string serve;
+	std::string serve_client;
+	bool watch = false;
+	std::string output_format = "text";
+	bool verbose = false;
+	bool debug = false;
+};
+#endif // SRC_OPTION_H_
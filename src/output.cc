@@ -0,0 +1,419 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+
+#include <cerrno>
+#include <cassert>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "./global.h"
+#include "./hash.h"
+#include "./output.h"
+
+const std::string OUTPUT_TEXT("text");
+const std::string OUTPUT_JSONL("jsonl");
+const std::string OUTPUT_CSV("csv");
+const std::string OUTPUT_BINARY("binary");
+
+namespace {
+const std::string OUTPUT_BINARY_MAGIC("DHREC001");
+const std::size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+const std::size_t OUTPUT_QUEUE_SIZE = 4; // buffers waiting for writer
+
+// std::cout buffer while installed, restored on cleanup
+std::unique_ptr<OutputBuffer> _output;
+std::streambuf* _output_orig;
+
+std::string get_json_string(const std::string& s) {
+	std::ostringstream ss;
+	ss << '"';
+	for (const auto& c : s) {
+		auto x = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\')
+			ss << '\\' << c;
+		else if (x < 0x20)
+			ss << "\\u" << std::hex << std::setw(4)
+				<< std::setfill('0') << static_cast<int>(x)
+				<< std::dec;
+		else
+			ss << c;
+	}
+	ss << '"';
+	return ss.str();
+}
+
+// RFC 4180, quoted only if needed
+std::string get_csv_string(const std::string& s) {
+	if (s.find_first_of(",\"\r\n") == std::string::npos)
+		return s;
+	std::string x("\"");
+	for (const auto& c : s) {
+		if (c == '"')
+			x += '"';
+		x += c;
+	}
+	return x + "\"";
+}
+
+std::string get_output_digest(const OutputRecord& r) {
+	return r.digest.empty() ? "" : get_hex_sum(r.digest);
+}
+
+void put_output_jsonl(std::ostream& os, const OutputRecord& r) {
+	os << "{\"path\":" << get_json_string(r.path)
+		<< ",\"type\":" << get_json_string(get_file_type_string(r.type))
+		<< ",\"size\":" << r.size << ",\"mtime_ns\":";
+	if (r.mtime_ns < 0)
+		os << "null";
+	else
+		os << r.mtime_ns;
+	os << ",\"digest\":";
+	if (r.digest.empty())
+		os << "null";
+	else
+		os << get_json_string(get_output_digest(r));
+	if (!r.label.empty())
+		os << ",\"label\":" << get_json_string(r.label);
+	os << "}\n";
+}
+
+void put_output_csv(std::ostream& os, const OutputRecord& r) {
+	os << get_csv_string(r.path) << ","
+		<< get_csv_string(get_file_type_string(r.type)) << "," << r.size
+		<< ",";
+	if (r.mtime_ns >= 0)
+		os << r.mtime_ns;
+	os << "," << get_output_digest(r) << "," << get_csv_string(r.label)
+		<< "\n";
+}
+
+// little endian, one write per record so that records never interleave
+void put_output_binary(std::ostream& os, const OutputRecord& r) {
+	assert(r.digest.size() <= 0xff);
+	assert(r.label.size() <= 0xff);
+	std::vector<char> v;
+	put_le32(v, static_cast<std::uint32_t>(r.path.size()));
+	v.insert(v.end(), r.path.begin(), r.path.end());
+	v.push_back(static_cast<char>(r.type));
+	put_le64(v, r.size);
+	put_le64(v, static_cast<std::uint64_t>(r.mtime_ns));
+	v.push_back(static_cast<char>(r.digest.size()));
+	v.insert(v.end(), r.digest.begin(), r.digest.end());
+	v.push_back(static_cast<char>(r.label.size()));
+	v.insert(v.end(), r.label.begin(), r.label.end());
+	os.write(v.data(), static_cast<std::streamsize>(v.size()));
+}
+
+void output_exit(void) {
+	output_cleanup();
+}
+} // namespace
+
+OutputBuffer::OutputBuffer(int fd, std::size_t size):
+	_fd(fd),
+	_size(size),
+	_busy(false),
+	_stop(false),
+	_error(0),
+	_thread(&OutputBuffer::run, this) {
+	assert(_size);
+	_buf.reserve(_size);
+}
+
+OutputBuffer::~OutputBuffer(void) {
+	drain();
+	{
+		std::lock_guard<std::mutex> lk(_mutex);
+		_stop = true;
+	}
+	_cv.notify_all();
+	_thread.join();
+}
+
+// wait until everything inserted so far is written, -errno if write failed
+int OutputBuffer::drain(void) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	if (!_buf.empty())
+		queue_buffer(lk);
+	_cv.wait(lk, [&] { return _queue.empty() && !_busy; });
+	return -_error;
+}
+
+OutputBuffer::int_type OutputBuffer::overflow(int_type c) {
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+	auto x = traits_type::to_char_type(c);
+	xsputn(&x, 1);
+	return c;
+}
+
+std::streamsize OutputBuffer::xsputn(const char* p, std::streamsize n) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	_buf.insert(_buf.end(), p, p + n);
+	if (_buf.size() >= _size)
+		queue_buffer(lk);
+	return n;
+}
+
+// hand what was inserted so far to writer, write errors are left to drain
+int OutputBuffer::sync(void) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	if (!_buf.empty())
+		queue_buffer(lk);
+	return 0;
+}
+
+// block while writer is behind, otherwise memory grows with output
+void OutputBuffer::queue_buffer(std::unique_lock<std::mutex>& lk) {
+	_cv.wait(lk, [&] { return _queue.size() < OUTPUT_QUEUE_SIZE; });
+	if (_buf.size() < _size) {
+		// flushed early, keep capacity rather than reallocate per flush
+		_queue.emplace_back(_buf.begin(), _buf.end());
+		_buf.clear();
+	} else {
+		_queue.push_back(std::move(_buf));
+		_buf.clear();
+		_buf.reserve(_size);
+	}
+	_cv.notify_all();
+}
+
+void OutputBuffer::run(void) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	while (true) {
+		_cv.wait(lk, [&] { return !_queue.empty() || _stop; });
+		if (_queue.empty())
+			break;
+		auto b = std::move(_queue.front());
+		_queue.pop_front();
+		_busy = true;
+		auto error = _error;
+		lk.unlock();
+		// discard once failed, so that inserting threads never block
+		std::size_t i = 0;
+		while (!error && i < b.size()) {
+			auto ret = write(_fd, b.data() + i, b.size() - i);
+			if (ret < 0) {
+				if (errno != EINTR)
+					error = errno;
+				continue;
+			}
+			i += static_cast<std::size_t>(ret);
+		}
+		lk.lock();
+		_busy = false;
+		_error = error;
+		_cv.notify_all();
+	}
+}
+
+bool is_valid_output_format(const std::string& s) {
+	return s == OUTPUT_TEXT || s == OUTPUT_JSONL || s == OUTPUT_CSV ||
+		s == OUTPUT_BINARY;
+}
+
+bool is_record_output(void) {
+	return opt.output_format != OUTPUT_TEXT;
+}
+
+// -1 for tar member, path only exists within archive, and invalid file
+std::int64_t get_output_mtime(const std::string& f, const FileType& t) {
+	if (opt.tar || t == FileType::Invalid)
+		return -1;
+	struct stat st;
+	auto ret = t == FileType::Symlink ? lstat(f.c_str(), &st) :
+		stat(f.c_str(), &st);
+	if (ret == -1)
+		return -1;
+	return get_mtime_ns(st);
+}
+
+void put_output_record(const OutputRecord& r) {
+	assert(is_record_output());
+	auto& os = get_output();
+	if (opt.output_format == OUTPUT_JSONL)
+		put_output_jsonl(os, r);
+	else if (opt.output_format == OUTPUT_CSV)
+		put_output_csv(os, r);
+	else if (opt.output_format == OUTPUT_BINARY)
+		put_output_binary(os, r);
+	else
+		assert(false);
+}
+
+// CSV column names, or binary magic followed by hash algorithm
+void print_output_header(void) {
+	auto& os = get_output();
+	if (opt.output_format == OUTPUT_CSV) {
+		os << "path,type,size,mtime_ns,digest,label\n";
+	} else if (opt.output_format == OUTPUT_BINARY) {
+		assert(opt.hash_algo.size() <= 0xff);
+		os << OUTPUT_BINARY_MAGIC
+			<< static_cast<char>(opt.hash_algo.size())
+			<< opt.hash_algo;
+	}
+}
+
+// unless interactive, stdout is written in large buffers by a writer thread
+void output_init(void) {
+	assert(!_output);
+	if (isatty(STDOUT_FILENO))
+		return;
+	std::cout.flush();
+	_output = std::make_unique<OutputBuffer>(STDOUT_FILENO,
+		OUTPUT_BUFFER_SIZE);
+	_output_orig = std::cout.rdbuf(_output.get());
+	// error paths in main exit(1) without cleanup
+	std::atexit(output_exit);
+}
+
+int output_cleanup(void) {
+	if (!_output)
+		return 0;
+	auto ret = _output->drain();
+	std::cout.rdbuf(_output_orig);
+	_output.reset();
+	return ret;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <filesystem>
+#include <thread>
+#include <chrono>
+
+#include <cppunit/TestAssert.h>
+
+#include <fcntl.h>
+
+#include "./cppunit.h"
+
+void OutputTest::test_put_output_record(void) {
+	auto x = opt;
+	std::ostringstream ss;
+	set_output(&ss);
+
+	OutputRecord r{"a\"b,c\n", FileType::Reg, 3, 1500000000, {'\x01',
+		'\xab'}, ""};
+	opt.output_format = OUTPUT_JSONL;
+	put_output_record(r);
+	CPPUNIT_ASSERT_EQUAL(ss.str(), std::string("{\"path\":"
+		"\"a\\\"b,c\\u000a\",\"type\":\"regular file\",\"size\":3,"
+		"\"mtime_ns\":1500000000,\"digest\":\"01ab\"}\n"));
+
+	ss.str("");
+	opt.output_format = OUTPUT_CSV;
+	put_output_record(r);
+	CPPUNIT_ASSERT_EQUAL(ss.str(), std::string("\"a\"\"b,c\n\","
+		"regular file,3,1500000000,01ab,\n"));
+
+	// unknown mtime and digest
+	OutputRecord r2{"x", FileType::Invalid, 0, -1, {}, "[squash][v1]"};
+	ss.str("");
+	opt.output_format = OUTPUT_JSONL;
+	put_output_record(r2);
+	CPPUNIT_ASSERT_EQUAL(ss.str(), std::string("{\"path\":\"x\","
+		"\"type\":\"invalid file\",\"size\":0,\"mtime_ns\":null,"
+		"\"digest\":null,\"label\":\"[squash][v1]\"}\n"));
+	ss.str("");
+	opt.output_format = OUTPUT_CSV;
+	put_output_record(r2);
+	CPPUNIT_ASSERT_EQUAL(ss.str(),
+		std::string("x,invalid file,0,,,[squash][v1]\n"));
+
+	ss.str("");
+	opt.output_format = OUTPUT_BINARY;
+	put_output_record(r);
+	auto s = ss.str();
+	CPPUNIT_ASSERT_EQUAL(s.size(), static_cast<std::size_t>(4 + 6 + 1 + 8 +
+		8 + 1 + 2 + 1));
+	CPPUNIT_ASSERT_EQUAL(get_le32(s.data()), static_cast<std::uint32_t>(6));
+	CPPUNIT_ASSERT_EQUAL(s.substr(4, 6), r.path);
+	CPPUNIT_ASSERT_EQUAL(s[10], static_cast<char>(FileType::Reg));
+	CPPUNIT_ASSERT_EQUAL(get_le64(s.data() + 11),
+		static_cast<std::uint64_t>(3));
+	CPPUNIT_ASSERT_EQUAL(get_le64(s.data() + 19),
+		static_cast<std::uint64_t>(1500000000));
+	CPPUNIT_ASSERT_EQUAL(s[27], '\x02');
+	CPPUNIT_ASSERT_EQUAL(s[29], '\xab');
+	CPPUNIT_ASSERT_EQUAL(s[30], '\x00');
+
+	set_output(nullptr);
+	opt = x;
+}
+
+void OutputTest::test_drain(void) {
+	auto f = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-output-test." + std::to_string(getpid()));
+	auto fd = open(f.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CPPUNIT_ASSERT(fd != -1);
+
+	// small buffer so that writer thread runs behind, lines stay whole
+	const auto n = 1000;
+	{
+		OutputBuffer b(fd, 64);
+		std::vector<std::thread> threads;
+		for (auto i = 0; i < 2; i++)
+			threads.push_back(std::thread([&, i](void) {
+				std::ostream os(&b);
+				for (auto j = 0; j < n; j++)
+					os << (std::to_string(i) + ":" +
+						std::to_string(j) + "\n")
+						<< std::flush;
+			}));
+		for (auto& t : threads)
+			t.join();
+		CPPUNIT_ASSERT_EQUAL(b.drain(), 0);
+	}
+	close(fd);
+
+	// per thread lines are in order
+	std::ifstream ifs(f);
+	std::string l;
+	std::vector<int> next(2);
+	while (std::getline(ifs, l)) {
+		auto i = l.find(':');
+		CPPUNIT_ASSERT(i != std::string::npos);
+		auto t = std::stoi(l.substr(0, i));
+		CPPUNIT_ASSERT_EQUAL(std::stoi(l.substr(i + 1)), next[t]);
+		next[t]++;
+	}
+	CPPUNIT_ASSERT_EQUAL(next[0], n);
+	CPPUNIT_ASSERT_EQUAL(next[1], n);
+	std::filesystem::remove_all(f);
+}
+
+void OutputTest::test_sync(void) {
+	auto f = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-output-test." + std::to_string(getpid()));
+	auto fd = open(f.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CPPUNIT_ASSERT(fd != -1);
+
+	// flushed line is written before buffer is full or drained
+	{
+		OutputBuffer b(fd, 1 << 20);
+		std::ostream os(&b);
+		os << "abc" << std::endl;
+		for (auto i = 0; i < 1000; i++) {
+			if (std::filesystem::file_size(f) == 4)
+				break;
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(10));
+		}
+		CPPUNIT_ASSERT_EQUAL(std::filesystem::file_size(f),
+			static_cast<std::uintmax_t>(4));
+		os << "def\n";
+		CPPUNIT_ASSERT_EQUAL(b.drain(), 0);
+		CPPUNIT_ASSERT_EQUAL(std::filesystem::file_size(f),
+			static_cast<std::uintmax_t>(8));
+	}
+	close(fd);
+	std::filesystem::remove_all(f);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(OutputTest);
+#endif
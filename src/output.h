@@ -0,0 +1,89 @@
+#ifndef SRC_OUTPUT_H_
+#define SRC_OUTPUT_H_
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <streambuf>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "./util.h"
+
+extern const std::string OUTPUT_TEXT;
+extern const std::string OUTPUT_JSONL;
+extern const std::string OUTPUT_CSV;
+extern const std::string OUTPUT_BINARY;
+
+struct OutputRecord {
+	std::string path; // as printed, "." for input itself
+	FileType type;
+	unsigned long size; // bytes hashed
+	std::int64_t mtime_ns; // -1 if unknown, e.g. tar member
+	std::vector<char> digest; // empty if unsupported or invalid
+	std::string label; // e.g. "[squash][v1]", empty if plain digest
+};
+
+// Streambuf collecting output into large buffers written by a separate
+// thread, so that each line doesn't cost a write(2). A flush hands what was
+// inserted so far to the writer. Insertions are serialized, hence usable
+// from multiple threads.
+class OutputBuffer: public std::streambuf {
+	public:
+	OutputBuffer(int, std::size_t);
+	~OutputBuffer(void);
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+	int drain(void);
+
+	protected:
+	int_type overflow(int_type) override;
+	std::streamsize xsputn(const char*, std::streamsize) override;
+	int sync(void) override;
+
+	private:
+	void queue_buffer(std::unique_lock<std::mutex>&);
+	void run(void);
+
+	int _fd;
+	std::size_t _size;
+	std::vector<char> _buf;
+	std::deque<std::vector<char>> _queue;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	bool _busy; // writing buffer taken from queue
+	bool _stop;
+	int _error;
+	std::thread _thread;
+};
+
+bool is_valid_output_format(const std::string&);
+bool is_record_output(void);
+std::int64_t get_output_mtime(const std::string&, const FileType&);
+void put_output_record(const OutputRecord&);
+void print_output_header(void);
+void output_init(void);
+int output_cleanup(void);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class OutputTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(OutputTest);
+	CPPUNIT_TEST(test_put_output_record);
+	CPPUNIT_TEST(test_drain);
+	CPPUNIT_TEST(test_sync);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_put_output_record(void);
+	void test_drain(void);
+	void test_sync(void);
+};
+#endif
+#endif // SRC_OUTPUT_H_
@@ -0,0 +1,409 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "./cache.h"
+#include "./dir.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./serve.h"
+#include "./squash.h"
+#include "./util.h"
+
+namespace {
+const std::string SERVE_MAGIC("DHSERV01");
+const unsigned long SERVE_FLUSH_COUNT = 1024; // results per write
+
+// boolean options sent per request, same order on both sides
+template <typename T>
+auto get_serve_flag(T& o) {
+	return std::vector{&o.ignore_dot, &o.ignore_dot_dir, &o.ignore_dot_file,
+		&o.ignore_symlink, &o.follow_symlink, &o.abs, &o.sort,
+		&o.squash, &o.dir_digests, &o.quick, &o.metadata_only, &o.tar};
+}
+
+int get_socket_address(const std::string& f, struct sockaddr_un& sa) {
+	if (f.size() >= sizeof(sa.sun_path))
+		return -ENAMETOOLONG;
+	std::memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	std::memcpy(sa.sun_path, f.data(), f.size());
+	return 0;
+}
+
+int connect_socket(const std::string& f) {
+	struct sockaddr_un sa;
+	auto ret = get_socket_address(f, sa);
+	if (ret < 0)
+		return ret;
+	auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+	if (connect(fd, reinterpret_cast<struct sockaddr*>(&sa),
+		sizeof(sa)) == -1) {
+		auto error = errno;
+		close(fd);
+		return -error;
+	}
+	return fd;
+}
+
+// socket left behind by a server no longer running, but not a live one
+int unlink_stale_socket(const std::string& f) {
+	struct stat st;
+	if (lstat(f.c_str(), &st) == -1)
+		return errno == ENOENT ? 0 : -errno;
+	if (!S_ISSOCK(st.st_mode))
+		return -EADDRINUSE;
+	auto fd = connect_socket(f);
+	if (fd >= 0) {
+		close(fd);
+		return -EADDRINUSE;
+	} else if (fd != -ECONNREFUSED) {
+		return fd;
+	}
+	if (unlink(f.c_str()) == -1)
+		return -errno;
+	return 0;
+}
+
+void put_serve_result(SyncChannel& ch, const Result& r) {
+	ch.put_varint(static_cast<std::uint64_t>(r.type) + 1);
+	ch.put_string(r.path);
+	ch.put_varint(r.size);
+	ch.put_byte(r.digest);
+	ch.put_varint(r.squash);
+}
+
+// same format as printed by dirhash-cpp itself
+void print_serve_result(const Result& r) {
+	auto hex_sum = get_hex_sum(r.digest);
+	if (opt.hash_only) {
+		std::cout << hex_sum << std::endl;
+	} else if (r.squash) {
+		// no space between two
+		std::ostringstream ss;
+		ss << "[" << SQUASH_LABEL << "][v" << SQUASH_VERSION << "]";
+		if (opt.metadata_only)
+			ss << "[" << METADATA_LABEL << "][v" << METADATA_VERSION
+				<< "]";
+		if (r.path == ".")
+			std::cout << hex_sum << ss.str() << std::endl;
+		else
+			std::cout << get_xsum_format_string(r.path, hex_sum,
+				opt.swap) << ss.str() << std::endl;
+	} else if (opt.quick && r.type != FileType::Symlink) {
+		std::cout << get_xsum_format_string(r.path, hex_sum, opt.swap)
+			<< "[" << QUICK_LABEL << "][v" << QUICK_VERSION << "]"
+			<< std::endl;
+	} else {
+		std::cout << get_xsum_format_string(r.path, hex_sum, opt.swap)
+			<< std::endl;
+	}
+}
+
+void print_serve_stat(std::vector<std::string>& l, const FileType& t) {
+	if (l.empty())
+		return;
+	print_num_format_string(l.size(), get_file_type_string(t));
+	for (const auto& x : l)
+		std::cout << x << std::endl;
+	l.clear();
+}
+} // namespace
+
+// per request options, others are either rejected or local to client
+void put_serve_option(SyncChannel& ch, const Options& o) {
+	ch.put_string(o.hash_algo);
+	for (const auto* x : get_serve_flag(o))
+		ch.put_varint(*x);
+	ch.put_varint(o.squash_buffer_limit);
+	ch.put_varint(static_cast<std::uint64_t>(o.dir_digests_depth));
+	ch.put_varint(o.quick_blocks);
+	ch.put_varint(static_cast<std::uint64_t>(o.newer));
+}
+
+Options get_serve_option(SyncChannel& ch) {
+	Options o;
+	o.hash_algo = ch.get_string();
+	for (auto* x : get_serve_flag(o))
+		*x = ch.get_varint() != 0;
+	o.squash_buffer_limit = ch.get_varint();
+	o.dir_digests_depth = static_cast<long>(ch.get_varint());
+	o.quick_blocks = ch.get_varint();
+	o.newer = static_cast<std::int64_t>(ch.get_varint());
+	return o;
+}
+
+// answer requests until client closes connection, results are streamed
+// followed by errno and message of the request
+void serve_connection(SyncChannel& ch) {
+	ch.put_string(SERVE_MAGIC);
+	ch.flush();
+
+	while (true) {
+		Options o;
+		std::string f;
+		try {
+			o = get_serve_option(ch);
+			f = ch.get_string();
+		} catch (const std::runtime_error& e) {
+			return;
+		}
+
+		int ret;
+		std::string msg;
+		unsigned long n = 0;
+		try {
+			ret = hash_path(o, f, [&](const Result& r) {
+				put_serve_result(ch, r);
+				if (++n % SERVE_FLUSH_COUNT == 0)
+					ch.flush();
+			});
+			if (ret < 0)
+				msg = strerror(-ret);
+		} catch (const std::runtime_error& e) {
+			ret = -EIO;
+			msg = e.what();
+		}
+		ch.put_varint(0);
+		ch.put_varint(static_cast<std::uint64_t>(-ret));
+		ch.put_string(msg);
+		ch.flush();
+	}
+}
+
+// hash f on server side with options o, results are passed to fn
+int query_serve(SyncChannel& ch, const Options& o, const std::string& f,
+	const ResultSink& fn, std::string& msg) {
+	put_serve_option(ch, o);
+	ch.put_string(f);
+	ch.flush();
+
+	while (auto x = ch.get_varint()) {
+		if (x > static_cast<std::uint64_t>(FileType::Invalid) + 1)
+			throw std::runtime_error("serve: Invalid file type");
+		Result r;
+		r.type = static_cast<FileType>(x - 1);
+		r.path = ch.get_string();
+		r.size = ch.get_varint();
+		r.digest = ch.get_byte();
+		r.squash = ch.get_varint() != 0;
+		fn(r);
+	}
+	auto error = ch.get_varint();
+	msg = ch.get_string();
+	return -static_cast<int>(error);
+}
+
+// accept connections on Unix socket f and answer them with a pool of
+// opt.jobs workers, digests are cached in memory unless --cache,
+// returns only on error
+int serve(const std::string& f) {
+	auto ret = unlink_stale_socket(f);
+	if (ret < 0)
+		return ret;
+	struct sockaddr_un sa;
+	ret = get_socket_address(f, sa);
+	if (ret < 0)
+		return ret;
+	auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -errno;
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&sa),
+		sizeof(sa)) == -1 || listen(fd, SOMAXCONN) == -1) {
+		auto error = errno;
+		close(fd);
+		return -error;
+	}
+	std::signal(SIGPIPE, SIG_IGN);
+	if (opt.cache.empty())
+		cache_init();
+
+	std::atomic<int> error(0);
+	auto worker = [&](void) {
+		while (true) {
+			auto c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (c == -1) {
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				auto x = 0;
+				error.compare_exchange_strong(x, -errno);
+				// wake up other workers
+				shutdown(fd, SHUT_RDWR);
+				break;
+			}
+			SyncChannel ch(c, c);
+			try {
+				serve_connection(ch);
+			} catch (const std::runtime_error& e) {
+				// client gone
+			}
+			close(c);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < opt.jobs; i++)
+		threads.push_back(new_thread(worker));
+	for (auto& t : threads)
+		t.join();
+	close(fd);
+	unlink(f.c_str());
+	return error;
+}
+
+// print results of inputs hashed by server at Unix socket f
+int serve_client(const std::string& f, const std::vector<std::string>& l) {
+	auto fd = connect_socket(f);
+	if (fd < 0) {
+		std::cout << f << ": " << strerror(-fd) << std::endl;
+		return fd;
+	}
+	std::signal(SIGPIPE, SIG_IGN);
+
+	SyncChannel ch(fd, fd);
+	auto ret = 0;
+	try {
+		if (ch.get_string() != SERVE_MAGIC) {
+			std::cout << "Invalid server " << f << std::endl;
+			ret = -EPROTO;
+		}
+		for (std::size_t i = 0; i < l.size() && ret == 0; i++) {
+			// unsupported and invalid files follow regular files,
+			// print each list with its count
+			std::vector<std::string> unsupported, invalid;
+			std::string msg;
+			ret = query_serve(ch, opt, get_abspath(l[i]),
+				[&](const Result& r) {
+				if (r.type == FileType::Unsupported) {
+					unsupported.push_back(r.path);
+				} else if (r.type == FileType::Invalid) {
+					invalid.push_back(r.path);
+				} else {
+					print_serve_stat(unsupported,
+						FileType::Unsupported);
+					print_serve_stat(invalid,
+						FileType::Invalid);
+					print_serve_result(r);
+				}
+			}, msg);
+			print_serve_stat(unsupported, FileType::Unsupported);
+			print_serve_stat(invalid, FileType::Invalid);
+			if (ret < 0)
+				std::cout << msg << std::endl;
+		}
+	} catch (const std::runtime_error& e) {
+		std::cout << e.what() << std::endl;
+		ret = -EIO;
+	}
+	close(fd);
+	return ret;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void ServeTest::test_get_serve_option(void) {
+	int sv[2];
+	CPPUNIT_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	SyncChannel a(sv[0], sv[0]), b(sv[1], sv[1]);
+
+	Options o1, o2;
+	o2.hash_algo = hash::SHA1;
+	o2.ignore_dot_dir = o2.sort = o2.tar = true;
+	o2.squash_buffer_limit = 1;
+	o2.dir_digests_depth = 3;
+	o2.newer = 1234567890123456789;
+	o2.verbose = true; // not sent
+	for (const auto* o : {&o1, &o2})
+		put_serve_option(a, *o);
+	a.flush();
+
+	for (const auto* o : {&o1, &o2}) {
+		auto x = get_serve_option(b);
+		CPPUNIT_ASSERT_EQUAL(x.hash_algo, o->hash_algo);
+		auto f1 = get_serve_flag(x);
+		auto f2 = get_serve_flag(*o);
+		for (std::size_t i = 0; i < f1.size(); i++)
+			CPPUNIT_ASSERT_EQUAL(*f1[i], *f2[i]);
+		CPPUNIT_ASSERT_EQUAL(x.squash_buffer_limit,
+			o->squash_buffer_limit);
+		CPPUNIT_ASSERT_EQUAL(x.dir_digests_depth, o->dir_digests_depth);
+		CPPUNIT_ASSERT_EQUAL(x.quick_blocks, o->quick_blocks);
+		CPPUNIT_ASSERT_EQUAL(x.newer, o->newer);
+		CPPUNIT_ASSERT(!x.verbose);
+	}
+	close(sv[0]);
+	close(sv[1]);
+}
+
+void ServeTest::test_query_serve(void) {
+	auto d = std::filesystem::temp_directory_path() /
+		("dirhash-cpp-serve-test." + std::to_string(getpid()));
+	std::filesystem::create_directories(d / "a");
+	for (const auto& f : {"x", "a/y"}) {
+		std::ofstream ofs(d / f);
+		ofs << f;
+	}
+
+	int sv[2];
+	CPPUNIT_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	SyncChannel a(sv[0], sv[0]), b(sv[1], sv[1]);
+	auto t = new_thread([&](void) {
+		serve_connection(b);
+	});
+	CPPUNIT_ASSERT_EQUAL(a.get_string(), SERVE_MAGIC);
+
+	// same results as local library call, several requests per connection
+	Options o1, o2;
+	o2.squash = o2.sort = true;
+	for (const auto* o : {&o1, &o2, &o1}) {
+		std::map<std::string, std::vector<char>> m1, m2;
+		CPPUNIT_ASSERT_EQUAL(hash_path(*o, d, [&](const Result& r) {
+			m1[r.path] = r.digest;
+		}), 0);
+		std::string msg;
+		CPPUNIT_ASSERT_EQUAL(query_serve(a, *o, d, [&](const Result& r) {
+			m2[r.path] = r.digest;
+		}, msg), 0);
+		CPPUNIT_ASSERT(msg.empty());
+		CPPUNIT_ASSERT(!m1.empty());
+		CPPUNIT_ASSERT(m1 == m2);
+	}
+
+	// errors are returned per request
+	std::string msg;
+	auto fn = [](const Result&) {
+		CPPUNIT_FAIL("");
+	};
+	CPPUNIT_ASSERT_EQUAL(query_serve(a, o1, d / "xxx", fn, msg), -EIO);
+	CPPUNIT_ASSERT(!msg.empty());
+	o1.hash_algo = "xxx";
+	CPPUNIT_ASSERT_EQUAL(query_serve(a, o1, d, fn, msg), -EINVAL);
+
+	// server returns once client is gone
+	close(sv[0]);
+	t.join();
+	close(sv[1]);
+	std::filesystem::remove_all(d);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ServeTest);
+#endif
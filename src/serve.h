@@ -0,0 +1,36 @@
+#ifndef SRC_SERVE_H_
+#define SRC_SERVE_H_
+
+#include <vector>
+#include <string>
+
+#include "./dirhash.h"
+#include "./option.h"
+#include "./sync.h"
+
+void put_serve_option(SyncChannel&, const Options&);
+Options get_serve_option(SyncChannel&);
+void serve_connection(SyncChannel&);
+int query_serve(SyncChannel&, const Options&, const std::string&,
+	const ResultSink&, std::string&);
+int serve(const std::string&);
+int serve_client(const std::string&, const std::vector<std::string>&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class ServeTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(ServeTest);
+	CPPUNIT_TEST(test_get_serve_option);
+	CPPUNIT_TEST(test_query_serve);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_serve_option(void);
+	void test_query_serve(void);
+};
+#endif
+#endif // SRC_SERVE_H_
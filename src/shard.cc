@@ -0,0 +1,369 @@
+#include <sstream>
+#include <filesystem>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "./global.h"
+#include "./merkle.h"
+#include "./shard.h"
+
+namespace {
+const std::string PARTIAL_MAGIC("DHPART01");
+
+PartialWriter* _writer;
+std::string _key; // entry being walked
+
+template <typename T>
+bool read_value(std::FILE* fp, T& x) {
+	return std::fread(&x, sizeof(x), 1, fp) == 1;
+}
+
+template <typename T>
+bool write_value(std::FILE* fp, const T& x) {
+	return std::fwrite(&x, sizeof(x), 1, fp) == 1;
+}
+
+template <typename S>
+bool read_string(std::FILE* fp, S& s) {
+	std::uint32_t n;
+	if (!read_value(fp, n))
+		return false;
+	s.resize(n);
+	return n == 0 || std::fread(&s[0], 1, n, fp) == n;
+}
+
+template <typename S>
+bool write_string(std::FILE* fp, const S& s) {
+	assert(s.size() <= UINT32_MAX);
+	return write_value(fp, static_cast<std::uint32_t>(s.size())) &&
+		std::fwrite(s.data(), 1, s.size(), fp) == s.size();
+}
+
+// stable across processes and hosts, unlike std::hash
+std::uint64_t get_fnv1a_hash(const std::string& s) {
+	std::uint64_t x = 0xcbf29ce484222325;
+	for (const auto& c : s) {
+		x ^= static_cast<unsigned char>(c);
+		x *= 0x100000001b3;
+	}
+	return x;
+}
+} // namespace
+
+PartialWriter::PartialWriter(void):
+	_fp(nullptr) {
+}
+
+PartialWriter::~PartialWriter(void) {
+	close_partial();
+}
+
+int PartialWriter::open_partial(const std::string& f) {
+	assert(!_fp);
+	_fp = std::fopen(f.c_str(), "wb");
+	if (!_fp)
+		return -errno;
+	return 0;
+}
+
+int PartialWriter::close_partial(void) {
+	if (!_fp)
+		return 0;
+	auto ret = 0;
+	if (std::fflush(_fp) || fsync(fileno(_fp)))
+		ret = -errno;
+	if (std::fclose(_fp) && ret == 0)
+		ret = -errno;
+	_fp = nullptr;
+	return ret;
+}
+
+int PartialWriter::write_header(const PartialHeader& h) {
+	assert(_fp);
+	if (std::fwrite(PARTIAL_MAGIC.data(), 1, PARTIAL_MAGIC.size(), _fp) !=
+		PARTIAL_MAGIC.size() ||
+		!write_value(_fp, h.shard_index) ||
+		!write_value(_fp, h.shard_count) ||
+		!write_string(_fp, h.option) ||
+		!write_string(_fp, h.input) ||
+		!write_string(_fp, h.prefix))
+		return -errno;
+	return 0;
+}
+
+int PartialWriter::write_entry(const PartialEntry& e) {
+	assert(_fp);
+	if (!write_value(_fp, static_cast<std::uint8_t>(e.type)) ||
+		!write_string(_fp, e.key) ||
+		!write_string(_fp, e.path) ||
+		!write_string(_fp, e.data))
+		return -errno;
+	return 0;
+}
+
+PartialReader::PartialReader(void):
+	_fp(nullptr),
+	_header{} {
+}
+
+PartialReader::~PartialReader(void) {
+	close_partial();
+}
+
+int PartialReader::open_partial(const std::string& f) {
+	assert(!_fp);
+	_fp = std::fopen(f.c_str(), "rb");
+	if (!_fp)
+		return -errno;
+	std::string magic(PARTIAL_MAGIC.size(), '\0');
+	auto& h = _header;
+	if (std::fread(&magic[0], 1, magic.size(), _fp) != magic.size() ||
+		magic != PARTIAL_MAGIC ||
+		!read_value(_fp, h.shard_index) ||
+		!read_value(_fp, h.shard_count) ||
+		!read_string(_fp, h.option) ||
+		!read_string(_fp, h.input) ||
+		!read_string(_fp, h.prefix) ||
+		h.shard_index >= h.shard_count) {
+		close_partial();
+		return -EINVAL;
+	}
+	return 0;
+}
+
+void PartialReader::close_partial(void) {
+	if (_fp)
+		std::fclose(_fp);
+	_fp = nullptr;
+}
+
+// returns 1 if read, 0 at the end, or negative errno if truncated
+int PartialReader::read_entry(PartialEntry& e) {
+	assert(_fp);
+	std::uint8_t t;
+	if (!read_value(_fp, t))
+		return std::ferror(_fp) ? -EIO : 0;
+	if (t > static_cast<std::uint8_t>(PartialType::Invalid) ||
+		!read_string(_fp, e.key) ||
+		!read_string(_fp, e.path) ||
+		!read_string(_fp, e.data))
+		return -EINVAL;
+	e.type = static_cast<PartialType>(t);
+	return 1;
+}
+
+// "i/N" with 0 <= i < N
+std::tuple<unsigned long, unsigned long> get_shard(const std::string& s) {
+	auto i = s.find('/');
+	if (i == std::string::npos || i == 0 || i == s.size() - 1 ||
+		s.find_first_not_of("0123456789/") != std::string::npos ||
+		s.find('/', i + 1) != std::string::npos)
+		throw std::invalid_argument("invalid shard");
+	auto x = std::stoul(s.substr(0, i));
+	auto n = std::stoul(s.substr(i + 1));
+	if (x >= n || n > UINT32_MAX)
+		throw std::invalid_argument("invalid shard");
+	return {x, n};
+}
+
+// entries are assigned by their parent directory,
+// f is relative to input prefix
+bool test_shard_entry(const std::string& f, unsigned long i, unsigned long n) {
+	if (n == 0)
+		return true;
+	return get_fnv1a_hash(get_merkle_parent(f)) % n == i;
+}
+
+// partial outputs only merge if all of these match
+std::string get_partial_option_string(void) {
+	std::ostringstream ss;
+	ss << opt.hash_algo
+		<< " " << opt.hash_only
+		<< " " << opt.ignore_dot
+		<< " " << opt.ignore_dot_dir
+		<< " " << opt.ignore_dot_file
+		<< " " << opt.ignore_symlink
+		<< " " << opt.follow_symlink
+		<< " " << opt.abs
+		<< " " << opt.swap
+		<< " " << opt.squash
+		<< " " << opt.dir_digests
+		<< " " << opt.dir_digests_depth
+		<< " " << opt.quick
+		<< " " << opt.quick_blocks
+		<< " " << opt.metadata_only
+		<< " " << opt.newer
+		<< " " << opt.debug;
+	return ss.str();
+}
+
+int partial_init(const std::string& f) {
+	assert(!_writer);
+	_writer = new PartialWriter();
+	auto ret = _writer->open_partial(f);
+	if (ret < 0) {
+		delete _writer;
+		_writer = nullptr;
+	}
+	return ret;
+}
+
+int partial_cleanup(void) {
+	if (!_writer)
+		return 0;
+	auto ret = _writer->close_partial();
+	delete _writer;
+	_writer = nullptr;
+	return ret;
+}
+
+bool is_partial_enabled(void) {
+	return _writer != nullptr;
+}
+
+void put_partial_header(const std::string& f, const std::string& inp) {
+	assert(_writer);
+	auto ret = _writer->write_header({
+		static_cast<std::uint32_t>(opt.shard_index),
+		static_cast<std::uint32_t>(opt.shard_count ?
+			opt.shard_count : 1),
+		get_partial_option_string(), f, inp});
+	if (ret < 0)
+		throw std::runtime_error(std::string("partial: ") +
+			strerror(-ret));
+}
+
+void set_partial_key(const std::string& f) {
+	_key = f;
+}
+
+void add_partial_entry(const PartialType& t, const std::string& f,
+	const std::vector<char>& b) {
+	assert(_writer);
+	auto ret = _writer->write_entry({t, _key, f, b});
+	if (ret < 0)
+		throw std::runtime_error(std::string("partial: ") +
+			strerror(-ret));
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void ShardTest::test_get_shard(void) {
+	const std::vector<std::tuple<std::string, unsigned long,
+		unsigned long>> ok{
+		{"0/1", 0, 1},
+		{"3/4", 3, 4},
+		{"09/10", 9, 10},
+	};
+	for (const auto& [s, i, n] : ok) {
+		const auto [x, y] = get_shard(s);
+		CPPUNIT_ASSERT_EQUAL(x, i);
+		CPPUNIT_ASSERT_EQUAL(y, n);
+	}
+
+	const std::vector<std::string> ng{
+		"",
+		"1",
+		"/1",
+		"1/",
+		"1/1",
+		"2/1",
+		"0/0",
+		"-1/2",
+		"0/1/2",
+		"a/2",
+		"0/99999999999",
+	};
+	for (const auto& s : ng)
+		try {
+			get_shard(s);
+			CPPUNIT_FAIL(s);
+		} catch (const std::invalid_argument& e) {
+		}
+}
+
+void ShardTest::test_test_shard_entry(void) {
+	// every entry belongs to exactly one shard
+	const std::vector<std::string> l{"a", "b", "a/b", "a/c", "a/b/c",
+		"x/y/z"};
+	for (const auto& f : l) {
+		CPPUNIT_ASSERT(test_shard_entry(f, 0, 0));
+		CPPUNIT_ASSERT(test_shard_entry(f, 0, 1));
+		auto n = 0;
+		for (unsigned long i = 0; i < 7; i++)
+			if (test_shard_entry(f, i, 7))
+				n++;
+		CPPUNIT_ASSERT_EQUAL(n, 1);
+	}
+
+	// siblings go to the same shard
+	for (unsigned long i = 0; i < 7; i++) {
+		CPPUNIT_ASSERT_EQUAL(test_shard_entry("a", i, 7),
+			test_shard_entry("b", i, 7));
+		CPPUNIT_ASSERT_EQUAL(test_shard_entry("a/b", i, 7),
+			test_shard_entry("a/c", i, 7));
+	}
+}
+
+void ShardTest::test_read_entry(void) {
+	auto f = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-shard-test." + std::to_string(getpid())));
+	const PartialHeader h{1, 3, "x", "/a/b", "/a"};
+	const std::vector<PartialEntry> l{
+		{PartialType::Text, "b", "", {'1', '\n'}},
+		{PartialType::Squash, "b", "", {'2'}},
+		{PartialType::Entry, "c", "c", {'3'}},
+		{PartialType::Directory, "d", "d", {}},
+		{PartialType::Invalid, "e", "", {'4'}},
+	};
+	{
+		PartialWriter w;
+		CPPUNIT_ASSERT_EQUAL(w.open_partial(f), 0);
+		CPPUNIT_ASSERT_EQUAL(w.write_header(h), 0);
+		for (const auto& e : l)
+			CPPUNIT_ASSERT_EQUAL(w.write_entry(e), 0);
+		CPPUNIT_ASSERT_EQUAL(w.close_partial(), 0);
+	}
+
+	PartialReader r;
+	CPPUNIT_ASSERT_EQUAL(r.open_partial(f), 0);
+	CPPUNIT_ASSERT_EQUAL(r.get_header().shard_index, h.shard_index);
+	CPPUNIT_ASSERT_EQUAL(r.get_header().shard_count, h.shard_count);
+	CPPUNIT_ASSERT_EQUAL(r.get_header().option, h.option);
+	CPPUNIT_ASSERT_EQUAL(r.get_header().input, h.input);
+	CPPUNIT_ASSERT_EQUAL(r.get_header().prefix, h.prefix);
+	PartialEntry e;
+	for (const auto& x : l) {
+		CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+		CPPUNIT_ASSERT(e.type == x.type);
+		CPPUNIT_ASSERT_EQUAL(e.key, x.key);
+		CPPUNIT_ASSERT_EQUAL(e.path, x.path);
+		CPPUNIT_ASSERT(e.data == x.data);
+	}
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 0);
+	r.close_partial();
+
+	// truncated
+	std::filesystem::resize_file(f, std::filesystem::file_size(f) - 1);
+	CPPUNIT_ASSERT_EQUAL(r.open_partial(f), 0);
+	for (std::size_t i = 0; i < l.size() - 1; i++)
+		CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), -EINVAL);
+	r.close_partial();
+
+	// not a partial output
+	std::filesystem::resize_file(f, 4);
+	CPPUNIT_ASSERT_EQUAL(r.open_partial(f), -EINVAL);
+	std::filesystem::remove(f);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ShardTest);
+#endif
@@ -0,0 +1,100 @@
+#ifndef SRC_SHARD_H_
+#define SRC_SHARD_H_
+
+#include <vector>
+#include <string>
+#include <tuple>
+#include <cstdio>
+#include <cstdint>
+
+enum class PartialType {
+	Text, // printed lines
+	Squash, // bytes appended to squash buffer
+	Directory, // directory added to merkle tree
+	Entry, // file added to merkle tree
+	Unsupported, // printed with stat at the end
+	Invalid, // printed with stat at the end
+};
+
+struct PartialEntry {
+	PartialType type;
+	std::string key; // path relative to input prefix, in walk order
+	std::string path; // merkle tree path if any
+	std::vector<char> data;
+};
+
+struct PartialHeader {
+	std::uint32_t shard_index;
+	std::uint32_t shard_count;
+	std::string option; // options affecting output
+	std::string input;
+	std::string prefix;
+};
+
+// Output of one shard in sorted walk order, with per entry printed lines,
+// squash bytes and merkle tree updates, so that partial outputs of all
+// shards merge into the output of a single process.
+class PartialWriter {
+	public:
+	PartialWriter(void);
+	~PartialWriter(void);
+	PartialWriter(const PartialWriter&) = delete;
+	PartialWriter& operator=(const PartialWriter&) = delete;
+	int open_partial(const std::string&);
+	int close_partial(void);
+	int write_header(const PartialHeader&);
+	int write_entry(const PartialEntry&);
+
+	private:
+	std::FILE* _fp;
+};
+
+class PartialReader {
+	public:
+	PartialReader(void);
+	~PartialReader(void);
+	PartialReader(const PartialReader&) = delete;
+	PartialReader& operator=(const PartialReader&) = delete;
+	int open_partial(const std::string&);
+	void close_partial(void);
+	const PartialHeader& get_header(void) const {
+		return _header;
+	}
+	int read_entry(PartialEntry&);
+
+	private:
+	std::FILE* _fp;
+	PartialHeader _header;
+};
+
+std::tuple<unsigned long, unsigned long> get_shard(const std::string&);
+bool test_shard_entry(const std::string&, unsigned long, unsigned long);
+std::string get_partial_option_string(void);
+int partial_init(const std::string&);
+int partial_cleanup(void);
+bool is_partial_enabled(void);
+void put_partial_header(const std::string&, const std::string&);
+void set_partial_key(const std::string&);
+void add_partial_entry(const PartialType&, const std::string&,
+	const std::vector<char>&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class ShardTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(ShardTest);
+	CPPUNIT_TEST(test_get_shard);
+	CPPUNIT_TEST(test_test_shard_entry);
+	CPPUNIT_TEST(test_read_entry);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_shard(void);
+	void test_test_shard_entry(void);
+	void test_read_entry(void);
+};
+#endif
+#endif // SRC_SHARD_H_
@@ -1,8 +1,10 @@
 #ifndef SRC_SQUASH_H_
 #define SRC_SQUASH_H_
 
-#ifdef CONFIG_SQUASH1
+#if defined(CONFIG_SQUASH1)
 #include "./squash1.h"
+#elif defined(CONFIG_SQUASH3)
+#include "./squash3.h"
 #else
 #include "./squash2.h"
 #endif
@@ -1,29 +1,310 @@
+#include <iostream>
 #include <sstream>
-#include <iterator>
+#include <streambuf>
 #include <algorithm>
+#include <queue>
+#include <utility>
+#include <stdexcept>
 
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include "./global.h"
 #include "./hash.h"
 #include "./squash1.h"
+#include "./util.h"
 
 const std::string SQUASH_LABEL("squash");
 const int SQUASH_VERSION = 1;
 
+namespace {
+const unsigned long MIB = 1024 * 1024;
+const std::size_t RUN_CHUNK = 4096; // digests per read from each run
+const std::size_t RUN_FAN_IN = 16; // runs per merge, bounds open files
+const std::ptrdiff_t RADIX_CUTOFF = 32;
+
+void throw_errno(const std::string& msg, int error) {
+	std::ostringstream ss;
+	ss << msg << ": " << strerror(error);
+	throw std::runtime_error(ss.str());
+}
+
+// in-place MSD radix sort (American flag sort) on unsigned bytes,
+// which is the same order as sorting lower case hex strings
+void radix_sort_digest_impl(squash_digest* beg, squash_digest* end,
+	std::size_t depth) {
+	if (end - beg <= RADIX_CUTOFF || depth >= sizeof(squash_digest)) {
+		std::sort(beg, end);
+		return;
+	}
+
+	std::array<std::ptrdiff_t, 256> count{};
+	for (auto* p = beg; p != end; p++)
+		count[(*p)[depth]]++;
+
+	std::array<squash_digest*, 256> head, tail;
+	auto* p = beg;
+	for (auto i = 0; i < 256; i++) {
+		head[i] = p;
+		p += count[i];
+		tail[i] = p;
+	}
+
+	for (auto i = 0; i < 256; i++)
+		while (head[i] != tail[i]) {
+			auto c = (*head[i])[depth];
+			if (c == i)
+				head[i]++;
+			else
+				std::swap(*head[i], *head[c]++);
+		}
+
+	p = beg;
+	for (auto i = 0; i < 256; i++) {
+		radix_sort_digest_impl(p, p + count[i], depth + 1);
+		p += count[i];
+	}
+}
+
+void append_hex(std::vector<char>& v, const squash_digest& x) {
+	static const char hex[] = "0123456789abcdef";
+	for (const auto& c : x) {
+		v.push_back(hex[c >> 4]);
+		v.push_back(hex[c & 0xf]);
+	}
+}
+} // namespace
+
+void radix_sort_digest(squash_digest* beg, squash_digest* end) {
+	radix_sort_digest_impl(beg, end, 0);
+}
+
+// k-way merge of sorted runs from first, and the in-memory buffer if mem
+class SquashMerge {
+	public:
+	SquashMerge(Squash& squ, std::size_t first, bool mem):
+		_squ(squ),
+		_first(first),
+		_chunk(squ._run.size() - first),
+		_pos(_chunk.size(), 0),
+		_mem(0),
+		_heap{} {
+		squ.rewind_run(first);
+		for (std::size_t i = 0; i < _chunk.size(); i++)
+			if (fill_chunk(i))
+				_heap.push({_chunk[i][0], i});
+		if (mem && !squ._buffer.empty()) {
+			radix_sort_digest(squ._buffer.data(),
+				squ._buffer.data() + squ._buffer.size());
+			_heap.push({squ._buffer[0], _chunk.size()});
+		}
+	}
+
+	bool next(squash_digest& x) {
+		if (_heap.empty())
+			return false;
+		auto [d, i] = _heap.top();
+		_heap.pop();
+		x = d;
+		if (i == _chunk.size()) {
+			if (++_mem < _squ._buffer.size())
+				_heap.push({_squ._buffer[_mem], i});
+		} else if (++_pos[i] < _chunk[i].size() || fill_chunk(i)) {
+			_heap.push({_chunk[i][_pos[i]], i});
+		}
+		return true;
+	}
+
+	private:
+	bool fill_chunk(std::size_t i) {
+		auto& v = _chunk[i];
+		auto* fp = _squ._run[_first + i];
+		v.resize(RUN_CHUNK);
+		auto n = std::fread(v.data(), sizeof(squash_digest), v.size(),
+			fp);
+		if (n == 0 && std::ferror(fp))
+			throw_errno("fread", errno);
+		v.resize(n);
+		_pos[i] = 0;
+		return n > 0;
+	}
+
+	typedef std::pair<squash_digest, std::size_t> merge_entry;
+
+	Squash& _squ;
+	std::size_t _first;
+	std::vector<std::vector<squash_digest>> _chunk;
+	std::vector<std::size_t> _pos;
+	std::size_t _mem;
+	std::priority_queue<merge_entry, std::vector<merge_entry>,
+		std::greater<merge_entry>> _heap;
+};
+
+namespace {
+// streams concatenated hex strings of merged digests
+class SquashStreamBuf: public std::streambuf {
+	public:
+	explicit SquashStreamBuf(Squash& squ):
+		_merge(squ, 0, true),
+		_buf{} {
+	}
+
+	protected:
+	int_type underflow(void) override {
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		_buf.clear();
+		squash_digest x;
+		while (_buf.size() < BUF_SIZE && _merge.next(x))
+			append_hex(_buf, x);
+		if (_buf.empty())
+			return traits_type::eof();
+		setg(_buf.data(), _buf.data(), _buf.data() + _buf.size());
+		return traits_type::to_int_type(*gptr());
+	}
+
+	// std::istream::readsome relies on this
+	std::streamsize showmanyc(void) override {
+		if (underflow() == traits_type::eof())
+			return -1;
+		return egptr() - gptr();
+	}
+
+	private:
+	static const std::size_t BUF_SIZE = 65536;
+	SquashMerge _merge;
+	std::vector<char> _buf;
+};
+} // namespace
+
+Squash::Squash(void):
+	Squash(opt.squash_buffer_limit * MIB / sizeof(squash_digest)) {
+}
+
+Squash::Squash(unsigned long limit):
+	_buffer{},
+	_run{},
+	_level{},
+	_num_run(0),
+	_limit(limit) {
+}
+
+Squash::~Squash(void) {
+	init_buffer();
+}
+
+void Squash::init_buffer(void) {
+	_buffer.clear();
+	for (auto* fp : _run)
+		std::fclose(fp);
+	_run.clear();
+	_level.clear();
+	_num_run = 0;
+}
+
 void Squash::update_buffer(const std::vector<char>& bx) {
 	auto [b, _ignore] = get_byte_hash(bx, hash::MD5);
-	_buffer.push_back(b);
+	assert(b.size() == sizeof(squash_digest));
+	squash_digest x;
+	std::memcpy(x.data(), b.data(), x.size());
+	_buffer.push_back(x);
+	if (_limit && _buffer.size() >= _limit)
+		spill_buffer();
 }
 
+// sorted hex strings concatenated
 std::vector<char> Squash::get_buffer(void) {
-	// XXX directly sort vector<vector<char>>
-	std::vector<std::string> s;
-	for (const auto& v : _buffer)
-		s.push_back(get_hex_sum(v));
-	std::sort(s.begin(), s.end());
-	std::ostringstream ss;
-	std::copy(s.begin(), s.end(),
-		std::ostream_iterator<std::string>(ss, ""));
-	auto x = ss.str();
-	return std::vector<char>(x.begin(), x.end());
+	reduce_run();
+	SquashMerge m(*this, 0, true);
+	std::vector<char> v;
+	v.reserve(num_buffer() * sizeof(squash_digest) * 2);
+	squash_digest x;
+	while (m.next(x))
+		append_hex(v, x);
+	return v;
+}
+
+// same as hashing get_buffer() result without materializing it
+hash_res Squash::get_buffer_hash(const std::string& hash_algo) {
+	reduce_run();
+	SquashStreamBuf sb(*this);
+	std::istream is(&sb);
+	return get_stream_hash(is, hash_algo);
+}
+
+void Squash::spill_buffer(void) {
+	radix_sort_digest(_buffer.data(), _buffer.data() + _buffer.size());
+	auto* fp = new_tmpfile();
+	_run.push_back(fp);
+	_level.push_back(0);
+	if (std::fwrite(_buffer.data(), sizeof(squash_digest), _buffer.size(),
+		fp) != _buffer.size())
+		throw_errno("fwrite", errno);
+	_num_run += _buffer.size();
+	_buffer.clear();
+	if (opt.debug)
+		get_output() << "### squash spilled run " << _run.size()
+			<< std::endl;
+
+	// merge in rounds of RUN_FAN_IN runs of the same level, levels are
+	// non-increasing, so about RUN_FAN_IN runs are open per level
+	while (_run.size() >= RUN_FAN_IN) {
+		auto first = _run.size() - RUN_FAN_IN;
+		if (_level[first] != _level.back())
+			break;
+		merge_run(first);
+	}
+}
+
+// replace runs from first by a single merged run
+void Squash::merge_run(std::size_t first) {
+	assert(first < _run.size());
+	auto* fp = new_tmpfile();
+	try {
+		SquashMerge m(*this, first, false);
+		std::vector<squash_digest> v;
+		v.reserve(RUN_CHUNK);
+		squash_digest x;
+		while (true) {
+			auto done = !m.next(x);
+			if (!done)
+				v.push_back(x);
+			if (v.size() == RUN_CHUNK || (done && !v.empty())) {
+				if (std::fwrite(v.data(), sizeof(squash_digest),
+					v.size(), fp) != v.size())
+					throw_errno("fwrite", errno);
+				v.clear();
+			}
+			if (done)
+				break;
+		}
+	} catch (...) {
+		std::fclose(fp);
+		throw;
+	}
+	auto level = _level.back() + 1;
+	for (auto i = first; i < _run.size(); i++)
+		std::fclose(_run[i]);
+	_run.resize(first);
+	_level.resize(first);
+	_run.push_back(fp);
+	_level.push_back(level);
+	if (opt.debug)
+		get_output() << "### squash merged run " << _run.size()
+			<< std::endl;
+}
+
+// final merge reads at most RUN_FAN_IN runs at once
+void Squash::reduce_run(void) {
+	while (_run.size() > RUN_FAN_IN)
+		merge_run(_run.size() - RUN_FAN_IN);
+}
+
+void Squash::rewind_run(std::size_t first) {
+	for (auto i = first; i < _run.size(); i++)
+		if (std::fflush(_run[i]) || std::fseek(_run[i], 0, SEEK_SET))
+			throw_errno("fseek", errno);
 }
 
 #ifdef CONFIG_CPPUNIT
@@ -53,5 +334,68 @@ void SquashTest::test_update_buffer(void) {
 	CPPUNIT_ASSERT(!squash.get_buffer().empty());
 }
 
+void SquashTest::test_radix_sort_digest(void) {
+	std::vector<squash_digest> v;
+	for (auto i = 0; i < 10000; i++) {
+		auto [b, _ignore] = get_string_hash(std::to_string(i),
+			hash::MD5);
+		squash_digest x;
+		std::memcpy(x.data(), b.data(), x.size());
+		v.push_back(x);
+		x[0] = 0xff; // high bit set
+		v.push_back(x);
+	}
+	auto l = v;
+	radix_sort_digest(v.data(), v.data() + v.size());
+	std::vector<std::string> s;
+	for (const auto& x : l)
+		s.push_back(get_hex_sum(std::vector<char>(x.begin(), x.end())));
+	std::sort(s.begin(), s.end());
+	for (std::size_t i = 0; i < v.size(); i++)
+		CPPUNIT_ASSERT_EQUAL(get_hex_sum(std::vector<char>(v[i].begin(),
+			v[i].end())), s[i]);
+}
+
+void SquashTest::test_spill_buffer(void) {
+	Squash squash1(7);
+	Squash squash2(0);
+	for (auto i = 0; i < 100; i++) {
+		auto s = std::to_string(i);
+		squash1.update_buffer(std::vector<char>(s.begin(), s.end()));
+		squash2.update_buffer(std::vector<char>(s.begin(), s.end()));
+	}
+	CPPUNIT_ASSERT_EQUAL(squash1.num_run(), 14lu);
+	CPPUNIT_ASSERT_EQUAL(squash2.num_run(), 0lu);
+	CPPUNIT_ASSERT_EQUAL(squash1.num_buffer(), 100lu);
+	CPPUNIT_ASSERT(squash1.get_buffer() == squash2.get_buffer());
+	// get_buffer is repeatable
+	CPPUNIT_ASSERT(squash1.get_buffer() == squash2.get_buffer());
+
+	auto [b1, n1] = squash1.get_buffer_hash(hash::SHA256);
+	auto [b2, _ignore] = get_byte_hash(squash2.get_buffer(), hash::SHA256);
+	CPPUNIT_ASSERT(b1 == b2);
+	CPPUNIT_ASSERT_EQUAL(n1, 100lu * 32);
+}
+
+void SquashTest::test_merge_run(void) {
+	Squash squash1(3);
+	Squash squash2(0);
+	for (auto i = 0; i < 3000; i++) {
+		auto s = std::to_string(i % 2500); // some duplicates
+		squash1.update_buffer(std::vector<char>(s.begin(), s.end()));
+		squash2.update_buffer(std::vector<char>(s.begin(), s.end()));
+		// 1000 runs merged in rounds, never more than fan-in per level
+		CPPUNIT_ASSERT(squash1.num_run() < 16 * 3);
+	}
+	CPPUNIT_ASSERT_EQUAL(squash1.num_buffer(), 3000lu);
+	CPPUNIT_ASSERT(squash1.get_buffer() == squash2.get_buffer());
+	CPPUNIT_ASSERT(squash1.num_run() <= 16);
+
+	auto [b1, n1] = squash1.get_buffer_hash(hash::SHA256);
+	auto [b2, _ignore] = get_byte_hash(squash2.get_buffer(), hash::SHA256);
+	CPPUNIT_ASSERT(b1 == b2);
+	CPPUNIT_ASSERT_EQUAL(n1, 3000lu * 32);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(SquashTest);
 #endif
@@ -2,26 +2,53 @@
 #define SRC_SQUASH1_H_
 
 #include <vector>
+#include <array>
 #include <string>
 
+#include <cstdio>
+
+#include "./hash.h"
+
 extern const std::string SQUASH_LABEL;
 extern const int SQUASH_VERSION;
 
+// packed MD5 of each entry
+typedef std::array<unsigned char, 16> squash_digest;
+
 class Squash {
 	public:
-	Squash(void):
-		_buffer{} {
-	}
-	void init_buffer(void) {
-		_buffer.clear();
-	}
+	Squash(void);
+	explicit Squash(unsigned long);
+	~Squash(void);
+	Squash(const Squash&) = delete;
+	Squash& operator=(const Squash&) = delete;
+	void init_buffer(void);
 	void update_buffer(const std::vector<char>&);
 	std::vector<char> get_buffer(void);
+	hash_res get_buffer_hash(const std::string&);
+	unsigned long num_buffer(void) const {
+		return _num_run + _buffer.size();
+	}
+	unsigned long num_run(void) const {
+		return _run.size();
+	}
 
 	private:
-	std::vector<std::vector<char>> _buffer;
+	void spill_buffer(void);
+	void merge_run(std::size_t);
+	void reduce_run(void);
+	void rewind_run(std::size_t);
+
+	std::vector<squash_digest> _buffer; // unsorted until spilled
+	std::vector<std::FILE*> _run; // sorted runs in temporary files
+	std::vector<unsigned int> _level; // merge rounds of each run
+	unsigned long _num_run; // number of digests in _run
+	unsigned long _limit; // max number of digests in _buffer
+	friend class SquashMerge;
 };
 
+void radix_sort_digest(squash_digest*, squash_digest*);
+
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestFixture.h>
 #include <cppunit/TestSuite.h>
@@ -32,11 +59,17 @@ class SquashTest: public CPPUNIT_NS::TestFixture {
 	CPPUNIT_TEST_SUITE(SquashTest);
 	CPPUNIT_TEST(test_init_buffer);
 	CPPUNIT_TEST(test_update_buffer);
+	CPPUNIT_TEST(test_radix_sort_digest);
+	CPPUNIT_TEST(test_spill_buffer);
+	CPPUNIT_TEST(test_merge_run);
 	CPPUNIT_TEST_SUITE_END();
 
 	private:
 	void test_init_buffer(void);
 	void test_update_buffer(void);
+	void test_radix_sort_digest(void);
+	void test_spill_buffer(void);
+	void test_merge_run(void);
 };
 #endif
 #endif // SRC_SQUASH1_H_
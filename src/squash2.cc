@@ -17,6 +17,10 @@ std::vector<char> Squash::get_buffer(void) {
 	return _buffer;
 }
 
+hash_res Squash::get_buffer_hash(const std::string& hash_algo) {
+	return get_byte_hash(_buffer, hash_algo);
+}
+
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestAssert.h>
 
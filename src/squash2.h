@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 
+#include "./hash.h"
+
 extern const std::string SQUASH_LABEL;
 extern const int SQUASH_VERSION;
 
@@ -17,6 +19,7 @@ class Squash {
 	}
 	void update_buffer(const std::vector<char>&);
 	std::vector<char> get_buffer(void);
+	hash_res get_buffer_hash(const std::string&);
 
 	private:
 	std::vector<char> _buffer;
@@ -0,0 +1,131 @@
+#include <algorithm>
+
+#include "./hash.h"
+#include "./squash3.h"
+
+const std::string SQUASH_LABEL("squash");
+const int SQUASH_VERSION = 3;
+
+namespace {
+std::array<std::uint16_t, SQUASH_LANE> get_lane(const std::vector<char>& bx) {
+	auto b = get_byte_shake256(bx, SQUASH_LANE * 2);
+	std::array<std::uint16_t, SQUASH_LANE> x;
+	for (std::size_t i = 0; i < x.size(); i++)
+		x[i] = static_cast<std::uint16_t>(
+			static_cast<unsigned char>(b[i * 2]) |
+			static_cast<unsigned char>(b[i * 2 + 1]) << 8);
+	return x;
+}
+} // namespace
+
+// result doesn't depend on append order, and partial results
+// (e.g. per thread or per process) can be merged in constant memory
+void Squash::update_buffer(const std::vector<char>& bx) {
+	auto x = get_lane(bx);
+	for (std::size_t i = 0; i < _buffer.size(); i++)
+		_buffer[i] += x[i];
+	_count++;
+}
+
+void Squash::remove_buffer(const std::vector<char>& bx) {
+	auto x = get_lane(bx);
+	for (std::size_t i = 0; i < _buffer.size(); i++)
+		_buffer[i] -= x[i];
+	_count--;
+}
+
+void Squash::merge_buffer(const Squash& squ) {
+	for (std::size_t i = 0; i < _buffer.size(); i++)
+		_buffer[i] += squ._buffer[i];
+	_count += squ._count;
+}
+
+std::vector<char> Squash::get_buffer(void) {
+	std::vector<char> v;
+	if (_count == 0)
+		return v;
+	for (const auto& x : _buffer) {
+		v.push_back(static_cast<char>(x & 0xff));
+		v.push_back(static_cast<char>(x >> 8));
+	}
+	return v;
+}
+
+hash_res Squash::get_buffer_hash(const std::string& hash_algo) {
+	return get_byte_hash(get_buffer(), hash_algo);
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void SquashTest::test_init_buffer(void) {
+	Squash squash;
+	CPPUNIT_ASSERT(squash.get_buffer().empty());
+}
+
+void SquashTest::test_update_buffer(void) {
+	Squash squash;
+	squash.update_buffer(std::vector<char>{});
+	CPPUNIT_ASSERT(!squash.get_buffer().empty());
+
+	squash.update_buffer(std::vector<char>{});
+	CPPUNIT_ASSERT(!squash.get_buffer().empty());
+
+	std::string s1("xxx");
+	squash.update_buffer(std::vector<char>(s1.begin(), s1.end()));
+	CPPUNIT_ASSERT(!squash.get_buffer().empty());
+
+	std::string s2(123456, 'x');
+	squash.update_buffer(std::vector<char>(s2.begin(), s2.end()));
+	CPPUNIT_ASSERT(!squash.get_buffer().empty());
+}
+
+void SquashTest::test_remove_buffer(void) {
+	std::string s1("xxx");
+	std::string s2("yyy");
+	std::vector<char> v1(s1.begin(), s1.end());
+	std::vector<char> v2(s2.begin(), s2.end());
+
+	Squash squash1;
+	squash1.update_buffer(v1);
+	auto b = squash1.get_buffer();
+
+	squash1.update_buffer(v2);
+	CPPUNIT_ASSERT(squash1.get_buffer() != b);
+	squash1.remove_buffer(v2);
+	CPPUNIT_ASSERT(squash1.get_buffer() == b);
+	squash1.remove_buffer(v1);
+	CPPUNIT_ASSERT(squash1.get_buffer().empty());
+}
+
+void SquashTest::test_merge_buffer(void) {
+	std::vector<std::vector<char>> l;
+	for (auto i = 0; i < 100; i++) {
+		auto s = std::to_string(i);
+		l.push_back(std::vector<char>(s.begin(), s.end()));
+	}
+
+	// order independent
+	Squash squash1;
+	for (const auto& v : l)
+		squash1.update_buffer(v);
+	Squash squash2;
+	for (auto it = l.rbegin(); it != l.rend(); it++)
+		squash2.update_buffer(*it);
+	CPPUNIT_ASSERT(squash1.get_buffer() == squash2.get_buffer());
+
+	// merge partial results
+	Squash squash3, squash4;
+	for (std::size_t i = 0; i < l.size(); i++)
+		if (i % 3)
+			squash3.update_buffer(l[i]);
+		else
+			squash4.update_buffer(l[i]);
+	squash3.merge_buffer(squash4);
+	CPPUNIT_ASSERT(squash1.get_buffer() == squash3.get_buffer());
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SquashTest);
+#endif
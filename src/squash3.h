@@ -0,0 +1,59 @@
+#ifndef SRC_SQUASH3_H_
+#define SRC_SQUASH3_H_
+
+#include <vector>
+#include <array>
+#include <string>
+#include <cstdint>
+
+#include "./hash.h"
+
+extern const std::string SQUASH_LABEL;
+extern const int SQUASH_VERSION;
+
+// LtHash16, 1024 lanes of 16 bit integers
+const std::size_t SQUASH_LANE = 1024;
+
+class Squash {
+	public:
+	Squash(void):
+		_buffer{},
+		_count(0) {
+	}
+	void init_buffer(void) {
+		_buffer.fill(0);
+		_count = 0;
+	}
+	void update_buffer(const std::vector<char>&);
+	void remove_buffer(const std::vector<char>&);
+	void merge_buffer(const Squash&);
+	std::vector<char> get_buffer(void);
+	hash_res get_buffer_hash(const std::string&);
+
+	private:
+	std::array<std::uint16_t, SQUASH_LANE> _buffer;
+	long _count; // number of entries, could be negative while merging
+};
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class SquashTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(SquashTest);
+	CPPUNIT_TEST(test_init_buffer);
+	CPPUNIT_TEST(test_update_buffer);
+	CPPUNIT_TEST(test_remove_buffer);
+	CPPUNIT_TEST(test_merge_buffer);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_init_buffer(void);
+	void test_update_buffer(void);
+	void test_remove_buffer(void);
+	void test_merge_buffer(void);
+};
+#endif
+#endif // SRC_SQUASH3_H_
@@ -15,6 +15,8 @@ Stat::Stat(void):
 	_stat_unsupported{},
 	_stat_invalid{},
 	_stat_ignored{},
+	_stat_type{},
+	_stat_skipped(0),
 	_written_directory(0),
 	_written_regular(0),
 	_written_device(0),
@@ -29,6 +31,8 @@ void Stat::init_stat(void) {
 	_stat_unsupported.clear();
 	_stat_invalid.clear();
 	_stat_ignored.clear();
+	_stat_type.clear();
+	_stat_skipped = 0;
 
 	_written_directory = 0;
 	_written_regular = 0;
@@ -42,22 +46,27 @@ void Stat::print_stat(const std::vector<std::string>& l, const std::string& msg,
 		return;
 	print_num_format_string(l.size(), msg);
 
-	for (const auto& v : l) {
-		auto f = get_real_path(v, inp);
-		auto t1 = get_raw_file_type(v);
-		auto t2 = get_file_type(v);
-		assert(t2 != FileType::Symlink); // symlink chains resolved
-		if (t1 == FileType::Symlink) {
-			assert(opt::ignore_symlink || t2 == FileType::Dir ||
-				t2 == FileType::Invalid);
-			std::cout << f << " (" << get_file_type_string(t1)
-				<< " -> " << get_file_type_string(t2) << ")"
-				<< std::endl;
-		} else {
-			assert(t2 != FileType::Dir);
-			std::cout << f << " (" << get_file_type_string(t1)
-				<< ")" << std::endl;
-		}
+	for (const auto& v : l)
+		get_output() << get_stat_string(v, inp) << std::endl;
+}
+
+std::string Stat::get_stat_string(const std::string& v,
+	const std::string& inp) const {
+	auto f = get_real_path(v, inp);
+	auto it = _stat_type.find(v);
+	if (it != _stat_type.end())
+		return f + " (" + get_file_type_string(it->second) + ")";
+	auto t1 = get_raw_file_type(v);
+	auto t2 = get_file_type(v);
+	assert(t2 != FileType::Symlink); // symlink chains resolved
+	if (t1 == FileType::Symlink) {
+		assert(opt.ignore_symlink || t2 == FileType::Dir ||
+			t2 == FileType::Invalid);
+		return f + " (" + get_file_type_string(t1) + " -> " +
+			get_file_type_string(t2) + ")";
+	} else {
+		assert(t2 != FileType::Dir);
+		return f + " (" + get_file_type_string(t1) + ")";
 	}
 }
 
@@ -116,5 +125,18 @@ void StatTest::test_append_written_regular(void) {
 	CPPUNIT_ASSERT_EQUAL(stat.num_written_regular(), 0lu);
 }
 
+void StatTest::test_append_stat_skipped(void) {
+	Stat stat;
+	stat.append_stat_skipped();
+	stat.append_stat_skipped();
+	CPPUNIT_ASSERT_EQUAL(stat.num_stat_skipped(), 2lu);
+
+	// not counted as hashed
+	CPPUNIT_ASSERT_EQUAL(stat.num_stat_total(), 0lu);
+
+	stat.init_stat();
+	CPPUNIT_ASSERT_EQUAL(stat.num_stat_skipped(), 0lu);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(StatTest);
 #endif
@@ -2,6 +2,7 @@
 #define SRC_STAT_H_
 
 #include <vector>
+#include <unordered_map>
 #include <string>
 
 #include "./util.h"
@@ -34,9 +35,18 @@ class Stat {
 	unsigned long num_stat_invalid(void) const {
 		return static_cast<unsigned long>(_stat_invalid.size());
 	}
+	const std::vector<std::string>& get_stat_unsupported(void) const {
+		return _stat_unsupported;
+	}
+	const std::vector<std::string>& get_stat_invalid(void) const {
+		return _stat_invalid;
+	}
 	unsigned long num_stat_ignored(void) const {
 		return static_cast<unsigned long>(_stat_ignored.size());
 	}
+	unsigned long num_stat_skipped(void) const {
+		return _stat_skipped;
+	}
 
 	// append stat
 	void append_stat_total(void) {
@@ -62,6 +72,13 @@ class Stat {
 	void append_stat_ignored(const std::string& f) {
 		_stat_ignored.push_back(f);
 	}
+	void append_stat_skipped(void) {
+		_stat_skipped++;
+	}
+	// type of entry not on file system, e.g. tar member
+	void set_stat_type(const std::string& f, const FileType& t) {
+		_stat_type[f] = t;
+	}
 
 	// print stat
 	void print_stat_directory(const std::string& inp) const {
@@ -91,8 +108,16 @@ class Stat {
 	void print_stat_ignored(const std::string& inp) const {
 		print_stat(_stat_ignored, "ignored file", inp);
 	}
+	void print_stat_skipped(void) const {
+		// may be most files, hence count only
+		if (_stat_skipped)
+			print_num_format_string(num_stat_skipped(),
+				"skipped file");
+	}
 	void print_stat(const std::vector<std::string>&, const std::string&,
 		const std::string&) const;
+	std::string get_stat_string(const std::string&,
+		const std::string&) const;
 
 	// num written
 	unsigned long num_written_total(void) const {
@@ -136,6 +161,8 @@ class Stat {
 	std::vector<std::string> _stat_unsupported;
 	std::vector<std::string> _stat_invalid;
 	std::vector<std::string> _stat_ignored;
+	std::unordered_map<std::string, FileType> _stat_type;
+	unsigned long _stat_skipped; // not modified since --newer
 	unsigned long _written_directory; // hashed
 	unsigned long _written_regular; // hashed
 	unsigned long _written_device; // hashed
@@ -154,6 +181,7 @@ class StatTest: public CPPUNIT_NS::TestFixture {
 	CPPUNIT_TEST(test_append_stat_regular);
 	CPPUNIT_TEST(test_num_written_regular);
 	CPPUNIT_TEST(test_append_written_regular);
+	CPPUNIT_TEST(test_append_stat_skipped);
 	CPPUNIT_TEST_SUITE_END();
 
 	private:
@@ -161,6 +189,7 @@ class StatTest: public CPPUNIT_NS::TestFixture {
 	void test_append_stat_regular(void);
 	void test_num_written_regular(void);
 	void test_append_written_regular(void);
+	void test_append_stat_skipped(void);
 };
 #endif
 #endif // SRC_STAT_H_
@@ -0,0 +1,582 @@
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <stdexcept>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <csignal>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "./global.h"
+#include "./sync.h"
+#include "./util.h"
+
+namespace {
+const std::string SYNC_MAGIC("DHSYNC02");
+const std::size_t SYNC_BUFFER_SIZE = 65536;
+const std::size_t SYNC_UNREADABLE_SIZE = 32;
+
+std::string get_sync_path(const std::string& d, const std::string& name) {
+	return d == "." ? name : d + "/" + name;
+}
+
+std::vector<SyncChild> get_sync_child(Merkle& mer, const std::string& d) {
+	std::vector<SyncChild> l;
+	mer.read_child(d, [&](const std::string& name, bool dir,
+		const std::vector<char>& b) {
+		l.push_back({name, dir, b});
+	});
+	return l;
+}
+
+// all files under local directory d
+void get_sync_file(Merkle& mer, const std::string& d,
+	std::vector<std::string>& l) {
+	for (const auto& c : get_sync_child(mer, d)) {
+		auto f = get_sync_path(d, c.name);
+		if (c.dir)
+			get_sync_file(mer, f, l);
+		else
+			l.push_back(f);
+	}
+}
+} // namespace
+
+SyncChannel::SyncChannel(int rfd, int wfd):
+	_rfd(rfd),
+	_wfd(wfd),
+	_rbuf{},
+	_roff(0),
+	_wbuf{},
+	_sent(0),
+	_received(0) {
+}
+
+void SyncChannel::put_varint(std::uint64_t x) {
+	while (x >= 0x80) {
+		_wbuf.push_back(static_cast<char>(x | 0x80));
+		x >>= 7;
+	}
+	_wbuf.push_back(static_cast<char>(x));
+}
+
+void SyncChannel::put_string(const std::string& s) {
+	put_varint(s.size());
+	_wbuf.insert(_wbuf.end(), s.begin(), s.end());
+}
+
+void SyncChannel::put_byte(const std::vector<char>& b) {
+	put_varint(b.size());
+	_wbuf.insert(_wbuf.end(), b.begin(), b.end());
+}
+
+void SyncChannel::flush(void) {
+	std::size_t i = 0;
+	while (i < _wbuf.size()) {
+		auto n = write(_wfd, _wbuf.data() + i, _wbuf.size() - i);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("sync: ") +
+				strerror(errno));
+		}
+		i += static_cast<std::size_t>(n);
+	}
+	_sent += _wbuf.size();
+	_wbuf.clear();
+}
+
+void SyncChannel::fill(void) {
+	_rbuf.erase(_rbuf.begin(), _rbuf.begin() +
+		static_cast<std::ptrdiff_t>(_roff));
+	_roff = 0;
+	auto siz = _rbuf.size();
+	_rbuf.resize(siz + SYNC_BUFFER_SIZE);
+	ssize_t n;
+	do {
+		n = read(_rfd, _rbuf.data() + siz, SYNC_BUFFER_SIZE);
+	} while (n == -1 && errno == EINTR);
+	if (n == -1)
+		throw std::runtime_error(std::string("sync: ") +
+			strerror(errno));
+	else if (n == 0)
+		throw std::runtime_error("sync: Unexpected end of stream");
+	_rbuf.resize(siz + static_cast<std::size_t>(n));
+	_received += static_cast<unsigned long>(n);
+}
+
+std::uint64_t SyncChannel::get_varint(void) {
+	std::uint64_t x = 0;
+	for (auto shift = 0; shift < 64; shift += 7) {
+		if (_roff == _rbuf.size())
+			fill();
+		auto c = static_cast<unsigned char>(_rbuf[_roff++]);
+		x |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return x;
+	}
+	throw std::runtime_error("sync: Invalid varint");
+}
+
+std::string SyncChannel::get_string(void) {
+	auto v = get_byte();
+	return std::string(v.begin(), v.end());
+}
+
+std::vector<char> SyncChannel::get_byte(void) {
+	auto n = get_varint();
+	while (_rbuf.size() - _roff < n)
+		fill();
+	auto p = _rbuf.begin() + static_cast<std::ptrdiff_t>(_roff);
+	std::vector<char> b(p, p + static_cast<std::ptrdiff_t>(n));
+	_roff += n;
+	return b;
+}
+
+// give entries left without digest a random one, so that an unreadable file
+// is Modified even if unreadable on the other side too
+void set_unreadable_digest(std::vector<DiffEntry>& l) {
+	std::mt19937_64 rand{std::random_device{}()};
+	for (auto& e : l) {
+		if (!e.digest.empty())
+			continue;
+		e.digest.resize(SYNC_UNREADABLE_SIZE);
+		for (auto& c : e.digest)
+			c = static_cast<char>(rand());
+	}
+}
+
+// per directory digests of regular files and symlinks under d,
+// unreadable files never match
+int get_sync_tree(const std::string& d, Merkle& mer) {
+	std::vector<DiffEntry> l;
+	auto ret = get_tree_entry(d, l);
+	if (ret < 0)
+		return ret;
+
+	std::atomic<std::size_t> next_job(0);
+	auto worker = [&](void) {
+		while (true) {
+			auto i = next_job++;
+			if (i >= l.size())
+				break;
+			try {
+				get_diff_digest(l[i]);
+			} catch (const std::exception& ex) {
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (unsigned long i = 0; i < opt.jobs; i++)
+		threads.push_back(new_thread(worker));
+	for (auto& t : threads)
+		t.join();
+	set_unreadable_digest(l);
+
+	mer.update_directory(".");
+	for (const auto& e : l)
+		mer.update_entry(e.path, e.digest);
+	return 0;
+}
+
+// compare children of the same directory on both sides, both sorted by name,
+// entries present in both with differing digest or type are Modified
+std::vector<DiffResult> merge_sync_child(const std::vector<SyncChild>& a,
+	const std::vector<SyncChild>& b) {
+	std::vector<DiffResult> l;
+	std::size_t i = 0, j = 0;
+	while (i < a.size() || j < b.size()) {
+		if (j == b.size() || (i < a.size() && a[i].name < b[j].name)) {
+			l.push_back({a[i].name, DiffStatus::Removed, i, 0});
+			i++;
+		} else if (i == a.size() || b[j].name < a[i].name) {
+			l.push_back({b[j].name, DiffStatus::Added, 0, j});
+			j++;
+		} else {
+			auto s = a[i].dir == b[j].dir &&
+				a[i].digest == b[j].digest ?
+				DiffStatus::Same : DiffStatus::Modified;
+			l.push_back({a[i].name, s, i, j});
+			i++;
+			j++;
+		}
+	}
+	return l;
+}
+
+// answer directory listings until client is done
+int serve_sync(SyncChannel& ch, Merkle& mer) {
+	ch.put_string(SYNC_MAGIC);
+	ch.put_string(""); // no error
+	ch.put_string(opt.hash_algo);
+	ch.put_byte(mer.get_digest("."));
+	ch.flush();
+
+	while (true) {
+		// read whole request before responding
+		auto n = ch.get_varint();
+		if (n == 0)
+			break;
+		std::vector<std::string> req;
+		for (std::uint64_t i = 0; i < n; i++)
+			req.push_back(ch.get_string());
+		for (const auto& d : req) {
+			auto l = get_sync_child(mer, d);
+			ch.put_varint(l.size());
+			for (const auto& c : l) {
+				ch.put_varint(c.dir);
+				ch.put_string(c.name);
+				ch.put_byte(c.digest);
+			}
+		}
+		ch.flush();
+	}
+	return 0;
+}
+
+// tell client why there is no tree to serve, as stdout belongs to it
+void refuse_sync(SyncChannel& ch, const std::string& error) {
+	assert(!error.empty());
+	ch.put_string(SYNC_MAGIC);
+	ch.put_string(error);
+	ch.flush();
+}
+
+// descend top-down into directories whose digests differ, one round trip
+// per tree level, returns number of round trips
+int query_sync(SyncChannel& ch, Merkle& mer, std::vector<DiffResult>& l) {
+	if (ch.get_string() != SYNC_MAGIC) {
+		std::cout << "Invalid sync peer" << std::endl;
+		return -EPROTO;
+	}
+	auto error = ch.get_string();
+	if (!error.empty()) {
+		std::cout << "sync: " << error << std::endl;
+		return -EIO;
+	}
+	auto hash_algo = ch.get_string();
+	if (hash_algo != opt.hash_algo) {
+		std::cout << "Sync peer uses hash algorithm " << hash_algo
+			<< std::endl;
+		return -EINVAL;
+	}
+
+	std::vector<std::string> level;
+	if (ch.get_byte() != mer.get_digest("."))
+		level.push_back(".");
+
+	auto n = 0;
+	while (!level.empty()) {
+		ch.put_varint(level.size());
+		for (const auto& d : level)
+			ch.put_string(d);
+		ch.flush();
+		n++;
+
+		std::vector<std::string> next;
+		for (const auto& d : level) {
+			std::vector<SyncChild> b(ch.get_varint());
+			for (auto& c : b) {
+				c.dir = ch.get_varint() != 0;
+				c.name = ch.get_string();
+				c.digest = ch.get_byte();
+			}
+			// empty unless local directory
+			auto a = get_sync_child(mer, d);
+
+			for (const auto& r : merge_sync_child(a, b)) {
+				auto f = get_sync_path(d, r.path);
+				std::vector<std::string> removed;
+				switch (r.status) {
+				case DiffStatus::Removed:
+					if (a[r.a].dir)
+						get_sync_file(mer, f, removed);
+					else
+						removed.push_back(f);
+					break;
+				case DiffStatus::Added:
+					if (b[r.b].dir)
+						next.push_back(f);
+					else
+						l.push_back({f, r.status, 0, 0});
+					break;
+				case DiffStatus::Modified:
+					if (a[r.a].dir && b[r.b].dir) {
+						next.push_back(f);
+					} else if (a[r.a].dir) {
+						get_sync_file(mer, f, removed);
+						l.push_back({f, DiffStatus::Added,
+							0, 0});
+					} else if (b[r.b].dir) {
+						removed.push_back(f);
+						next.push_back(f);
+					} else {
+						l.push_back({f, r.status, 0, 0});
+					}
+					break;
+				default:
+					break;
+				}
+				for (const auto& x : removed)
+					l.push_back({x, DiffStatus::Removed, 0, 0});
+			}
+		}
+		level = next;
+	}
+	ch.put_varint(0);
+	ch.flush();
+
+	std::sort(l.begin(), l.end(), [](const DiffResult& x,
+		const DiffResult& y) {
+		return x.path < y.path;
+	});
+	return n;
+}
+
+int sync_server(const std::string& f) {
+	Merkle mer;
+	auto ret = get_sync_tree(f, mer);
+	SyncChannel ch(0, 1);
+	try {
+		if (ret < 0) {
+			refuse_sync(ch, f + ": " + strerror(-ret));
+			return ret;
+		}
+		return serve_sync(ch, mer);
+	} catch (const std::runtime_error& e) {
+		return -EIO;
+	}
+}
+
+// run server command with its stdin and stdout connected to a socketpair,
+// and print files added, removed or modified from f to server side,
+// returns number of differences found
+int sync_client(const std::string& cmd, const std::string& f) {
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+		return -errno;
+	std::cout.flush();
+	auto pid = fork();
+	if (pid == -1) {
+		auto error = errno;
+		close(sv[0]);
+		close(sv[1]);
+		return -error;
+	} else if (pid == 0) {
+		dup2(sv[1], 0);
+		dup2(sv[1], 1);
+		execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr);
+		_exit(127);
+	}
+	close(sv[1]);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	// build local tree while server builds its own
+	Merkle mer;
+	std::vector<DiffResult> l;
+	auto ret = get_sync_tree(f, mer);
+	if (ret == 0) {
+		SyncChannel ch(sv[0], sv[0]);
+		try {
+			ret = query_sync(ch, mer, l);
+		} catch (const std::runtime_error& e) {
+			std::cout << e.what() << std::endl;
+			ret = -EIO;
+		}
+		if (ret >= 0 && opt.verbose) {
+			print_num_format_string(static_cast<unsigned long>(ret),
+				"round trip");
+			print_num_format_string(ch.num_sent(), "sent byte");
+			print_num_format_string(ch.num_received(),
+				"received byte");
+		}
+	}
+	close(sv[0]);
+	int status;
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	if (ret < 0)
+		return ret;
+
+	unsigned long num_added = 0, num_removed = 0, num_modified = 0;
+	for (const auto& x : l) {
+		if (x.status == DiffStatus::Added)
+			num_added++;
+		else if (x.status == DiffStatus::Removed)
+			num_removed++;
+		else if (x.status == DiffStatus::Modified)
+			num_modified++;
+		std::cout << x.path << ": " << get_diff_status_string(x.status)
+			<< std::endl;
+	}
+	if (num_added)
+		print_num_format_string(num_added, "added file");
+	if (num_removed)
+		print_num_format_string(num_removed, "removed file");
+	if (num_modified)
+		print_num_format_string(num_modified, "modified file");
+	return static_cast<int>(l.size());
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void SyncTest::test_get_varint(void) {
+	int sv[2];
+	CPPUNIT_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	SyncChannel a(sv[0], sv[0]), b(sv[1], sv[1]);
+	const std::vector<std::uint64_t> l{0, 1, 0x7f, 0x80, 0x3fff, 0x4000,
+		UINT64_MAX};
+	for (const auto& x : l)
+		a.put_varint(x);
+	a.put_string("xxx");
+	a.put_byte({});
+	a.flush();
+	for (const auto& x : l)
+		CPPUNIT_ASSERT_EQUAL(b.get_varint(), x);
+	CPPUNIT_ASSERT_EQUAL(b.get_string(), std::string("xxx"));
+	CPPUNIT_ASSERT(b.get_byte().empty());
+	CPPUNIT_ASSERT_EQUAL(a.num_sent(), b.num_received());
+
+	// peer closed
+	close(sv[0]);
+	try {
+		b.get_varint();
+		CPPUNIT_FAIL("");
+	} catch (const std::runtime_error& e) {
+	}
+	close(sv[1]);
+}
+
+void SyncTest::test_merge_sync_child(void) {
+	std::vector<char> d1{'1'}, d2{'2'};
+	std::vector<SyncChild> a{
+		{"a", false, d1},
+		{"b", false, d1},
+		{"c", true, d1},
+		{"d", false, d1},
+		{"e", true, d1},
+	};
+	std::vector<SyncChild> b{
+		{"0", false, d1},
+		{"a", false, d1},
+		{"b", false, d2},
+		{"c", true, d2},
+		{"d", true, d1},
+	};
+	const std::vector<std::pair<std::string, DiffStatus>> x{
+		{"0", DiffStatus::Added},
+		{"a", DiffStatus::Same},
+		{"b", DiffStatus::Modified},
+		{"c", DiffStatus::Modified}, // descend
+		{"d", DiffStatus::Modified}, // type differs
+		{"e", DiffStatus::Removed},
+	};
+	auto l = merge_sync_child(a, b);
+	CPPUNIT_ASSERT_EQUAL(l.size(), x.size());
+	for (std::size_t i = 0; i < l.size(); i++) {
+		CPPUNIT_ASSERT_EQUAL(l[i].path, x[i].first);
+		CPPUNIT_ASSERT(l[i].status == x[i].second);
+	}
+	CPPUNIT_ASSERT(merge_sync_child({}, {}).empty());
+}
+
+void SyncTest::test_query_sync(void) {
+	std::vector<char> d1{'1'}, d2{'2'};
+	Merkle a, b;
+	for (auto* m : {&a, &b}) {
+		m->update_directory(".");
+		for (const auto& f : {"x/y/z/0", "x/y/z/1", "x/y/2", "x/3",
+			"4"})
+			m->update_entry(f, d1);
+	}
+
+	auto query = [&](std::vector<DiffResult>& l) {
+		int sv[2];
+		CPPUNIT_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+		SyncChannel x(sv[0], sv[0]), y(sv[1], sv[1]);
+		auto t = new_thread([&](void) {
+			serve_sync(y, b);
+		});
+		auto n = query_sync(x, a, l);
+		t.join();
+		close(sv[0]);
+		close(sv[1]);
+		return n;
+	};
+
+	// same, no round trip
+	std::vector<DiffResult> l;
+	CPPUNIT_ASSERT_EQUAL(query(l), 0);
+	CPPUNIT_ASSERT(l.empty());
+
+	// one round trip per level down to modified file
+	b.update_entry("x/y/z/1", d2);
+	CPPUNIT_ASSERT_EQUAL(query(l), 4);
+	CPPUNIT_ASSERT_EQUAL(l.size(), 1lu);
+	CPPUNIT_ASSERT_EQUAL(l[0].path, std::string("x/y/z/1"));
+	CPPUNIT_ASSERT(l[0].status == DiffStatus::Modified);
+
+	// unreadable on both sides
+	std::vector<DiffEntry> ua{
+		{"x/y/2", "", FileType::Reg, 0, false, {}},
+		{"4", "", FileType::Reg, 0, false, d1},
+	};
+	auto ub = ua;
+	set_unreadable_digest(ua);
+	set_unreadable_digest(ub);
+	CPPUNIT_ASSERT(ua[0].digest != ub[0].digest);
+	CPPUNIT_ASSERT(ua[1].digest == d1);
+	a.update_entry(ua[0].path, ua[0].digest);
+	b.update_entry(ub[0].path, ub[0].digest);
+	l.clear();
+	CPPUNIT_ASSERT_EQUAL(query(l), 4);
+	CPPUNIT_ASSERT_EQUAL(l.size(), 2lu);
+	CPPUNIT_ASSERT_EQUAL(l[0].path, std::string("x/y/2"));
+	CPPUNIT_ASSERT(l[0].status == DiffStatus::Modified);
+	a.update_entry(ua[0].path, d1);
+	b.update_entry(ub[0].path, d1);
+
+	// added subtree, removed file, file replaced by directory
+	b.update_entry("n/m/5", d1);
+	b.remove_entry("x/3");
+	b.remove_entry("4");
+	b.update_entry("4/6", d1);
+	l.clear();
+	query(l);
+	const std::vector<std::pair<std::string, DiffStatus>> x{
+		{"4", DiffStatus::Removed},
+		{"4/6", DiffStatus::Added},
+		{"n/m/5", DiffStatus::Added},
+		{"x/3", DiffStatus::Removed},
+		{"x/y/z/1", DiffStatus::Modified},
+	};
+	CPPUNIT_ASSERT_EQUAL(l.size(), x.size());
+	for (std::size_t i = 0; i < l.size(); i++) {
+		CPPUNIT_ASSERT_EQUAL(l[i].path, x[i].first);
+		CPPUNIT_ASSERT(l[i].status == x[i].second);
+	}
+
+	// directory replaced by file
+	b.remove_entry("x");
+	b.update_entry("x", d1);
+	l.clear();
+	query(l);
+	CPPUNIT_ASSERT_EQUAL(l.size(), 8lu);
+	CPPUNIT_ASSERT_EQUAL(l[3].path, std::string("x"));
+	CPPUNIT_ASSERT(l[3].status == DiffStatus::Added);
+	CPPUNIT_ASSERT(l[4].status == DiffStatus::Removed);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(SyncTest);
+#endif
@@ -0,0 +1,77 @@
+#ifndef SRC_SYNC_H_
+#define SRC_SYNC_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "./diff.h"
+#include "./merkle.h"
+
+struct SyncChild {
+	std::string name;
+	bool dir;
+	std::vector<char> digest;
+};
+
+// Buffered length prefixed messages over a pair of file descriptors,
+// e.g. stdin and stdout of ssh(1), or a socketpair(2).
+class SyncChannel {
+	public:
+	SyncChannel(int, int);
+	void put_varint(std::uint64_t);
+	void put_string(const std::string&);
+	void put_byte(const std::vector<char>&);
+	void flush(void);
+	std::uint64_t get_varint(void);
+	std::string get_string(void);
+	std::vector<char> get_byte(void);
+	unsigned long num_sent(void) const {
+		return _sent;
+	}
+	unsigned long num_received(void) const {
+		return _received;
+	}
+
+	private:
+	void fill(void);
+
+	int _rfd;
+	int _wfd;
+	std::vector<char> _rbuf;
+	std::size_t _roff;
+	std::vector<char> _wbuf;
+	unsigned long _sent;
+	unsigned long _received;
+};
+
+void set_unreadable_digest(std::vector<DiffEntry>&);
+int get_sync_tree(const std::string&, Merkle&);
+std::vector<DiffResult> merge_sync_child(const std::vector<SyncChild>&,
+	const std::vector<SyncChild>&);
+int serve_sync(SyncChannel&, Merkle&);
+void refuse_sync(SyncChannel&, const std::string&);
+int query_sync(SyncChannel&, Merkle&, std::vector<DiffResult>&);
+int sync_server(const std::string&);
+int sync_client(const std::string&, const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class SyncTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(SyncTest);
+	CPPUNIT_TEST(test_get_varint);
+	CPPUNIT_TEST(test_merge_sync_child);
+	CPPUNIT_TEST(test_query_sync);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_varint(void);
+	void test_merge_sync_child(void);
+	void test_query_sync(void);
+};
+#endif
+#endif // SRC_SYNC_H_
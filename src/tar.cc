@@ -0,0 +1,870 @@
+#include <istream>
+#include <streambuf>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef CONFIG_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#include "./tar.h"
+
+namespace {
+const std::size_t TAR_BLOCK_SIZE = 512;
+const std::size_t TAR_BUF_SIZE = 65536;
+const std::uint64_t TAR_STRING_LIMIT = 1 << 24; // long name or pax header
+
+// header field offsets and sizes
+const std::size_t TAR_NAME = 0;
+const std::size_t TAR_SIZE = 124;
+const std::size_t TAR_MTIME = 136;
+const std::size_t TAR_CHKSUM = 148;
+const std::size_t TAR_TYPEFLAG = 156;
+const std::size_t TAR_LINKNAME = 157;
+const std::size_t TAR_MAGIC = 257;
+const std::size_t TAR_PREFIX = 345;
+
+std::string get_field_string(const char* p, std::size_t n) {
+	return std::string(p, strnlen(p, n));
+}
+
+bool is_zero_block(const char* h) {
+	return std::all_of(h, h + TAR_BLOCK_SIZE, [](char c) {
+		return c == '\0';
+	});
+}
+
+// either unsigned or signed sum is accepted, as old tar(1)s used both
+bool test_checksum(const char* h) {
+	std::uint64_t x;
+	if (get_tar_number(h + TAR_CHKSUM, 8, x) < 0)
+		return false;
+	long u = 0, s = 0;
+	for (std::size_t i = 0; i < TAR_BLOCK_SIZE; i++) {
+		auto c = i >= TAR_CHKSUM && i < TAR_CHKSUM + 8 ? ' ' : h[i];
+		u += static_cast<unsigned char>(c);
+		s += static_cast<signed char>(c);
+	}
+	return static_cast<long>(x) == u || static_cast<long>(x) == s;
+}
+
+// "seconds[.fraction]" in pax mtime
+int get_pax_mtime_ns(const std::string& s, std::int64_t& x) {
+	auto i = s.find('.');
+	auto a = s.substr(0, i);
+	auto b = i == std::string::npos ? "" : s.substr(i + 1);
+	if (a.empty() || a.find_first_not_of("-0123456789") !=
+		std::string::npos ||
+		b.find_first_not_of("0123456789") != std::string::npos)
+		return -EINVAL;
+	try {
+		auto sec = std::stoll(a);
+		b = (b + "000000000").substr(0, 9);
+		auto nsec = std::stoll(b);
+		x = sec * 1000000000 + (a.starts_with("-") ? -nsec : nsec);
+	} catch (const std::exception& e) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+std::uint64_t get_pad_size(std::uint64_t n) {
+	return (TAR_BLOCK_SIZE - n % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+// contents of current entry as std::istream for get_stream_hash,
+// read error ends the stream and is kept for the caller
+class TarDataBuf: public std::streambuf {
+	public:
+	explicit TarDataBuf(TarReader& r):
+		_r(r),
+		_buf(TAR_BUF_SIZE),
+		_err(0) {
+	}
+
+	int get_error(void) const {
+		return _err;
+	}
+
+	protected:
+	int_type underflow(void) override {
+		if (_err < 0)
+			return traits_type::eof();
+		auto n = _r.read_data(_buf.data(), _buf.size());
+		if (n < 0) {
+			_err = static_cast<int>(n);
+			return traits_type::eof();
+		}
+		if (n == 0)
+			return traits_type::eof();
+		setg(_buf.data(), _buf.data(), _buf.data() + n);
+		return traits_type::to_int_type(*gptr());
+	}
+
+	// std::istream::readsome only reads what this says is available
+	std::streamsize showmanyc(void) override {
+		auto n = _r.get_data_left();
+		if (n == 0)
+			return -1;
+		return static_cast<std::streamsize>(std::min(n,
+			static_cast<std::uint64_t>(TAR_BUF_SIZE)));
+	}
+
+	private:
+	TarReader& _r;
+	std::vector<char> _buf;
+	int _err;
+};
+} // namespace
+
+TarReader::TarReader(void):
+	_fd(-1),
+	_comp(TarCompression::None),
+	_ctx(nullptr),
+	_ioff(0),
+	_ilen(0),
+	_ieof(false),
+	_left(0),
+	_pad(0),
+	_end(false) {
+}
+
+TarReader::~TarReader(void) {
+	close_tar();
+}
+
+int TarReader::open_tar(const std::string& f) {
+	assert(_fd == -1);
+	_fd = open(f.c_str(), O_RDONLY | O_CLOEXEC);
+	if (_fd == -1)
+		return -errno;
+	_ibuf.resize(TAR_BUF_SIZE);
+	_ioff = _ilen = 0;
+	_ieof = false;
+	_left = _pad = 0;
+	_end = false;
+	_global.clear();
+	auto ret = fill_input();
+	if (ret < 0) {
+		close_tar();
+		return ret;
+	}
+
+	// detect compression by magic
+	auto* p = reinterpret_cast<const unsigned char*>(_ibuf.data());
+	if (_ilen >= 2 && p[0] == 0x1f && p[1] == 0x8b) {
+#ifdef CONFIG_ZLIB
+		auto* z = new z_stream{};
+		if (inflateInit2(z, 15 + 32) != Z_OK) {
+			delete z;
+			close_tar();
+			return -ENOMEM;
+		}
+		_ctx = z;
+		_comp = TarCompression::Gzip;
+#else
+		close_tar();
+		return -ENOTSUP;
+#endif
+	} else if (_ilen >= 4 && p[0] == 0x28 && p[1] == 0xb5 &&
+		p[2] == 0x2f && p[3] == 0xfd) {
+#ifdef CONFIG_ZSTD
+		_ctx = ZSTD_createDCtx();
+		if (!_ctx) {
+			close_tar();
+			return -ENOMEM;
+		}
+		_comp = TarCompression::Zstd;
+#else
+		close_tar();
+		return -ENOTSUP;
+#endif
+	} else if ((_ilen >= 3 && !std::memcmp(p, "BZh", 3)) ||
+		(_ilen >= 6 && !std::memcmp(p, "\xfd" "7zXZ", 6))) {
+		close_tar();
+		return -ENOTSUP;
+	} else {
+		_comp = TarCompression::None;
+	}
+	return 0;
+}
+
+void TarReader::close_tar(void) {
+	switch (_comp) {
+	case TarCompression::Gzip:
+#ifdef CONFIG_ZLIB
+		inflateEnd(static_cast<z_stream*>(_ctx));
+		delete static_cast<z_stream*>(_ctx);
+#endif
+		break;
+	case TarCompression::Zstd:
+#ifdef CONFIG_ZSTD
+		ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(_ctx));
+#endif
+		break;
+	case TarCompression::None:
+		break;
+	}
+	_ctx = nullptr;
+	_comp = TarCompression::None;
+	if (_fd != -1)
+		close(_fd);
+	_fd = -1;
+}
+
+// returns 1 if read, 0 at the end, or negative errno if truncated or invalid
+int TarReader::read_entry(TarEntry& e) {
+	assert(_fd != -1);
+	if (_end)
+		return 0;
+	auto ret = skip_data();
+	if (ret < 0)
+		return ret;
+
+	std::unordered_map<std::string, std::string> local;
+	std::string longname, longlink;
+	auto has_longname = false, has_longlink = false;
+	char h[TAR_BLOCK_SIZE];
+	while (1) {
+		ret = read_block(h);
+		if (ret < 0)
+			return ret;
+		// some tar(1)s omit end of archive blocks
+		if (ret == 0 || is_zero_block(h)) {
+			_end = true;
+			return 0;
+		}
+		if (!test_checksum(h))
+			return -EINVAL;
+		std::uint64_t size, mtime;
+		if (get_tar_number(h + TAR_SIZE, 12, size) < 0 ||
+			get_tar_number(h + TAR_MTIME, 12, mtime) < 0)
+			return -EINVAL;
+
+		// extended headers apply to next entry
+		auto t = h[TAR_TYPEFLAG];
+		if (t == 'L' || t == 'K' || t == 'x' || t == 'g') {
+			std::string s;
+			ret = read_string(size, s);
+			if (ret < 0)
+				return ret;
+			if (t == 'L') {
+				longname = get_field_string(s.data(), s.size());
+				has_longname = true;
+			} else if (t == 'K') {
+				longlink = get_field_string(s.data(), s.size());
+				has_longlink = true;
+			} else if (get_pax_record(s, t == 'x' ? local :
+				_global) < 0) {
+				return -EINVAL;
+			}
+			continue;
+		}
+
+		// pax local overrides pax global, and empty value unsets
+		auto attr = _global;
+		for (const auto& [k, v] : local)
+			attr[k] = v;
+		for (auto it = attr.begin(); it != attr.end();)
+			it = it->second.empty() ? attr.erase(it) : std::next(it);
+
+		// POSIX ustar has prefix, GNU uses the same area otherwise
+		std::string name;
+		if (attr.contains("path")) {
+			name = attr["path"];
+		} else if (has_longname) {
+			name = longname;
+		} else {
+			name = get_field_string(h + TAR_NAME, 100);
+			if (!std::memcmp(h + TAR_MAGIC, "ustar\0", 6)) {
+				auto prefix = get_field_string(h + TAR_PREFIX,
+					155);
+				if (!prefix.empty())
+					name = prefix + "/" + name;
+			}
+		}
+		if (attr.contains("linkpath"))
+			e.link = attr["linkpath"];
+		else if (has_longlink)
+			e.link = longlink;
+		else
+			e.link = get_field_string(h + TAR_LINKNAME, 100);
+		if (attr.contains("size")) {
+			const auto& s = attr["size"];
+			if (s.empty() || s.find_first_not_of("0123456789") !=
+				std::string::npos)
+				return -EINVAL;
+			try {
+				size = std::stoull(s);
+			} catch (const std::exception& x) {
+				return -EINVAL;
+			}
+		}
+		if (attr.contains("mtime")) {
+			if (get_pax_mtime_ns(attr["mtime"], e.mtime_ns) < 0)
+				return -EINVAL;
+		} else {
+			e.mtime_ns = static_cast<std::int64_t>(mtime) *
+				1000000000;
+		}
+
+		switch (t) {
+		case '0':
+			[[fallthrough]];
+		case '7':
+			e.type = TarType::Reg;
+			break;
+		case '\0':
+			// pre POSIX directory
+			e.type = name.ends_with("/") ? TarType::Dir :
+				TarType::Reg;
+			break;
+		case '1':
+			e.type = TarType::Hardlink;
+			break;
+		case '2':
+			e.type = TarType::Symlink;
+			break;
+		case '3':
+			[[fallthrough]];
+		case '4':
+			e.type = TarType::Device;
+			break;
+		case '5':
+			e.type = TarType::Dir;
+			break;
+		case '6':
+			e.type = TarType::Fifo;
+			break;
+		case 'V':
+			// volume label isn't a file
+			_left = size;
+			_pad = get_pad_size(size);
+			ret = skip_data();
+			if (ret < 0)
+				return ret;
+			local.clear();
+			has_longname = has_longlink = false;
+			continue;
+		default:
+			// e.g. GNU sparse file or dumpdir
+			e.type = TarType::Unsupported;
+			break;
+		}
+
+		// no data follows for these regardless of size field
+		if (e.type == TarType::Dir || e.type == TarType::Symlink ||
+			e.type == TarType::Device || e.type == TarType::Fifo)
+			size = 0;
+		e.path = get_tar_path(name);
+		e.size = size;
+		_left = size;
+		_pad = get_pad_size(size);
+		return 1;
+	}
+}
+
+// returns bytes read from current entry, 0 at the end of it,
+// or negative errno if truncated
+long TarReader::read_data(char* p, std::size_t n) {
+	auto x = static_cast<std::size_t>(std::min(_left,
+		static_cast<std::uint64_t>(n)));
+	if (x == 0)
+		return 0;
+	auto ret = read_stream(p, x);
+	if (ret < 0)
+		return ret;
+	if (static_cast<std::size_t>(ret) != x)
+		return -EINVAL;
+	_left -= x;
+	return ret;
+}
+
+int TarReader::fill_input(void) {
+	assert(_ioff == _ilen);
+	if (_ieof)
+		return 0;
+	ssize_t n;
+	do {
+		n = read(_fd, _ibuf.data(), _ibuf.size());
+	} while (n == -1 && errno == EINTR);
+	if (n == -1)
+		return -errno;
+	if (n == 0)
+		_ieof = true;
+	_ioff = 0;
+	_ilen = static_cast<std::size_t>(n);
+	return static_cast<int>(n);
+}
+
+// read up to n decompressed bytes, fewer only at the end of input
+long TarReader::read_stream(char* p, std::size_t n) {
+	std::size_t done = 0;
+	while (done < n) {
+		if (_comp == TarCompression::None) {
+			if (_ioff == _ilen) {
+				auto ret = fill_input();
+				if (ret < 0)
+					return ret;
+				if (ret == 0)
+					break;
+			}
+			auto x = std::min(n - done, _ilen - _ioff);
+			std::memcpy(p + done, _ibuf.data() + _ioff, x);
+			_ioff += x;
+			done += x;
+			continue;
+		}
+
+		// decompressor may have pending output without more input
+		auto progress = false;
+#ifdef CONFIG_ZLIB
+		if (_comp == TarCompression::Gzip) {
+			auto* z = static_cast<z_stream*>(_ctx);
+			z->next_in = reinterpret_cast<Bytef*>(_ibuf.data() +
+				_ioff);
+			z->avail_in = static_cast<uInt>(_ilen - _ioff);
+			z->next_out = reinterpret_cast<Bytef*>(p + done);
+			z->avail_out = static_cast<uInt>(n - done);
+			auto ret = inflate(z, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_BUF_ERROR &&
+				ret != Z_STREAM_END)
+				return -EIO;
+			auto consumed = _ilen - _ioff - z->avail_in;
+			auto produced = n - done - z->avail_out;
+			_ioff += consumed;
+			done += produced;
+			progress = consumed || produced;
+			// concatenated gzip members
+			if (ret == Z_STREAM_END) {
+				if (inflateReset(z) != Z_OK)
+					return -EIO;
+				progress = true;
+			}
+		}
+#endif
+#ifdef CONFIG_ZSTD
+		if (_comp == TarCompression::Zstd) {
+			ZSTD_inBuffer in{_ibuf.data() + _ioff, _ilen - _ioff, 0};
+			ZSTD_outBuffer out{p + done, n - done, 0};
+			auto ret = ZSTD_decompressStream(
+				static_cast<ZSTD_DCtx*>(_ctx), &out, &in);
+			if (ZSTD_isError(ret))
+				return -EIO;
+			_ioff += in.pos;
+			done += out.pos;
+			progress = in.pos || out.pos;
+		}
+#endif
+		if (_ioff == _ilen) {
+			auto ret = fill_input();
+			if (ret < 0)
+				return ret;
+			if (ret == 0 && !progress)
+				break;
+		} else if (!progress) {
+			return -EIO;
+		}
+	}
+	return static_cast<long>(done);
+}
+
+// returns block size if read, 0 at the end, or negative errno if truncated
+int TarReader::read_block(char* h) {
+	auto ret = read_stream(h, TAR_BLOCK_SIZE);
+	if (ret < 0)
+		return static_cast<int>(ret);
+	if (ret == 0)
+		return 0;
+	if (static_cast<std::size_t>(ret) != TAR_BLOCK_SIZE)
+		return -EINVAL;
+	return static_cast<int>(ret);
+}
+
+int TarReader::read_string(std::uint64_t n, std::string& s) {
+	if (n > TAR_STRING_LIMIT)
+		return -EINVAL;
+	s.resize(static_cast<std::size_t>(n));
+	_left = n;
+	_pad = get_pad_size(n);
+	std::size_t off = 0;
+	while (off < s.size()) {
+		auto ret = read_data(&s[off], s.size() - off);
+		if (ret < 0)
+			return static_cast<int>(ret);
+		assert(ret > 0);
+		off += static_cast<std::size_t>(ret);
+	}
+	return skip_data();
+}
+
+// skip unread data and padding of current entry
+int TarReader::skip_data(void) {
+	char buf[TAR_BLOCK_SIZE * 16];
+	auto n = _left + _pad;
+	while (n) {
+		auto x = static_cast<std::size_t>(std::min(n,
+			static_cast<std::uint64_t>(sizeof(buf))));
+		auto ret = read_stream(buf, x);
+		if (ret < 0)
+			return static_cast<int>(ret);
+		if (static_cast<std::size_t>(ret) != x)
+			return -EINVAL;
+		n -= x;
+	}
+	_left = _pad = 0;
+	return 0;
+}
+
+// relative path as if extracted, "." for top directory,
+// or empty if outside of it
+std::string get_tar_path(const std::string& s) {
+	auto x = s;
+	while (x.starts_with("/"))
+		x = x.substr(1);
+	x = std::filesystem::path(x).lexically_normal();
+	while (x.size() > 1 && x.ends_with("/"))
+		x = x.substr(0, x.size() - 1);
+	if (x.empty() || x == ".")
+		return s.empty() ? "" : ".";
+	if (x == ".." || x.starts_with("../"))
+		return "";
+	return x;
+}
+
+// octal with optional leading and trailing space or NUL,
+// or GNU base-256 if the first byte has its highest bit set
+int get_tar_number(const char* p, std::size_t n, std::uint64_t& x) {
+	x = 0;
+	auto* u = reinterpret_cast<const unsigned char*>(p);
+	if (n && (u[0] & 0x80)) {
+		if (u[0] & 0x40) // negative
+			return -EINVAL;
+		x = u[0] & 0x3f;
+		for (std::size_t i = 1; i < n; i++) {
+			if (x >> 56)
+				return -EINVAL;
+			x = (x << 8) | u[i];
+		}
+		return 0;
+	}
+	std::size_t i = 0;
+	while (i < n && (p[i] == ' ' || p[i] == '\0'))
+		i++;
+	for (; i < n && p[i] >= '0' && p[i] <= '7'; i++) {
+		if (x >> 61)
+			return -EINVAL;
+		x = (x << 3) | static_cast<std::uint64_t>(p[i] - '0');
+	}
+	for (; i < n; i++)
+		if (p[i] != ' ' && p[i] != '\0')
+			return -EINVAL;
+	return 0;
+}
+
+// "%d %s=%s\n" records, where %d is the length of the whole record
+int get_pax_record(const std::string& s,
+	std::unordered_map<std::string, std::string>& m) {
+	std::size_t off = 0;
+	while (off < s.size()) {
+		// GNU tar pads with NUL
+		if (s[off] == '\0')
+			break;
+		auto i = s.find(' ', off);
+		if (i == std::string::npos || i == off ||
+			s.find_first_not_of("0123456789", off) != i)
+			return -EINVAL;
+		std::size_t n;
+		try {
+			n = std::stoul(s.substr(off, i - off));
+		} catch (const std::exception& e) {
+			return -EINVAL;
+		}
+		if (n > s.size() - off || off + n <= i + 1 ||
+			s[off + n - 1] != '\n')
+			return -EINVAL;
+		auto r = s.substr(i + 1, off + n - 1 - (i + 1));
+		auto j = r.find('=');
+		if (j == std::string::npos || j == 0)
+			return -EINVAL;
+		m[r.substr(0, j)] = r.substr(j + 1);
+		off += n;
+	}
+	return 0;
+}
+
+// hash contents of current entry,
+// returns negative errno if truncated
+int get_tar_data_hash(TarReader& r, const std::string& hash_algo,
+	hash_res& res) {
+	TarDataBuf buf(r);
+	std::istream is(&buf);
+	is.exceptions(std::istream::badbit);
+	res = get_stream_hash(is, hash_algo);
+	if (buf.get_error() < 0)
+		return buf.get_error();
+	assert(r.get_data_left() == 0);
+	return 0;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <fstream>
+
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+namespace {
+std::string get_test_tar_header(const std::string& name, char t,
+	std::uint64_t size, const std::string& link = "",
+	const std::string& prefix = "") {
+	std::string h(TAR_BLOCK_SIZE, '\0');
+	auto put = [&](std::size_t off, std::size_t n, const std::string& s) {
+		assert(s.size() <= n);
+		h.replace(off, s.size(), s);
+	};
+	auto put_octal = [&](std::size_t off, std::size_t n, std::uint64_t x) {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%0*llo", static_cast<int>(n - 1),
+			static_cast<unsigned long long>(x));
+		put(off, n, buf);
+	};
+	put(TAR_NAME, 100, name);
+	put_octal(100, 8, 0644);
+	put_octal(108, 8, 0);
+	put_octal(116, 8, 0);
+	put_octal(TAR_SIZE, 12, size);
+	put_octal(TAR_MTIME, 12, 1700000000);
+	put(TAR_CHKSUM, 8, "        ");
+	h[TAR_TYPEFLAG] = t;
+	put(TAR_LINKNAME, 100, link);
+	h.replace(TAR_MAGIC, 6, std::string("ustar\0", 6));
+	put(263, 2, "00");
+	put(TAR_PREFIX, 155, prefix);
+	long sum = 0;
+	for (auto c : h)
+		sum += static_cast<unsigned char>(c);
+	put_octal(TAR_CHKSUM, 7, static_cast<std::uint64_t>(sum));
+	return h;
+}
+
+std::string get_test_tar_data(const std::string& s) {
+	return s + std::string(get_pad_size(s.size()), '\0');
+}
+
+std::string get_test_pax_record(const std::string& k, const std::string& v) {
+	// length includes its own digits
+	auto n = k.size() + v.size() + 3;
+	auto x = std::to_string(n);
+	while (std::to_string(n + x.size()) != x)
+		x = std::to_string(n + x.size());
+	return x + " " + k + "=" + v + "\n";
+}
+} // namespace
+
+void TarTest::test_get_tar_path(void) {
+	const std::vector<std::pair<std::string, std::string>> path_list{
+		{"a", "a"},
+		{"a/", "a"},
+		{"./a/b", "a/b"},
+		{"/a/b", "a/b"},
+		{"//a//b//", "a/b"},
+		{"a/./b/../c", "a/c"},
+		{".", "."},
+		{"./", "."},
+		{"/", "."},
+		{"", ""},
+		{"..", ""},
+		{"../a", ""},
+		{"a/../../b", ""},
+	};
+	for (const auto& [s, x] : path_list)
+		CPPUNIT_ASSERT_EQUAL(get_tar_path(s), x);
+}
+
+void TarTest::test_get_tar_number(void) {
+	const std::vector<std::tuple<std::string, std::uint64_t, int>>
+		number_list{
+		{std::string("0000644\0", 8), 0644, 0},
+		{std::string("     17 ", 8), 017, 0},
+		{std::string("\0\0\0\0\0\0\0\0", 8), 0, 0},
+		{std::string("00000000001\0", 12), 1, 0},
+		{std::string("0000008\0", 8), 0, -EINVAL},
+		{std::string("12 3\0\0\0\0", 8), 0, -EINVAL},
+		{std::string("\x80\0\0\0\0\0\0\0\0\0\x01\0", 12), 256, 0},
+		{std::string("\x80\x01\0\0\0\0\0\0\0\0\0\0", 12), 0,
+			-EINVAL},
+		{std::string("\xff\xff\xff\xff\xff\xff\xff\xff", 8), 0, -EINVAL},
+	};
+	for (const auto& [s, x, ret] : number_list) {
+		std::uint64_t y;
+		CPPUNIT_ASSERT_EQUAL(get_tar_number(s.data(), s.size(), y), ret);
+		if (ret == 0)
+			CPPUNIT_ASSERT_EQUAL(y, x);
+	}
+}
+
+void TarTest::test_get_pax_record(void) {
+	std::unordered_map<std::string, std::string> m;
+	auto s = get_test_pax_record("path", "a/b") +
+		get_test_pax_record("size", "12345678901") +
+		get_test_pax_record("mtime", "1.5");
+	CPPUNIT_ASSERT_EQUAL(get_pax_record(s, m), 0);
+	CPPUNIT_ASSERT_EQUAL(m.size(), static_cast<std::size_t>(3));
+	CPPUNIT_ASSERT_EQUAL(m["path"], std::string("a/b"));
+	CPPUNIT_ASSERT_EQUAL(m["size"], std::string("12345678901"));
+	CPPUNIT_ASSERT_EQUAL(m["mtime"], std::string("1.5"));
+
+	for (const auto& x : {"13 path=a/b\n", "x path=a\n", "9 path=a/b\n",
+		"12 path a/b\n", "12 =a/bcdef\n"}) {
+		m.clear();
+		CPPUNIT_ASSERT_EQUAL(get_pax_record(x, m), -EINVAL);
+	}
+}
+
+void TarTest::test_read_entry(void) {
+	auto f = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-tar-test." + std::to_string(getpid())));
+	auto longname = std::string(150, 'x') + "/" + std::string(150, 'y');
+	auto pax = get_test_pax_record("path", "p/q") +
+		get_test_pax_record("mtime", "1700000000.25");
+	auto s = get_test_tar_header("./d/", '5', 0) +
+		get_test_tar_header("a", '0', 3) + get_test_tar_data("abc") +
+		get_test_tar_header("b", '0', 0, "", "d") +
+		get_test_tar_header("././@LongLink", 'L', longname.size() + 1) +
+		get_test_tar_data(longname + std::string(1, '\0')) +
+		get_test_tar_header("ignored", '0', 600) +
+		get_test_tar_data(std::string(600, 'z')) +
+		get_test_tar_header("PaxHeaders/x", 'x', pax.size()) +
+		get_test_tar_data(pax) +
+		get_test_tar_header("x", '0', 1) + get_test_tar_data("1") +
+		get_test_tar_header("l", '2', 0, "a") +
+		get_test_tar_header("h", '1', 0, "a") +
+		get_test_tar_header("c", '3', 0) +
+		get_test_tar_header("../e", '0', 0) +
+		std::string(TAR_BLOCK_SIZE * 2, '\0');
+	{
+		std::ofstream ofs(f, std::ios::binary);
+		ofs.write(s.data(), static_cast<std::streamsize>(s.size()));
+	}
+
+	const std::vector<std::tuple<std::string, std::string, TarType,
+		std::uint64_t>> entry_list{
+		{"d", "", TarType::Dir, 0},
+		{"a", "", TarType::Reg, 3},
+		{"d/b", "", TarType::Reg, 0},
+		{longname, "", TarType::Reg, 600},
+		{"p/q", "", TarType::Reg, 1},
+		{"l", "a", TarType::Symlink, 0},
+		{"h", "a", TarType::Hardlink, 0},
+		{"c", "", TarType::Device, 0},
+		{"", "", TarType::Reg, 0},
+	};
+	TarReader r;
+	CPPUNIT_ASSERT_EQUAL(r.open_tar(f), 0);
+	CPPUNIT_ASSERT(r.get_compression() == TarCompression::None);
+	TarEntry e;
+	for (const auto& [path, link, t, size] : entry_list) {
+		CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+		CPPUNIT_ASSERT_EQUAL(e.path, path);
+		CPPUNIT_ASSERT_EQUAL(e.link, link);
+		CPPUNIT_ASSERT(e.type == t);
+		CPPUNIT_ASSERT_EQUAL(e.size, size);
+		if (path == "a") {
+			// read contents
+			hash_res res;
+			CPPUNIT_ASSERT_EQUAL(get_tar_data_hash(r, hash::SHA256,
+				res), 0);
+			const auto& [b, written] = res;
+			CPPUNIT_ASSERT(b == std::get<0>(get_string_hash("abc",
+				hash::SHA256)));
+			CPPUNIT_ASSERT_EQUAL(written, 3lu);
+		} else if (path == "p/q") {
+			CPPUNIT_ASSERT_EQUAL(e.mtime_ns, 1700000000250000000);
+		} else {
+			CPPUNIT_ASSERT_EQUAL(e.mtime_ns, 1700000000000000000);
+		}
+	}
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 0);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 0);
+	r.close_tar();
+
+	// truncated in contents
+	std::filesystem::resize_file(f, TAR_BLOCK_SIZE * 2 + 1);
+	CPPUNIT_ASSERT_EQUAL(r.open_tar(f), 0);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+	CPPUNIT_ASSERT_EQUAL(e.path, std::string("a"));
+	{
+		hash_res res;
+		CPPUNIT_ASSERT_EQUAL(get_tar_data_hash(r, hash::SHA256, res),
+			-EINVAL);
+	}
+	r.close_tar();
+
+	// truncated
+	std::filesystem::resize_file(f, TAR_BLOCK_SIZE + 100);
+	CPPUNIT_ASSERT_EQUAL(r.open_tar(f), 0);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), -EINVAL);
+	r.close_tar();
+
+	// bad checksum
+	s[TAR_NAME] = 'X';
+	{
+		std::ofstream ofs(f, std::ios::binary);
+		ofs.write(s.data(), static_cast<std::streamsize>(s.size()));
+	}
+	CPPUNIT_ASSERT_EQUAL(r.open_tar(f), 0);
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), -EINVAL);
+	r.close_tar();
+
+#ifdef CONFIG_ZLIB
+	// two gzip members
+	s[TAR_NAME] = '.';
+	std::string z;
+	for (const auto& x : {s.substr(0, 3000), s.substr(3000)}) {
+		z_stream zs{};
+		CPPUNIT_ASSERT_EQUAL(deflateInit2(&zs, Z_DEFAULT_COMPRESSION,
+			Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY), Z_OK);
+		std::string buf(deflateBound(&zs, x.size()), '\0');
+		zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(
+			x.data()));
+		zs.avail_in = static_cast<uInt>(x.size());
+		zs.next_out = reinterpret_cast<Bytef*>(&buf[0]);
+		zs.avail_out = static_cast<uInt>(buf.size());
+		CPPUNIT_ASSERT_EQUAL(deflate(&zs, Z_FINISH), Z_STREAM_END);
+		z += buf.substr(0, buf.size() - zs.avail_out);
+		deflateEnd(&zs);
+	}
+	{
+		std::ofstream ofs(f, std::ios::binary);
+		ofs.write(z.data(), static_cast<std::streamsize>(z.size()));
+	}
+	CPPUNIT_ASSERT_EQUAL(r.open_tar(f), 0);
+	CPPUNIT_ASSERT(r.get_compression() == TarCompression::Gzip);
+	for (const auto& x : entry_list) {
+		CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 1);
+		CPPUNIT_ASSERT_EQUAL(e.path, std::get<0>(x));
+	}
+	CPPUNIT_ASSERT_EQUAL(r.read_entry(e), 0);
+	r.close_tar();
+#endif
+	std::filesystem::remove(f);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TarTest);
+#endif
@@ -0,0 +1,101 @@
+#ifndef SRC_TAR_H_
+#define SRC_TAR_H_
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+#include "./hash.h"
+
+enum class TarType {
+	Reg,
+	Hardlink,
+	Symlink,
+	Dir,
+	Device,
+	Fifo,
+	Unsupported,
+};
+
+enum class TarCompression {
+	None,
+	Gzip,
+	Zstd,
+};
+
+struct TarEntry {
+	std::string path; // relative, normalized
+	std::string link; // symlink or hardlink target
+	TarType type;
+	std::uint64_t size;
+	std::int64_t mtime_ns;
+};
+
+// Sequential reader of ustar, pax and GNU tar archives, optionally gzip or
+// zstd compressed, without seeking so that pipes work as well.
+class TarReader {
+	public:
+	TarReader(void);
+	~TarReader(void);
+	TarReader(const TarReader&) = delete;
+	TarReader& operator=(const TarReader&) = delete;
+	int open_tar(const std::string&);
+	void close_tar(void);
+	int read_entry(TarEntry&);
+	long read_data(char*, std::size_t);
+	std::uint64_t get_data_left(void) const {
+		return _left;
+	}
+	TarCompression get_compression(void) const {
+		return _comp;
+	}
+
+	private:
+	int fill_input(void);
+	long read_stream(char*, std::size_t);
+	int read_block(char*);
+	int read_string(std::uint64_t, std::string&);
+	int skip_data(void);
+
+	int _fd;
+	TarCompression _comp;
+	void* _ctx; // z_stream or ZSTD_DCtx
+	std::vector<char> _ibuf;
+	std::size_t _ioff;
+	std::size_t _ilen;
+	bool _ieof;
+	std::uint64_t _left; // data bytes of current entry
+	std::uint64_t _pad;
+	bool _end;
+	std::unordered_map<std::string, std::string> _global; // pax global
+};
+
+std::string get_tar_path(const std::string&);
+int get_tar_number(const char*, std::size_t, std::uint64_t&);
+int get_pax_record(const std::string&,
+	std::unordered_map<std::string, std::string>&);
+int get_tar_data_hash(TarReader&, const std::string&, hash_res&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class TarTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(TarTest);
+	CPPUNIT_TEST(test_get_tar_path);
+	CPPUNIT_TEST(test_get_tar_number);
+	CPPUNIT_TEST(test_get_pax_record);
+	CPPUNIT_TEST(test_read_entry);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_tar_path(void);
+	void test_get_tar_number(void);
+	void test_get_pax_record(void);
+	void test_read_entry(void);
+};
+#endif
+#endif // SRC_TAR_H_
@@ -1,10 +1,17 @@
 #include <iostream>
 #include <array>
+#include <algorithm>
 #include <filesystem>
+#include <stdexcept>
 
 #include <cctype>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
 
+#include <unistd.h>
+
 #include "./util.h"
 
 namespace {
@@ -78,6 +85,19 @@ FileType get_mode_type(const std::filesystem::file_type& t) {
 		return FileType::Unsupported;
 	}
 }
+
+FileType get_stat_type(const struct stat& st) {
+	if (S_ISDIR(st.st_mode))
+		return FileType::Dir;
+	else if (S_ISREG(st.st_mode))
+		return FileType::Reg;
+	else if (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode))
+		return FileType::Device;
+	else if (S_ISLNK(st.st_mode))
+		return FileType::Symlink;
+	else
+		return FileType::Unsupported;
+}
 } // namespace
 
 FileType get_raw_file_type(const std::string& f) {
@@ -96,6 +116,22 @@ FileType get_file_type(const std::string& f) {
 	}
 }
 
+// same as above but also returns stat of f for callers that need its
+// mtime, non existent path is unsupported as with std::filesystem
+FileType get_raw_file_type(const std::string& f, struct stat& st) {
+	if (lstat(f.c_str(), &st) == -1)
+		return errno == ENOENT || errno == ENOTDIR ?
+			FileType::Unsupported : FileType::Invalid;
+	return get_stat_type(st);
+}
+
+FileType get_file_type(const std::string& f, struct stat& st) {
+	if (stat(f.c_str(), &st) == -1)
+		return errno == ENOENT || errno == ENOTDIR ?
+			FileType::Unsupported : FileType::Invalid;
+	return get_stat_type(st);
+}
+
 const std::string& get_file_type_string(const FileType& t) {
 	static const std::array<std::string, 6> x{
 		"directory",
@@ -185,8 +221,22 @@ std::string get_num_format_string(unsigned long n, const std::string& msg) {
 	return s;
 }
 
+namespace {
+thread_local std::ostream* _output;
+} // namespace
+
+// stdout unless redirected for the calling thread,
+// e.g. input processed concurrently with others
+std::ostream& get_output(void) {
+	return _output ? *_output : std::cout;
+}
+
+void set_output(std::ostream* os) {
+	_output = os;
+}
+
 void print_num_format_string(unsigned long n, const std::string& msg) {
-	std::cout << get_num_format_string(n, msg) << std::endl;
+	get_output() << get_num_format_string(n, msg) << std::endl;
 }
 
 void panic_file_type(const std::string& f, const std::string& how,
@@ -200,6 +250,96 @@ void panic_file_type(const std::string& f, const std::string& how,
 	assert(false);
 }
 
+std::int64_t get_mtime_ns(const struct stat& st) {
+	return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+		st.st_mtim.tv_nsec;
+}
+
+std::int64_t get_ctime_ns(const struct stat& st) {
+	return static_cast<std::int64_t>(st.st_ctim.tv_sec) * 1000000000 +
+		st.st_ctim.tv_nsec;
+}
+
+// seconds since epoch with optional fraction, or local time in
+// "YYYY-MM-DD[ T]HH:MM[:SS]" or "YYYY-MM-DD" format, in nanoseconds
+std::int64_t get_timestamp_ns(const std::string& s) {
+	auto is_digit = [](char c) {
+		return isdigit(static_cast<unsigned char>(c)) != 0;
+	};
+	auto i = s.find('.');
+	auto x = s.substr(0, i);
+	if (!x.empty() && std::all_of(x.begin(), x.end(), is_digit)) {
+		std::string frac;
+		if (i != std::string::npos) {
+			frac = s.substr(i + 1);
+			if (frac.empty() || !std::all_of(frac.begin(), frac.end(),
+				is_digit))
+				throw std::invalid_argument("invalid timestamp");
+		}
+		frac.resize(9, '0');
+		return std::stoll(x) * 1000000000 + std::stoll(frac.substr(0, 9));
+	}
+
+	for (const auto* fmt : {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+		struct tm tm{};
+		const auto* p = strptime(s.c_str(), fmt, &tm);
+		if (p && *p == '\0') {
+			tm.tm_isdst = -1;
+			auto t = mktime(&tm);
+			if (t == -1)
+				break;
+			return static_cast<std::int64_t>(t) * 1000000000;
+		}
+	}
+	throw std::invalid_argument("invalid timestamp");
+}
+
+void put_le32(std::vector<char>& v, std::uint32_t x) {
+	for (auto i = 0; i < 4; i++)
+		v.push_back(static_cast<char>(x >> (i * 8)));
+}
+
+void put_le64(std::vector<char>& v, std::uint64_t x) {
+	for (auto i = 0; i < 8; i++)
+		v.push_back(static_cast<char>(x >> (i * 8)));
+}
+
+std::uint32_t get_le32(const char* p) {
+	std::uint32_t x = 0;
+	for (auto i = 0; i < 4; i++)
+		x |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i]))
+			<< (i * 8);
+	return x;
+}
+
+std::uint64_t get_le64(const char* p) {
+	std::uint64_t x = 0;
+	for (auto i = 0; i < 8; i++)
+		x |= static_cast<std::uint64_t>(static_cast<unsigned char>(p[i]))
+			<< (i * 8);
+	return x;
+}
+
+// unlinked temporary file, unlike tmpfile(3) honors TMPDIR
+std::FILE* new_tmpfile(void) {
+	auto d = std::filesystem::temp_directory_path() / "dirhash-cpp.XXXXXX";
+	auto s = std::string(d);
+	std::vector<char> v(s.begin(), s.end());
+	v.push_back('\0');
+	auto fd = mkstemp(&v[0]);
+	if (fd == -1)
+		throw std::runtime_error(s + ": " + strerror(errno));
+	unlink(&v[0]);
+	auto* fp = fdopen(fd, "w+b");
+	if (!fp) {
+		auto error = errno;
+		close(fd);
+		throw std::runtime_error(s + ": " + strerror(error));
+	}
+	return fp;
+}
+
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestAssert.h>
 
@@ -323,6 +463,12 @@ void UtilTest::test_get_raw_file_type(void) {
 	for (const auto& f : invalid_list)
 		CPPUNIT_ASSERT_EQUAL_MESSAGE(f, get_raw_file_type(f),
 			FileType::Unsupported);
+
+	struct stat st;
+	for (const auto& f : {"/", "/dev/null", "/proc/self", "",
+		"516e7cb4-6ecf-11d6-8ff8-00022d09712b"})
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(f, get_raw_file_type(f, st),
+			get_raw_file_type(f));
 }
 
 void UtilTest::test_get_file_type(void) {
@@ -343,6 +489,12 @@ void UtilTest::test_get_file_type(void) {
 	for (const auto& f : invalid_list)
 		CPPUNIT_ASSERT_EQUAL_MESSAGE(f, get_file_type(f),
 			FileType::Unsupported);
+
+	struct stat st;
+	for (const auto& f : {"/", "/dev/null", "/proc/self", "",
+		"516e7cb4-6ecf-11d6-8ff8-00022d09712b"})
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(f, get_file_type(f, st),
+			get_file_type(f));
 }
 
 void UtilTest::test_get_file_type_string(void) {
@@ -450,5 +602,42 @@ void UtilTest::test_get_num_format_string(void) {
 	}
 }
 
+void UtilTest::test_get_le64(void) {
+	std::vector<char> v;
+	put_le32(v, 0x01020304);
+	put_le64(v, 0xfffefdfcfbfaf9f8);
+	CPPUNIT_ASSERT_EQUAL(v.size(), static_cast<std::size_t>(12));
+	CPPUNIT_ASSERT_EQUAL(v[0], '\x04');
+	CPPUNIT_ASSERT_EQUAL(v[4], '\xf8');
+	CPPUNIT_ASSERT_EQUAL(get_le32(&v[0]), static_cast<std::uint32_t>(
+		0x01020304));
+	CPPUNIT_ASSERT_EQUAL(get_le64(&v[4]), static_cast<std::uint64_t>(
+		0xfffefdfcfbfaf9f8));
+}
+
+void UtilTest::test_get_timestamp_ns(void) {
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("0"), static_cast<std::int64_t>(0));
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("1700000000"),
+		static_cast<std::int64_t>(1700000000000000000));
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("1.5"),
+		static_cast<std::int64_t>(1500000000));
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("1.0123456789"),
+		static_cast<std::int64_t>(1012345678));
+
+	auto t = get_timestamp_ns("2000-01-01");
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("2000-01-01 00:00:00"), t);
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("2000-01-01T00:00"), t);
+	CPPUNIT_ASSERT_EQUAL(get_timestamp_ns("2000-01-01T00:00:01") - t,
+		static_cast<std::int64_t>(1000000000));
+
+	for (const auto& s : {"", "x", "1.", "1.x", "1.2.3", "-1",
+		"2000-01-01x", "2000-13-01"})
+		try {
+			get_timestamp_ns(s);
+			CPPUNIT_FAIL(s);
+		} catch (const std::invalid_argument& e) {
+		}
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(UtilTest);
 #endif
@@ -1,8 +1,14 @@
 #ifndef SRC_UTIL_H_
 #define SRC_UTIL_H_
 
+#include <ostream>
 #include <tuple>
+#include <vector>
 #include <string>
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/stat.h>
 
 enum class FileType {
 	Dir,
@@ -25,14 +31,26 @@ bool is_windows(void);
 char get_path_separator(void);
 FileType get_raw_file_type(const std::string&);
 FileType get_file_type(const std::string&);
+FileType get_raw_file_type(const std::string&, struct stat&);
+FileType get_file_type(const std::string&, struct stat&);
 const std::string& get_file_type_string(const FileType&);
 bool path_exists(const std::string&);
 std::tuple<std::string, bool> is_valid_hexsum(const std::string&);
 std::string get_xsum_format_string(const std::string&, const std::string&,
 	bool);
 std::string get_num_format_string(unsigned long, const std::string&);
+std::ostream& get_output(void);
+void set_output(std::ostream*);
 void print_num_format_string(unsigned long, const std::string&);
 void panic_file_type(const std::string&, const std::string&, const FileType&);
+std::int64_t get_mtime_ns(const struct stat&);
+std::int64_t get_ctime_ns(const struct stat&);
+std::int64_t get_timestamp_ns(const std::string&);
+void put_le32(std::vector<char>&, std::uint32_t);
+void put_le64(std::vector<char>&, std::uint64_t);
+std::uint32_t get_le32(const char*);
+std::uint64_t get_le64(const char*);
+std::FILE* new_tmpfile(void);
 
 #ifdef CONFIG_CPPUNIT
 #include <cppunit/TestFixture.h>
@@ -55,6 +73,8 @@ class UtilTest: public CPPUNIT_NS::TestFixture {
 	CPPUNIT_TEST(test_path_exists);
 	CPPUNIT_TEST(test_is_valid_hexsum);
 	CPPUNIT_TEST(test_get_num_format_string);
+	CPPUNIT_TEST(test_get_le64);
+	CPPUNIT_TEST(test_get_timestamp_ns);
 	CPPUNIT_TEST_SUITE_END();
 
 	private:
@@ -71,6 +91,8 @@ class UtilTest: public CPPUNIT_NS::TestFixture {
 	void test_path_exists(void);
 	void test_is_valid_hexsum(void);
 	void test_get_num_format_string(void);
+	void test_get_le64(void);
+	void test_get_timestamp_ns(void);
 };
 #endif
 #endif // SRC_UTIL_H_
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include "./global.h"
+#include "./hash.h"
+#include "./util.h"
+#include "./verify.h"
+
+namespace {
+const std::size_t BLOOM_THRESHOLD = 4 * 1024 * 1024; // table size in bytes
+const std::size_t BLOOM_BIT = 16; // bits per digest
+const int BLOOM_PROBE = 4; // bits per digest set within a block
+const std::size_t BLOOM_BLOCK_BIT = sizeof(BloomBlock) * 8;
+
+std::unique_ptr<DigestSet> _set;
+std::atomic<bool> _found(false);
+
+// 8 bytes of digest, last 8 bytes if off is out of range
+std::uint64_t get_digest_word(const std::vector<char>& b, std::size_t off) {
+	assert(b.size() >= 8);
+	return get_le64(b.data() + std::min(off, b.size() - 8));
+}
+
+std::uint64_t get_pow2(std::uint64_t n) {
+	std::uint64_t x = 1;
+	while (x < n)
+		x <<= 1;
+	return x;
+}
+
+// 9 bits of h per probe select a bit within the 512 bit block, h is the
+// upper 36 bits of the word whose lower bits index the table
+std::uint64_t get_bloom_bit(std::uint64_t h, int k) {
+	return (h >> (k * 9)) & (BLOOM_BLOCK_BIT - 1);
+}
+} // namespace
+
+DigestSet::DigestSet(void):
+	_slot{},
+	_used{},
+	_bloom{},
+	_digest_size(0),
+	_num_digest(0),
+	_mask(0),
+	_bloom_mask(0) {
+}
+
+// load factor is kept at most 0.5 for n digests
+void DigestSet::init_set(std::size_t digest_size, std::size_t n) {
+	assert(digest_size >= 8);
+	auto siz = get_pow2(std::max<std::uint64_t>(2 * n, 16));
+	_slot.assign(siz * digest_size, 0);
+	_used.assign(siz, false);
+	_mask = siz - 1;
+	_bloom.clear();
+	_bloom_mask = 0;
+	if (_slot.size() > BLOOM_THRESHOLD) {
+		auto blocks = get_pow2(std::max<std::uint64_t>(n * BLOOM_BIT /
+			BLOOM_BLOCK_BIT, 1));
+		_bloom.assign(blocks, BloomBlock{});
+		_bloom_mask = blocks - 1;
+	}
+	_digest_size = digest_size;
+	_num_digest = 0;
+}
+
+// false if already exists
+bool DigestSet::insert_digest(const std::vector<char>& b) {
+	assert(b.size() == _digest_size);
+	assert(_num_digest * 2 < _used.size());
+	auto i = get_digest_word(b, 0) & _mask;
+	while (_used[i]) {
+		if (!std::memcmp(&_slot[i * _digest_size], b.data(),
+			_digest_size))
+			return false;
+		i = (i + 1) & _mask;
+	}
+	std::memcpy(&_slot[i * _digest_size], b.data(), _digest_size);
+	_used[i] = true;
+	_num_digest++;
+
+	if (!_bloom.empty()) {
+		auto& x = _bloom[get_digest_word(b, 8) & _bloom_mask];
+		auto h = get_digest_word(b, 0) >> 28;
+		for (auto k = 0; k < BLOOM_PROBE; k++) {
+			auto i = get_bloom_bit(h, k);
+			x.word[i / 64] |= 1ull << (i % 64);
+		}
+	}
+	return true;
+}
+
+bool DigestSet::find_digest(const std::vector<char>& b) const {
+	if (b.size() != _digest_size || _used.empty())
+		return false;
+
+	// single cache line miss rather than one per probe
+	if (!_bloom.empty()) {
+		const auto& x = _bloom[get_digest_word(b, 8) & _bloom_mask];
+		auto h = get_digest_word(b, 0) >> 28;
+		for (auto k = 0; k < BLOOM_PROBE; k++) {
+			auto i = get_bloom_bit(h, k);
+			if (!(x.word[i / 64] & (1ull << (i % 64))))
+				return false;
+		}
+	}
+
+	auto i = get_digest_word(b, 0) & _mask;
+	while (_used[i]) {
+		if (!std::memcmp(&_slot[i * _digest_size], b.data(),
+			_digest_size))
+			return true;
+		i = (i + 1) & _mask;
+	}
+	return false;
+}
+
+// load digests to verify, one per line optionally followed by a path
+int verify_init(void) {
+	if (opt.hash_verify_from.empty())
+		return 0;
+
+	std::ifstream ifs;
+	if (opt.hash_verify_from != "-") {
+		ifs.open(opt.hash_verify_from);
+		if (!ifs.is_open())
+			return errno ? -errno : -ENOENT;
+	}
+	auto& is = opt.hash_verify_from == "-" ? std::cin : ifs;
+
+	auto digest_size = std::get<0>(get_string_hash("",
+		opt.hash_algo)).size();
+	std::vector<char> v;
+	std::string line;
+	unsigned long n = 0;
+	while (std::getline(is, line)) {
+		n++;
+		std::istringstream ss(line);
+		std::string h;
+		if (!(ss >> h))
+			continue;
+		auto [x, valid] = is_valid_hexsum(h);
+		if (!valid || x.size() != digest_size * 2) {
+			std::cout << opt.hash_verify_from << ":" << n
+				<< ": Invalid digest " << h << std::endl;
+			return -EINVAL;
+		}
+		auto b = get_hex_byte(x);
+		v.insert(v.end(), b.begin(), b.end());
+	}
+
+	_set = std::make_unique<DigestSet>();
+	_set->init_set(digest_size, v.size() / digest_size);
+	for (std::size_t i = 0; i < v.size(); i += digest_size)
+		_set->insert_digest(std::vector<char>(v.begin() + i,
+			v.begin() + i + digest_size));
+	if (opt.verbose)
+		print_num_format_string(_set->num_digest(),
+			"digest to verify");
+	return 0;
+}
+
+void verify_cleanup(void) {
+	_set.reset();
+}
+
+// true if digest passes --hash_verify and --hash_verify_from
+bool test_hash_verify(const std::vector<char>& b, const std::string& hex_sum) {
+	if (!opt.hash_verify.empty() && opt.hash_verify != hex_sum)
+		return false;
+	if (_set && !_set->find_digest(b))
+		return false;
+	if (!opt.hash_verify.empty() || _set)
+		_found = true;
+	return true;
+}
+
+// true if walk can stop with --first
+bool is_hash_verify_done(void) {
+	return opt.first && _found;
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void VerifyTest::test_find_digest(void) {
+	for (const auto& hash_algo : {hash::MD5, hash::SHA1, hash::SHA256}) {
+		DigestSet set;
+		set.init_set(std::get<0>(get_string_hash("", hash_algo)).size(),
+			1000);
+		CPPUNIT_ASSERT(!set.has_bloom());
+		for (auto i = 0; i < 1000; i++) {
+			auto [b, _ignore] = get_string_hash(std::to_string(i),
+				hash_algo);
+			CPPUNIT_ASSERT(set.insert_digest(b));
+		}
+		CPPUNIT_ASSERT_EQUAL(set.num_digest(),
+			static_cast<std::size_t>(1000));
+
+		// duplicate
+		auto [b, _ignore] = get_string_hash("0", hash_algo);
+		CPPUNIT_ASSERT(!set.insert_digest(b));
+		CPPUNIT_ASSERT_EQUAL(set.num_digest(),
+			static_cast<std::size_t>(1000));
+
+		for (auto i = 0; i < 2000; i++) {
+			auto [b, _ignore] = get_string_hash(std::to_string(i),
+				hash_algo);
+			CPPUNIT_ASSERT_EQUAL(set.find_digest(b), i < 1000);
+		}
+
+		// different size
+		CPPUNIT_ASSERT(!set.find_digest(std::vector<char>(8)));
+	}
+}
+
+void VerifyTest::test_bloom(void) {
+	const std::size_t n = 200000;
+	DigestSet set;
+	set.init_set(32, n);
+	CPPUNIT_ASSERT(set.has_bloom());
+	CPPUNIT_ASSERT_EQUAL(alignof(BloomBlock), static_cast<std::size_t>(64));
+	for (std::size_t i = 0; i < n; i++) {
+		auto [b, _ignore] = get_string_hash(std::to_string(i),
+			hash::SHA256);
+		CPPUNIT_ASSERT(set.insert_digest(b));
+	}
+	for (std::size_t i = 0; i < 2 * n; i += 7) {
+		auto [b, _ignore] = get_string_hash(std::to_string(i),
+			hash::SHA256);
+		CPPUNIT_ASSERT_EQUAL(set.find_digest(b), i < n);
+	}
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VerifyTest);
+#endif
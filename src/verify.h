@@ -0,0 +1,64 @@
+#ifndef SRC_VERIFY_H_
+#define SRC_VERIFY_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// one cache line of Bloom filter, all bits of a digest are in one block
+struct alignas(64) BloomBlock {
+	std::uint64_t word[8];
+};
+
+// Open addressing set of fixed size raw digests, optionally fronted by
+// a blocked Bloom filter once the table no longer fits in cache.
+// Digests are uniformly distributed, so their bytes are used as hash values.
+class DigestSet {
+	public:
+	DigestSet(void);
+	void init_set(std::size_t, std::size_t);
+	bool insert_digest(const std::vector<char>&);
+	bool find_digest(const std::vector<char>&) const;
+	std::size_t num_digest(void) const {
+		return _num_digest;
+	}
+	std::size_t get_digest_size(void) const {
+		return _digest_size;
+	}
+	bool has_bloom(void) const {
+		return !_bloom.empty();
+	}
+
+	private:
+	std::vector<char> _slot; // _digest_size bytes per slot
+	std::vector<bool> _used;
+	std::vector<BloomBlock> _bloom;
+	std::size_t _digest_size;
+	std::size_t _num_digest;
+	std::uint64_t _mask; // number of slots - 1
+	std::uint64_t _bloom_mask; // number of blocks - 1
+};
+
+int verify_init(void);
+void verify_cleanup(void);
+bool test_hash_verify(const std::vector<char>&, const std::string&);
+bool is_hash_verify_done(void);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class VerifyTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(VerifyTest);
+	CPPUNIT_TEST(test_find_digest);
+	CPPUNIT_TEST(test_bloom);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_find_digest(void);
+	void test_bloom(void);
+};
+#endif
+#endif // SRC_VERIFY_H_
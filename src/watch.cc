@@ -0,0 +1,476 @@
+#include <iostream>
+#include <vector>
+#include <set>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+
+#include <cerrno>
+#include <cassert>
+
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "./cache.h"
+#include "./dir.h"
+#include "./global.h"
+#include "./hash.h"
+#include "./watch.h"
+
+namespace {
+#ifdef __linux__
+const std::uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE |
+	IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+	IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+#endif
+const int WATCH_COALESCE_MS = 50; // wait for more events after first one
+const std::size_t WATCH_BUF_SIZE = 65536;
+
+std::string get_watch_path(const std::string& d, const std::string& name) {
+	return d == "/" ? d + name : d + "/" + name;
+}
+
+void print_watch_line(const std::string& f, const std::string& hex_sum) {
+	if (opt.hash_only)
+		std::cout << hex_sum << std::endl;
+	else
+		std::cout << get_xsum_format_string(f, hex_sum, opt.swap)
+			<< std::endl;
+}
+} // namespace
+
+Watch::Watch(void):
+	_entry{},
+	_wd{},
+	_changed{},
+	_removed{},
+	_dir_digest{},
+	_squash_digest{},
+	_squash_dirty(false),
+	_squ{},
+	_mer{},
+	_inp{},
+	_fd(-1) {
+}
+
+Watch::~Watch(void) {
+	if (_fd != -1)
+		close(_fd);
+}
+
+// initial walk, changes are pending until print_change
+int Watch::init_watch(const std::string& f) {
+#ifdef __linux__
+	_inp = canonicalize_path(f);
+	if (_inp.empty())
+		return -ENOENT;
+	_inp = get_abspath(_inp);
+	if (get_raw_file_type(_inp) != FileType::Dir)
+		return -ENOTDIR;
+	_fd = inotify_init1(IN_CLOEXEC);
+	if (_fd == -1)
+		return -errno;
+	if (opt.dir_digests)
+		_mer.update_directory(".");
+	return scan_directory(_inp);
+#else
+	return -ENOTSUP;
+#endif
+}
+
+// wait for events, then apply those arriving within WATCH_COALESCE_MS
+int Watch::read_event(void) {
+#ifdef __linux__
+	alignas(struct inotify_event) char buf[WATCH_BUF_SIZE];
+	std::set<std::string> update;
+	auto timeout = -1;
+	auto deadline = std::chrono::steady_clock::now();
+	while (1) {
+		if (timeout != -1) {
+			auto x = std::chrono::duration_cast<
+				std::chrono::milliseconds>(deadline -
+				std::chrono::steady_clock::now()).count();
+			timeout = static_cast<int>(std::max<long>(x, 0));
+		}
+		pollfd pfd{_fd, POLLIN, 0};
+		auto ret = poll(&pfd, 1, timeout);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		} else if (ret == 0) {
+			break;
+		}
+		auto n = read(_fd, buf, sizeof(buf));
+		if (n == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+
+		for (auto* p = buf; p < buf + n;) {
+			const auto* ev = reinterpret_cast<
+				const inotify_event*>(p);
+			p += sizeof(inotify_event) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				// rescan everything
+				update.insert(_inp);
+				continue;
+			}
+			auto it = _wd.find(ev->wd);
+			if (it == _wd.end())
+				continue;
+			if (ev->mask & IN_IGNORED) {
+				_wd.erase(it);
+				continue;
+			}
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				if (it->second == _inp)
+					return -ENOENT;
+				continue;
+			}
+			if (!ev->len)
+				continue;
+			auto f = get_watch_path(it->second, ev->name);
+			if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+				remove_path(f);
+			else
+				update.insert(f);
+		}
+		if (timeout == -1) {
+			timeout = WATCH_COALESCE_MS;
+			deadline = std::chrono::steady_clock::now() +
+				std::chrono::milliseconds(WATCH_COALESCE_MS);
+		}
+	}
+
+	// sorted, so directories are scanned before their entries
+	for (const auto& f : update) {
+		auto ret = f == _inp ? scan_directory(f) : update_path(f);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+// print per file, squash or per directory digests changed since last call
+void Watch::print_change(void) {
+	if (opt.dir_digests) {
+		std::set<std::string> l;
+		auto dirs = _mer.get_directory(opt.dir_digests_depth);
+		for (const auto& x : dirs) {
+			l.insert(x);
+			auto b = _mer.get_digest(x);
+			auto it = _dir_digest.find(x);
+			if (it != _dir_digest.end() && it->second == b)
+				continue;
+			_dir_digest[x] = b;
+			auto f = x == "." ? _inp : get_watch_path(_inp, x);
+			print_watch_line(get_real_path(f, _inp),
+				get_hex_sum(b));
+		}
+		for (auto it = _dir_digest.begin(); it != _dir_digest.end();) {
+			if (l.contains(it->first)) {
+				it++;
+				continue;
+			}
+			auto f = get_watch_path(_inp, it->first);
+			std::cout << get_real_path(f, _inp) << ": REMOVED"
+				<< std::endl;
+			it = _dir_digest.erase(it);
+		}
+	} else if (opt.squash) {
+#ifndef CONFIG_SQUASH3
+		// squash1 and squash2 can't remove entries, so rebuild
+		// in sorted order
+		if (_squash_dirty) {
+			_squ.init_buffer();
+			for (const auto& [f, e] : _entry)
+				_squ.update_buffer(e.squash);
+			_squash_dirty = false;
+		}
+#endif
+		const auto [b, _ignore] = _squ.get_buffer_hash(opt.hash_algo);
+		if (b != _squash_digest) {
+			_squash_digest = b;
+			// same as squash line in dir.cc
+			auto hex_sum = get_hex_sum(b);
+			auto s = "[" + SQUASH_LABEL + "][v" +
+				std::to_string(SQUASH_VERSION) + "]";
+			auto realf = get_real_path(_inp, _inp);
+			if (opt.hash_only)
+				std::cout << hex_sum << std::endl;
+			else if (realf == ".")
+				std::cout << hex_sum << s << std::endl;
+			else
+				std::cout << get_xsum_format_string(realf,
+					hex_sum, opt.swap) << s << std::endl;
+		}
+	} else {
+		// both sorted and disjoint
+		auto i = _changed.begin();
+		auto j = _removed.begin();
+		while (i != _changed.end() || j != _removed.end()) {
+			if (j == _removed.end() || (i != _changed.end() &&
+				*i < *j)) {
+				const auto& e = _entry.at(*i);
+				if (e.type != FileType::Dir)
+					print_watch_line(get_real_path(*i,
+						_inp), get_hex_sum(e.digest));
+				i++;
+			} else {
+				std::cout << get_real_path(*j, _inp)
+					<< ": REMOVED" << std::endl;
+				j++;
+			}
+		}
+	}
+	_changed.clear();
+	_removed.clear();
+}
+
+bool Watch::find_entry(const std::string& f, std::vector<char>& b) const {
+	auto it = _entry.find(f);
+	if (it == _entry.end())
+		return false;
+	b = it->second.digest;
+	return true;
+}
+
+// watch directory and update its entries recursively
+int Watch::scan_directory(const std::string& d) {
+#ifdef __linux__
+	auto wd = inotify_add_watch(_fd, d.c_str(), WATCH_MASK);
+	if (wd == -1) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return 0; // gone
+		return -errno;
+	}
+	_wd[wd] = d;
+#endif
+
+	std::set<std::string> l;
+	try {
+		for (const auto& x : std::filesystem::directory_iterator(d))
+			l.insert(x.path());
+	} catch (const std::filesystem::filesystem_error& e) {
+		return 0;
+	}
+
+	// entries no longer in this directory
+	std::vector<std::string> stale;
+	auto prefix = d == "/" ? d : d + "/";
+	for (auto it = _entry.lower_bound(prefix); it != _entry.end() &&
+		it->first.starts_with(prefix); it++)
+		if (it->first.find('/', prefix.size()) == std::string::npos &&
+			!l.contains(it->first))
+			stale.push_back(it->first);
+	for (const auto& f : stale)
+		remove_path(f);
+
+	for (const auto& f : l) {
+		auto ret = update_path(f);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+// same per entry digest as dir.cc without following symlinks
+int Watch::update_path(const std::string& f) {
+	auto t = get_raw_file_type(f);
+	if (test_ignore_entry(f, t) ||
+		(t == FileType::Symlink && opt.ignore_symlink) ||
+		(t != FileType::Dir && t != FileType::Reg &&
+		t != FileType::Device && t != FileType::Symlink)) {
+		remove_path(f);
+		return 0;
+	}
+	auto it = _entry.find(f);
+	if (it != _entry.end() && it->second.type != t)
+		remove_path(f);
+
+	Entry e{t, {}, {}};
+	try {
+		switch (t) {
+		case FileType::Dir:
+			e.digest = std::get<0>(get_string_hash(
+				get_relative_path(f), opt.hash_algo));
+			break;
+		case FileType::Symlink:
+			e.digest = std::get<0>(get_string_hash(get_basename(f),
+				opt.hash_algo));
+			break;
+		default:
+			e.digest = std::get<0>(get_cache_file_hash(f,
+				opt.hash_algo));
+			break;
+		}
+	} catch (const std::exception& ex) {
+		// removed while hashing
+		remove_path(f);
+		return 0;
+	}
+	if (opt.hash_only) {
+		e.squash = e.digest;
+	} else {
+		auto realf = get_real_path(f, _inp);
+		e.squash.assign(realf.begin(), realf.end());
+		e.squash.insert(e.squash.end(), e.digest.begin(),
+			e.digest.end());
+	}
+	set_entry(f, std::move(e));
+
+	if (t == FileType::Dir)
+		return scan_directory(f);
+	return 0;
+}
+
+void Watch::remove_path(const std::string& f) {
+	auto it = _entry.find(f);
+	if (it == _entry.end())
+		return;
+	auto dir = it->second.type == FileType::Dir;
+	if (opt.dir_digests)
+		_mer.remove_entry(get_relative_path(f)); // including subtree
+	erase_entry(it);
+	if (dir) {
+		auto prefix = f + "/";
+		auto x = _entry.lower_bound(prefix);
+		while (x != _entry.end() && x->first.starts_with(prefix))
+			x = erase_entry(x);
+
+		// moved away directory is still watched, and its events
+		// would otherwise be mapped to paths no longer in the tree
+		for (auto w = _wd.begin(); w != _wd.end();) {
+			if (w->second == f || w->second.starts_with(prefix)) {
+#ifdef __linux__
+				inotify_rm_watch(_fd, w->first);
+#endif
+				w = _wd.erase(w);
+			} else {
+				w++;
+			}
+		}
+	}
+}
+
+void Watch::set_entry(const std::string& f, Entry&& e) {
+	auto it = _entry.find(f);
+	if (it != _entry.end()) {
+		if (it->second.digest == e.digest &&
+			it->second.squash == e.squash)
+			return;
+#ifdef CONFIG_SQUASH3
+		_squ.remove_buffer(it->second.squash);
+#endif
+	}
+#ifdef CONFIG_SQUASH3
+	_squ.update_buffer(e.squash);
+#else
+	_squash_dirty = true;
+#endif
+	if (opt.dir_digests) {
+		auto x = get_relative_path(f);
+		if (e.type == FileType::Dir)
+			_mer.update_directory(x);
+		else
+			_mer.update_entry(x, e.digest);
+	}
+	_changed.insert(f);
+	_removed.erase(f);
+	_entry[f] = std::move(e);
+}
+
+std::map<std::string, Watch::Entry>::iterator Watch::erase_entry(
+	std::map<std::string, Entry>::iterator it) {
+#ifdef CONFIG_SQUASH3
+	_squ.remove_buffer(it->second.squash);
+#else
+	_squash_dirty = true;
+#endif
+	if (it->second.type != FileType::Dir)
+		_removed.insert(it->first);
+	_changed.erase(it->first);
+	return _entry.erase(it);
+}
+
+std::string Watch::get_relative_path(const std::string& f) const {
+	assert(f != _inp);
+	return _inp == "/" ? f.substr(1) : f.substr(_inp.size() + 1);
+}
+
+// print digests of input directory, then changed ones as they change
+int watch_input(const std::string& f) {
+	Watch w;
+	auto ret = w.init_watch(f);
+	if (ret < 0)
+		return ret;
+	w.print_change();
+	while (1) {
+		ret = w.read_event();
+		if (ret < 0)
+			return ret;
+		w.print_change();
+	}
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <fstream>
+
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void WatchTest::test_read_event(void) {
+	auto d = std::string(std::filesystem::temp_directory_path() /
+		("dirhash-cpp-watch-test." + std::to_string(getpid())));
+	std::filesystem::create_directories(d + "/x");
+	std::ofstream(d + "/a") << "a";
+	std::ofstream(d + "/x/b") << "b";
+
+	Watch w;
+	CPPUNIT_ASSERT_EQUAL(w.init_watch(d), 0);
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 3lu); // a, x, x/b
+	std::vector<char> b;
+	CPPUNIT_ASSERT(w.find_entry(d + "/a", b));
+	CPPUNIT_ASSERT(b == std::get<0>(get_string_hash("a", opt.hash_algo)));
+
+	std::ofstream(d + "/a") << "aa";
+	std::filesystem::create_directories(d + "/y");
+	std::ofstream(d + "/y/c") << "c";
+	std::filesystem::remove_all(d + "/x");
+	CPPUNIT_ASSERT_EQUAL(w.read_event(), 0);
+	CPPUNIT_ASSERT(w.find_entry(d + "/a", b));
+	CPPUNIT_ASSERT(b == std::get<0>(get_string_hash("aa", opt.hash_algo)));
+	CPPUNIT_ASSERT(w.find_entry(d + "/y/c", b));
+	CPPUNIT_ASSERT(!w.find_entry(d + "/x", b));
+	CPPUNIT_ASSERT(!w.find_entry(d + "/x/b", b));
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 3lu); // a, y, y/c
+	CPPUNIT_ASSERT_EQUAL(w.num_watch(), 2lu); // d, y
+
+	// moved out of tree, no longer watched
+	std::filesystem::rename(d + "/y", d + ".out");
+	CPPUNIT_ASSERT_EQUAL(w.read_event(), 0);
+	CPPUNIT_ASSERT(!w.find_entry(d + "/y/c", b));
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 1lu); // a
+	CPPUNIT_ASSERT_EQUAL(w.num_watch(), 1lu);
+	std::ofstream(d + ".out/z") << "z";
+	std::ofstream(d + "/a") << "aaa";
+	CPPUNIT_ASSERT_EQUAL(w.read_event(), 0);
+	CPPUNIT_ASSERT(!w.find_entry(d + "/y/z", b));
+	CPPUNIT_ASSERT_EQUAL(w.num_entry(), 1lu);
+	std::filesystem::remove_all(d + ".out");
+	std::filesystem::remove_all(d);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(WatchTest);
+#endif
@@ -0,0 +1,77 @@
+#ifndef SRC_WATCH_H_
+#define SRC_WATCH_H_
+
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <string>
+
+#include "./merkle.h"
+#include "./squash.h"
+#include "./util.h"
+
+// Live per file, squash and per directory digests of a directory tree,
+// kept current with inotify(7) after the initial walk.
+class Watch {
+	public:
+	Watch(void);
+	~Watch(void);
+	Watch(const Watch&) = delete;
+	Watch& operator=(const Watch&) = delete;
+	int init_watch(const std::string&);
+	int read_event(void);
+	void print_change(void);
+	bool find_entry(const std::string&, std::vector<char>&) const;
+	unsigned long num_entry(void) const {
+		return static_cast<unsigned long>(_entry.size());
+	}
+	unsigned long num_watch(void) const {
+		return static_cast<unsigned long>(_wd.size());
+	}
+
+	private:
+	struct Entry {
+		FileType type;
+		std::vector<char> digest;
+		std::vector<char> squash; // bytes appended to squash buffer
+	};
+	int scan_directory(const std::string&);
+	int update_path(const std::string&);
+	void remove_path(const std::string&);
+	void set_entry(const std::string&, Entry&&);
+	std::map<std::string, Entry>::iterator erase_entry(
+		std::map<std::string, Entry>::iterator);
+	std::string get_relative_path(const std::string&) const;
+
+	std::map<std::string, Entry> _entry; // by absolute path, sorted
+	std::unordered_map<int, std::string> _wd; // watched directories
+	std::set<std::string> _changed; // since last print_change
+	std::set<std::string> _removed; // since last print_change
+	std::map<std::string, std::vector<char>> _dir_digest; // last printed
+	std::vector<char> _squash_digest; // last printed
+	bool _squash_dirty;
+	Squash _squ;
+	Merkle _mer;
+	std::string _inp;
+	int _fd;
+};
+
+int watch_input(const std::string&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class WatchTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(WatchTest);
+	CPPUNIT_TEST(test_read_event);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_read_event(void);
+};
+#endif
+#endif // SRC_WATCH_H_
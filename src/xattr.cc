@@ -0,0 +1,128 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif
+
+#include "./util.h"
+#include "./xattr.h"
+
+namespace {
+const std::string XATTR_PREFIX("user.dirhash.");
+const char XATTR_VERSION = 1;
+const std::size_t XATTR_HEADER_SIZE = 1 + 8 + 8; // version, size, mtime_ns
+const std::size_t XATTR_MAX_SIZE = 256;
+} // namespace
+
+bool is_xattr_supported(void) {
+#ifdef __linux__
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::string get_xattr_name(const std::string& hash_algo) {
+	return XATTR_PREFIX + hash_algo;
+}
+
+// little endian regardless of host as it may be copied to other machines
+std::vector<char> encode_xattr_hash(const struct stat& st,
+	const std::vector<char>& b) {
+	std::vector<char> v{XATTR_VERSION};
+	put_le64(v, static_cast<std::uint64_t>(st.st_size));
+	put_le64(v, static_cast<std::uint64_t>(get_mtime_ns(st)));
+	v.insert(v.end(), b.begin(), b.end());
+	return v;
+}
+
+// valid only if size and mtime still match
+bool decode_xattr_hash(const std::vector<char>& v, const struct stat& st,
+	std::vector<char>& b) {
+	if (v.size() <= XATTR_HEADER_SIZE || v[0] != XATTR_VERSION)
+		return false;
+	if (get_le64(&v[1]) != static_cast<std::uint64_t>(st.st_size) ||
+		get_le64(&v[9]) != static_cast<std::uint64_t>(get_mtime_ns(st)))
+		return false;
+	b.assign(v.begin() + XATTR_HEADER_SIZE, v.end());
+	return true;
+}
+
+bool get_xattr_hash([[maybe_unused]]int fd,
+	[[maybe_unused]]const struct stat& st,
+	[[maybe_unused]]const std::string& hash_algo,
+	[[maybe_unused]]std::vector<char>& b) {
+#ifdef __linux__
+	std::vector<char> v(XATTR_MAX_SIZE);
+	auto n = fgetxattr(fd, get_xattr_name(hash_algo).c_str(), &v[0],
+		v.size());
+	if (n == -1)
+		return false;
+	v.resize(static_cast<std::size_t>(n));
+	return decode_xattr_hash(v, st, b);
+#else
+	return false;
+#endif
+}
+
+int set_xattr_hash([[maybe_unused]]int fd,
+	[[maybe_unused]]const struct stat& st,
+	[[maybe_unused]]const std::string& hash_algo,
+	[[maybe_unused]]const std::vector<char>& b) {
+#ifdef __linux__
+	auto v = encode_xattr_hash(st, b);
+	if (fsetxattr(fd, get_xattr_name(hash_algo).c_str(), v.data(),
+		v.size(), 0) == -1)
+		return -errno;
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestAssert.h>
+
+#include "./cppunit.h"
+
+void XattrTest::test_get_xattr_name(void) {
+	CPPUNIT_ASSERT_EQUAL(get_xattr_name("sha256"),
+		std::string("user.dirhash.sha256"));
+}
+
+void XattrTest::test_decode_xattr_hash(void) {
+	struct stat st;
+	std::memset(&st, 0, sizeof(st));
+	st.st_size = 12345;
+	st.st_mtim.tv_sec = 1700000000;
+	st.st_mtim.tv_nsec = 123;
+
+	std::vector<char> b1{'\x01', '\x02', '\xff'}, b;
+	auto v = encode_xattr_hash(st, b1);
+	CPPUNIT_ASSERT_EQUAL(v.size(), static_cast<std::size_t>(17 + 3));
+	CPPUNIT_ASSERT(decode_xattr_hash(v, st, b));
+	CPPUNIT_ASSERT(b == b1);
+
+	// modified
+	auto st2 = st;
+	st2.st_size++;
+	CPPUNIT_ASSERT(!decode_xattr_hash(v, st2, b));
+	st2 = st;
+	st2.st_mtim.tv_nsec++;
+	CPPUNIT_ASSERT(!decode_xattr_hash(v, st2, b));
+
+	// ctime doesn't matter
+	st2 = st;
+	st2.st_ctim.tv_sec++;
+	CPPUNIT_ASSERT(decode_xattr_hash(v, st2, b));
+
+	// broken
+	CPPUNIT_ASSERT(!decode_xattr_hash(std::vector<char>(17, '\x01'), st, b));
+	v[0] = 2;
+	CPPUNIT_ASSERT(!decode_xattr_hash(v, st, b));
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(XattrTest);
+#endif
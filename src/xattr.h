@@ -0,0 +1,38 @@
+#ifndef SRC_XATTR_H_
+#define SRC_XATTR_H_
+
+#include <vector>
+#include <string>
+
+#include <sys/stat.h>
+
+// message digest stored in user.dirhash.<hash algorithm> extended attribute
+bool is_xattr_supported(void);
+std::string get_xattr_name(const std::string&);
+std::vector<char> encode_xattr_hash(const struct stat&,
+	const std::vector<char>&);
+bool decode_xattr_hash(const std::vector<char>&, const struct stat&,
+	std::vector<char>&);
+bool get_xattr_hash(int, const struct stat&, const std::string&,
+	std::vector<char>&);
+int set_xattr_hash(int, const struct stat&, const std::string&,
+	const std::vector<char>&);
+
+#ifdef CONFIG_CPPUNIT
+#include <cppunit/TestFixture.h>
+#include <cppunit/TestSuite.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class XattrTest: public CPPUNIT_NS::TestFixture {
+	public:
+	CPPUNIT_TEST_SUITE(XattrTest);
+	CPPUNIT_TEST(test_get_xattr_name);
+	CPPUNIT_TEST(test_decode_xattr_hash);
+	CPPUNIT_TEST_SUITE_END();
+
+	private:
+	void test_get_xattr_name(void);
+	void test_decode_xattr_hash(void);
+};
+#endif
+#endif // SRC_XATTR_H_